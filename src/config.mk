@@ -13,6 +13,26 @@ UPLOAD_RESET = nodemcu
 FLASH_DEF = 4M3M
 #F_CPU=160000000
 
+# uncomment to use 12bit deep frame buffer (doubles frame buffer RAM usage)
+#BUILD_EXTRA_FLAGS += -DFRAME_BUFFER_FORMAT=frame_buffer_format_12bpp_t
+
+# uncomment to use 4bit packed frame buffer (16 levels; halves frame buffer RAM usage)
+#BUILD_EXTRA_FLAGS += -DFRAME_BUFFER_FORMAT=frame_buffer_format_4bpp_t
+
+# uncomment to use triple buffering (the UI never waits for vsync)
+#BUILD_EXTRA_FLAGS += -DFRAME_BUFFER_COUNT=3
+
+# BFF font glyph cache size in bytes and in glyphs (default: 8192 bytes, 192 glyphs)
+# The cache is taken from the heap at boot, 20 bytes per glyph plus the bytes
+# (12032 bytes by default); the boot log shows it as "Font glyph cache" and the
+# heap left after it as "Font free heap". If it does not fit, the BFF font is
+# unavailable and the marquee is not shown.
+# The cache has to hold every distinct glyph of the marquee at once; below that
+# each frame reads glyphs from flash again (at 4096 bytes, 316649 flash reads
+# per scroll and 18 times the draw cost). The minimum accepted is 6144 bytes
+# and 128 glyphs; raise both for marquees longer than about 150 characters.
+#BUILD_EXTRA_FLAGS += -DBFF_GLYPH_CACHE_BYTES=8192 -DBFF_GLYPH_CACHE_ENTRIES=192
+
 # flash rom layout:
 
 # start    size         content
@@ -31,6 +51,15 @@ SETTINGS_SPIFFS_SIZE=131072
 SETTINGS_FS_IMAGE=settings_fs.spiffs
 SETTINGS_SPIFFS_START=0x3c0000
 
+# the font is built by tools/bffc from BDF/PNG/BFF sources, e.g.
+#   bffc -r 20-7e -r 3000-30ff -o fonts/takaop.bff SOURCE.bdf
+# The font is appended to the main SPIFFS image, so it is flashed with the
+# FS image, not with the firmware. The shipped font is compressed by xor4,
+# which firmware older than the BFF compiler cannot decode; it draws blank
+# glyphs. Flash the firmware and the FS image together (combined_rom_image
+# holds both, for OTA). To go back to older firmware, flash it with the FS
+# image it was built with, or with one whose font is converted back, e.g.
+#   bffc -m rle-auto -o fonts/takaop-rle.bff fonts/takaop.bff
 BFF_FONT_FILE_NAME=fonts/takaop.bff
 BFF_FONT_FILE_START_ADDRESS=0x1e0000
 BUILD_EXTRA_FLAGS += -DNO_GLOBAL_SPIFFS -DMY_SPIFFS_SIZE=$(MY_SPIFFS_SIZE) \
@@ -61,6 +61,9 @@ static void console_usage()
 			"psk <psk>              - Set WiFi PSK(i.e. password)\r\n"
 			"wps                    - Virtually push WPS \"Push Button\"\r\n"
 			"reboot                 - Restart the system\r\n"
+			"phasecal [reset]       - Calibrate (or reset) LED scan phase schedule\r\n"
+			"                         (POST /settings/phasecal calibrates in normal mode,\r\n"
+			"                         under WiFi and I2S load)\r\n"
 			"\r\n"
 			"During this console mode, LED matrix will not propery work.\r\n"
 			"To go to normal mode, type \"reboot\".\r\n\r\n"
@@ -96,6 +99,16 @@ static void console_command(const String & line)
 		wifi_wps();
 		return;
 	}
+	else if(vec[0] == String(F("phasecal")))
+	{
+		if(vec.size() == 1)
+			led_start_phase_calibration();
+		else if(vec.size() == 2 && vec[1] == String(F("reset")))
+			led_reset_phase_schedule();
+		else
+			goto parameter_count_error;
+		return;
+	}
 	else if(vec[0] == String(F("reboot")))
 	{
 		if(vec.size() != 1) goto parameter_count_error;
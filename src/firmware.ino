@@ -156,12 +156,14 @@ void test_led_sel_row();
 static int init_state = 0;
 void loop() 
 {
+	led_encode_behind_beam();
 	wifi_check();
 	test_led_sel_row();
 	button_update();
 	sensors_check();
 	ui_process();
 	web_server_handle_client();
+	led_encode_behind_beam();
 
 	{
 		static ir_status_t last_ir_status = (ir_status_t)-1;
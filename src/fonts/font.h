@@ -1,7 +1,10 @@
 #ifndef FONT_H
 #define FONT_H
 
+#include <stdint.h>
+
 class frame_buffer_t;
+enum blit_mode_t : uint8_t;
 
 //! abstract simple font class
 class font_base_t
@@ -9,17 +12,41 @@ class font_base_t
 public:
 	struct metrics_t
 	{
-		int w;
+		int w; //!< advance in px, truncated
 		int h;
 		bool exist;
+		int advance_64; //!< advance in 1/64 px; w * 64 for fonts without fractional advances
 	};
 
+	//! Round a position in 1/64 px to px
+	static int round_64(int32_t v) { return (v + 32) >> 6; }
+
 	virtual int get_height() const = 0; //!< returns font's nominal height in px
 
 	virtual metrics_t get_metrics(int32_t chr) const = 0; //!< returns font metrics of given character code
 
-	virtual void put(int32_t chr, int level, int x, int y, frame_buffer_t & fb) const = 0;
+	virtual void put(int32_t chr, int level, int x, int y, frame_buffer_t & fb, blit_mode_t mode) const = 0;
 		//!< put a character to given framebuffer
+
+	//! Opaque reference to a glyph, given by find_glyph() and used by put_glyph().
+	//! The character code itself unless the font overrides these.
+	typedef intptr_t glyph_handle_t;
+
+	//! Look up a glyph; returns its metrics and the handle to it.
+	//! The handle stays valid as long as the font is; fonts which load
+	//! glyphs on demand load it again if evicted.
+	virtual metrics_t find_glyph(int32_t chr, glyph_handle_t & handle) const
+	{
+		handle = chr;
+		return get_metrics(chr);
+	}
+
+	//! put a glyph given by find_glyph() to given framebuffer
+	virtual void put_glyph(glyph_handle_t handle, int level, int x, int y,
+		frame_buffer_t & fb, blit_mode_t mode) const
+	{
+		put(static_cast<int32_t>(handle), level, x, y, fb, mode);
+	}
 };
 
 #endif
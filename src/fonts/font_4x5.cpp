@@ -9,17 +9,18 @@ struct glyph_vw_t
 	uint8_t bitmap[5];
 };
 
+//! a row of the glyph; the leftmost pixel in bit 0, as draw_mask() takes
 static constexpr unsigned char operator "" _b (const char *p, size_t)
 {
 	return
-		((p[0]!=' ') << 7) + 
-		((p[1]!=' ') << 6) + 
-		((p[2]!=' ') << 5) + 
-		((p[3]!=' ') << 4) + 
-		((p[4]!=' ') << 3) +
-		((p[5]!=' ') << 2) +
-		((p[6]!=' ') << 1) +
-		((p[7]!=' ') << 0) ;
+		((p[0]!=' ') << 0) + 
+		((p[1]!=' ') << 1) + 
+		((p[2]!=' ') << 2) + 
+		((p[3]!=' ') << 3) + 
+		((p[4]!=' ') << 4) +
+		((p[5]!=' ') << 5) +
+		((p[6]!=' ') << 6) +
+		((p[7]!=' ') << 7) ;
 }
 
 const PROGMEM glyph_vw_t font_4x5_data[]= {
@@ -190,60 +191,47 @@ const PROGMEM glyph_vw_t font_4x5_data[]= {
 }; 
 
 
+//! glyph index by code point - 0x20; for ' ' to 'h'.
+//! in RAM, as it is read for every character drawn
+static constexpr uint8_t NG = 0xff; // no glyph
+static const uint8_t font_4x5_index[] = {
+	10, NG, NG, NG, NG, 15, NG, 17, NG, NG, NG, NG, NG, 16, 11, NG, // 0x20 -
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 12, NG, NG, NG, NG, NG, // 0x30 -
+	NG, NG, NG, NG, NG, NG, NG, NG, NG, NG, NG, NG, NG, NG, NG, NG, // 0x40 -
+	NG, NG, NG, NG, NG, NG, NG, NG, NG, NG, NG, NG, NG, NG, NG, NG, // 0x50 -
+	NG, NG, NG, NG, NG, NG, NG, NG, 14, // 0x60 -
+};
+
 static int chr_to_index(int32_t chr)
 {
-	switch(chr)
+	uint32_t i = chr - 0x20;
+	if(i < sizeof(font_4x5_index))
 	{
-	case '0' ... '9': return chr - '0';
-	case ' ': return 10;
-	case '.': return 11;
-	case ':': return 12;
-	case L'℃': return 13;
-	case 'h': return 14;
-	case '%': return 15;
-	case '-': return 16;
-	case '\'': return 17;
-	default:;
+		uint8_t idx = font_4x5_index[i];
+		return idx == NG ? -1 : idx;
 	}
+	if(chr == L'℃') return 13;
 	return -1;
 }
 
 font_base_t::metrics_t font_4x5_t::get_metrics(int32_t chr) const
 {
 	int idx = chr_to_index(chr);
-	if(idx == -1) return metrics_t{0,0,false}; // not found
-	return metrics_t{pgm_read_byte( & (font_4x5_data[idx].width) ) + 1, 6, true};
+	if(idx == -1) return metrics_t{0, 0, false, 0}; // not found
+	int w = pgm_read_byte( & (font_4x5_data[idx].width) ) + 1;
+	return metrics_t{w, 6, true, w * 64};
 }
 
-void font_4x5_t::put(int32_t chr, int level, int x, int y, frame_buffer_t & fb) const
+void font_4x5_t::put(int32_t chr, int level, int x, int y, frame_buffer_t & fb, blit_mode_t mode) const
 {
-	int fx = 0, fy = 0;
-
 	// get glyph pointer
 	int idx = chr_to_index(chr);
 	if(idx == -1) return; // not found
 	const glyph_vw_t *p = font_4x5_data + idx;
 
-	// clip font bounding box
-	int w = pgm_read_byte( & (p->width) );
-	int h = 5;
-	if(!fb.clip(fx, fy, x, y, w, h)) return;
-
-	// pixel loop
-	for(int yy = y; yy < h+y; ++yy, ++fy)
-	{
-		unsigned char line = pgm_read_byte(p->bitmap + fy);
-//		Serial.printf("line %d: %02x\r\n", fy, line);
-		int fxx = fx;
-		for(int xx = x; xx < w+x; ++xx, ++fxx)
-		{
-			if(line & (1<<(7-fxx)))
-			{
-//				Serial.printf("%d %d %d %d \r\n", fxx, fy, xx, yy);
-				fb.set_point(xx, yy, level);
-			}
-		}
-	}
+	uint32_t rows[5];
+	for(int i = 0; i < 5; ++i) rows[i] = pgm_read_byte(p->bitmap + i);
+	fb.draw_mask(x, y, pgm_read_byte( & (p->width) ), 5, rows, level, mode);
 }
 
 font_4x5_t font_4x5;
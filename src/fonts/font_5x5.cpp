@@ -2,13 +2,14 @@
 #include "font_5x5.h"
 #include "frame_buffer.h"
 
+//! a row of the glyph; the leftmost pixel in bit 0, as draw_mask() takes
 static constexpr unsigned char operator "" _b (const char *p, size_t) {
 	return
-		((p[0]!=' ') << 4) + 
-		((p[1]!=' ') << 3) + 
+		((p[0]!=' ') << 0) + 
+		((p[1]!=' ') << 1) + 
 		((p[2]!=' ') << 2) + 
-		((p[3]!=' ') << 1) + 
-		((p[4]!=' ') << 0) ; 
+		((p[3]!=' ') << 3) + 
+		((p[4]!=' ') << 4) ; 
 	}
 const PROGMEM unsigned char font_5x5_data[][5] = {
 { // 0x21 !
@@ -766,24 +767,17 @@ font_base_t::metrics_t font_5x5_t::get_metrics(int32_t chr) const
 	if(chr < 0x20 || chr > 0x7e)
 	{
 		if(chr >= 0x2080 && chr <= 0x2089)
-			return metrics_t{4, 6, true};
+			return metrics_t{4, 6, true, 4 * 64};
 		if(chr == 0x208f)
-			return metrics_t{2, 6, true};
-		return metrics_t{0,0,false};
+			return metrics_t{2, 6, true, 2 * 64};
+		return metrics_t{0, 0, false, 0};
 	}
 	else
-		return metrics_t{6,6,true};
+		return metrics_t{6, 6, true, 6 * 64};
 }
 
-void font_5x5_t::put(int32_t chr, int level, int x, int y, frame_buffer_t & fb) const
+void font_5x5_t::put(int32_t chr, int level, int x, int y, frame_buffer_t & fb, blit_mode_t mode) const
 {
-	int fx = 0, fy = 0;
-	int w = 5, h = 5;
-
-	// clip font bounding box
-	if(!fb.clip(fx, fy, x, y, w, h)) return;
-
-
 	// draw the pattern
 	const unsigned char *p = nullptr;
 
@@ -797,20 +791,9 @@ void font_5x5_t::put(int32_t chr, int level, int x, int y, frame_buffer_t & fb)
 	// return if thereis nothing to draw
 	if(!p) return;
 
-	for(int yy = y; yy < h+y; ++yy, ++fy)
-	{
-		unsigned char line = pgm_read_byte(p + fy);
-//		Serial.printf("line %d: %02x\r\n", fy, line);
-		int fxx = fx;
-		for(int xx = x; xx < w+x; ++xx, ++fxx)
-		{
-			if(line & (1<<(4-fxx)))
-			{
-//				Serial.printf("%d %d %d %d \r\n", fxx, fy, xx, yy);
-				fb.set_point(xx, yy, level);
-			}
-		}
-	}
+	uint32_t rows[5];
+	for(int i = 0; i < 5; ++i) rows[i] = pgm_read_byte(p + i);
+	fb.draw_mask(x, y, 5, 5, rows, level, mode);
 }
 
 font_5x5_t font_5x5;
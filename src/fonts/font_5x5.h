@@ -11,7 +11,7 @@ public:
 
 	virtual metrics_t get_metrics(int32_t chr) const;
 
-	virtual void put(int32_t chr, int level, int x, int y, frame_buffer_t & fb) const;
+	virtual void put(int32_t chr, int level, int x, int y, frame_buffer_t & fb, blit_mode_t mode) const;
 };
 
 extern font_5x5_t font_5x5;
@@ -5,60 +5,46 @@
 #include "font_aa.h"
 
 
-const glyph_t * font_aa_t::get_glyph(int32_t chr) const
+font_aa_t::font_aa_t(const glyph_header_t &glyph_header_) :
+	glyph_header(glyph_header_),
+	index(glyph_header_.index),
+	first_code_point(pgm_read_dword(&glyph_header_.first_code_point)),
+	index_size(pgm_read_dword(&glyph_header_.index_size))
 {
-	int count = pgm_read_dword(&glyph_header.num_glyphs);
-
-	uint32_t s = 0;
-	uint32_t e = count;
-	const glyph_t * g = nullptr;
-
-	do
-	{
-		uint32_t m = (s+e)/2;
-		switch(e - s)
-		{
-		case 0:
-			// nothing found
-			return nullptr;
-
-		case 1:
-			// last one found
-			g = glyph_header.array + m;
-			if(pgm_read_dword(&g->code_point) == chr)
-				return g; // found
-			return nullptr; // not found
-
-		default:
-			// do binary search
-			g = glyph_header.array + m;
-			int cp = pgm_read_dword(&g->code_point);
-			if(cp == chr)
-				return g; // found
-			if(cp < chr)
-				s = m;
-			else
-				e = m;
-		}
-	} while(1);
-
+}
 
+const glyph_t * font_aa_t::get_glyph(int32_t chr) const
+{
+	// direct lookup in the dense index table; no PROGMEM access
+	uint32_t i = chr - first_code_point;
+	if(i >= index_size) return nullptr;
+	uint8_t idx = index[i];
+	if(idx == glyph_header_t::NO_GLYPH) return nullptr;
+	return glyph_header.array + idx;
 }
 
 int font_aa_t::get_height() const
 {
-	return pgm_read_dword(&glyph_header.nominal_height);
+	return pgm_read_byte(&glyph_header.nominal_height);
 }
 
 font_base_t::metrics_t font_aa_t::get_metrics(int32_t chr) const
+{
+	glyph_handle_t handle;
+	return find_glyph(chr, handle);
+}
+
+font_base_t::metrics_t font_aa_t::find_glyph(int32_t chr, glyph_handle_t & handle) const
 {
 	const glyph_t * g = get_glyph(chr);
+	handle = reinterpret_cast<glyph_handle_t>(g);
 	metrics_t r;
 	if(g)
 	{
 		r.w = pgm_read_byte(&g->ascend_x);
 		r.h = pgm_read_byte(&g->h);
 		r.exist = true;
+		r.advance_64 = r.w * 64;
 	}
 	else
 	{
@@ -67,9 +53,19 @@ font_base_t::metrics_t font_aa_t::get_metrics(int32_t chr) const
 	return r;
 }
 
-void font_aa_t::put(int32_t chr, int level, int x, int y, frame_buffer_t & fb) const
+void font_aa_t::put(int32_t chr, int level, int x, int y, frame_buffer_t & fb, blit_mode_t mode) const
+{
+	put(get_glyph(chr), level, x, y, fb, mode);
+}
+
+void font_aa_t::put_glyph(glyph_handle_t handle, int level, int x, int y,
+	frame_buffer_t & fb, blit_mode_t mode) const
+{
+	put(reinterpret_cast<const glyph_t *>(handle), level, x, y, fb, mode);
+}
+
+void font_aa_t::put(const glyph_t * g, int level, int x, int y, frame_buffer_t & fb, blit_mode_t mode) const
 {
-	const glyph_t * g = get_glyph(chr);
 	if(!g) return;	
 
 	int fx = 0, fy = 0;
@@ -84,19 +80,10 @@ void font_aa_t::put(int32_t chr, int level, int x, int y, frame_buffer_t & fb) c
 
 	for(int yy = y; yy < h+y; ++yy, ++fy)
 	{
-		const unsigned char * line = p + fy * w;
-		int fxx = fx;
-		for(int xx = x; xx < w+x; ++xx, ++fxx)
-		{
-			int alpha = pgm_read_byte(line + fxx);
-			if(alpha)
-			{
-				int v = fb.get_point(xx, yy);
-				v = alpha;
-//				v = (((level - v) * alpha) >> 8 ) + v; // TODO: exact calculation
-				fb.set_point(xx, yy, v);
-			}
-		}
+		const unsigned char * line = p + fy * stride;
+		uint8_t alpha[LED_MAX_LOGICAL_COL];
+		memcpy_P(alpha, line + fx, w);
+		fb.blend_row(x, yy, w, alpha, level, mode);
 	}
 }
 
@@ -7,17 +7,27 @@
 class font_aa_t : public font_base_t
 {
 	const glyph_header_t & glyph_header;
+	const uint8_t * index; //!< copy of glyph_header.index
+	int32_t first_code_point; //!< copy of glyph_header.first_code_point
+	uint32_t index_size; //!< copy of glyph_header.index_size
 
 	const glyph_t * get_glyph(int32_t chr) const; 
 
+	void put(const glyph_t * g, int level, int x, int y, frame_buffer_t & fb, blit_mode_t mode) const;
+
 public:
-	font_aa_t(const glyph_header_t &glyph_header_) : glyph_header(glyph_header_) {}
+	font_aa_t(const glyph_header_t &glyph_header_);
 
 	virtual int get_height() const; // including space
 
 	virtual metrics_t get_metrics(int32_t chr) const;
 
-	virtual void put(int32_t chr, int level, int x, int y, frame_buffer_t & fb) const;
+	virtual void put(int32_t chr, int level, int x, int y, frame_buffer_t & fb, blit_mode_t mode) const;
+
+	virtual metrics_t find_glyph(int32_t chr, glyph_handle_t & handle) const;
+
+	virtual void put_glyph(glyph_handle_t handle, int level, int x, int y,
+		frame_buffer_t & fb, blit_mode_t mode) const;
 };
 
 
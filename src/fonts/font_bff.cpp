@@ -1,5 +1,7 @@
 #include <Arduino.h>
 #include <unistd.h>
+#include <algorithm>
+#include <new>
 
 using namespace std;
 
@@ -9,30 +11,311 @@ using namespace std;
 
 bff_font_t font_bff;
 
-bff_font_t::glyph_cache_t::ptr_t bff_font_t::glyph_cache_t::find_and_touch(int32_t code_point)
+
+void flash_linear_file_t::invalidate()
+{
+	for(auto && b : blocks) b.addr = invalid_addr, b.last_used = 0;
+}
+
+const uint8_t * flash_linear_file_t::get_block(uint32_t addr)
+{
+	++ use_count;
+
+	block_t * victim = blocks;
+	for(auto && b : blocks)
+	{
+		if(b.addr == addr)
+		{
+			++ hits;
+			b.last_used = use_count;
+			return reinterpret_cast<const uint8_t *>(b.data);
+		}
+		if(b.last_used < victim->last_used) victim = &b;
+	}
+
+	// not found; evict the least recently used one
+	++ misses;
+	if(!ESP.flashRead(addr, victim->data, block_size))
+	{
+		victim->addr = invalid_addr;
+		victim->last_used = 0;
+		return nullptr;
+	}
+	victim->addr = addr;
+	victim->last_used = use_count;
+	return reinterpret_cast<const uint8_t *>(victim->data);
+}
+
+uint32_t flash_linear_file_t::read(uint8_t * dest, uint32_t size)
+{
+	uint32_t addr = start_addr + current_offs;
+	uint32_t remain = size;
+	while(remain)
+	{
+		uint32_t block_addr = addr & ~(block_size - 1);
+		uint32_t offs = addr - block_addr;
+		uint32_t n = std::min(remain, block_size - offs);
+		const uint8_t * block = get_block(block_addr);
+		if(!block) return 0;
+		memcpy(dest, block + offs, n);
+		dest += n, addr += n, remain -= n;
+	}
+	current_offs += size;
+	return size;
+}
+
+bool bff_glyph_cache_t::allocate()
+{
+	if(!get_available())
+	{
+		release();
+		entries = new (std::nothrow) entry_t[num_entries];
+		arena = new (std::nothrow) uint8_t[arena_size];
+		if(!get_available())
+		{
+			release();
+			return false;
+		}
+	}
+	clear();
+	return true;
+}
+
+void bff_glyph_cache_t::release()
+{
+	delete [] entries;
+	delete [] arena;
+	entries = nullptr;
+	arena = nullptr;
+	clear();
+}
+
+void bff_glyph_cache_t::clear()
+{
+	if(entries)
+		for(uint32_t i = 0; i < num_entries; ++i) entries[i].code_point = -1;
+	for(auto && b : buckets) b = none;
+	arena_top = 0;
+	hand = 0;
+	stats = stats_t();
+}
+
+uint8_t bff_glyph_cache_t::find(int32_t code_point)
+{
+	for(uint8_t i = buckets[hash(code_point)]; i != none; i = entries[i].next)
+	{
+		if(entries[i].code_point == code_point)
+		{
+			entries[i].referenced = true;
+			++ stats.hits;
+			return i;
+		}
+	}
+	++ stats.misses;
+	return none;
+}
+
+bool bff_glyph_cache_t::touch(uint8_t idx, int32_t code_point)
+{
+	if(idx >= num_entries || entries[idx].code_point != code_point) return false;
+	entries[idx].referenced = true;
+	++ stats.hits;
+	return true;
+}
+
+void bff_glyph_cache_t::remove(uint8_t idx)
+{
+	entry_t & e = entries[idx];
+
+	// unlink from the hash chain
+	uint8_t * link = &buckets[hash(e.code_point)];
+	while(*link != idx) link = &entries[*link].next;
+	*link = e.next;
+
+	stats.arena_used -= e.get_bitmap_size();
+	-- stats.entries_used;
+	e.code_point = -1;
+}
+
+void bff_glyph_cache_t::evict_one()
 {
-	for(auto && i : array)
+	// the caller ensures at least one entry is used,
+	// so this ends within two turns of the hand
+	for(;;)
 	{
-		if(i && i->glyph_info.code_point == code_point)
+		uint8_t idx = hand;
+		entry_t & e = entries[idx];
+		if(++ hand == num_entries) hand = 0;
+		if(e.code_point < 0) continue;
+		if(e.referenced)
 		{
-			// found; bring it to the top
-			std::swap(i, array[top_point]);
-			return array[top_point];
+			// give a second chance
+			e.referenced = false;
+			continue;
 		}
+		remove(idx);
+		++ stats.evictions;
+		return;
 	}
-	return ptr_t();
 }
 
+void bff_glyph_cache_t::compact()
+{
+	// list entries having bitmap, in order of the offset
+	uint8_t order[num_entries];
+	uint32_t n = 0;
+	for(uint32_t i = 0; i < num_entries; ++i)
+		if(entries[i].code_point >= 0 && entries[i].get_bitmap_size())
+			order[n++] = i;
+	std::sort(order, order + n, [this](uint8_t a, uint8_t b) {
+		return entries[a].offset < entries[b].offset; });
+
+	// slide bitmaps down
+	uint32_t top = 0;
+	for(uint32_t i = 0; i < n; ++i)
+	{
+		entry_t & e = entries[order[i]];
+		uint32_t size = e.get_bitmap_size();
+		if(e.offset != top) memmove(arena + top, arena + e.offset, size);
+		e.offset = top;
+		top += size;
+	}
+	arena_top = top;
+	++ stats.compactions;
+}
 
-void bff_font_t::glyph_cache_t::insert(ptr_t glyph)
+uint8_t bff_glyph_cache_t::insert(const entry_t & entry)
 {
-	array[top_point] = glyph;
-	++ top_point;
-	if(top_point == array.size()) top_point = 0;
+	entry_t ne = entry;
+	uint32_t size = ne.get_bitmap_size();
+	if(size > arena_size) ne.bb_w = ne.bb_h = size = 0; // never fits
+
+	if(stats.entries_used == num_entries) evict_one();
+
+	if(arena_top + size > arena_size)
+	{
+		// make enough room at once so that compaction does not occur at every insertion
+		uint32_t limit = arena_size - arena_size / 4;
+		if(size > limit) limit = arena_size;
+		while(stats.entries_used && stats.arena_used + size > limit) evict_one();
+		compact();
+	}
+
+	uint8_t idx = 0;
+	while(entries[idx].code_point >= 0) ++idx;
+
+	ne.offset = arena_top;
+	ne.referenced = true;
+	uint32_t h = hash(ne.code_point);
+	ne.next = buckets[h];
+	buckets[h] = idx;
+	entries[idx] = ne;
+
+	arena_top += size;
+	stats.arena_used += size;
+	++ stats.entries_used;
+	return idx;
 }
 
 
 
+bool bff_code_point_index_t::allocate(uint32_t _num_glyphs, uint32_t num_bits)
+{
+	clear();
+	num_glyphs = _num_glyphs;
+	num_blocks = (num_glyphs + block_size - 1) / block_size;
+	num_stream_bytes = (num_bits + 7) / 8 + 4; // peek() reads 4 bytes
+	block_code_points = new uint32_t[num_blocks];
+	block_positions = new uint32_t[num_blocks];
+	stream = new uint8_t[num_stream_bytes];
+	if(!block_code_points || !block_positions || !stream)
+	{
+		clear();
+		return false;
+	}
+	memset(stream, 0, num_stream_bytes);
+	return true;
+}
+
+void bff_code_point_index_t::put_bit(uint32_t bit)
+{
+	if(bit) stream[pos >> 3] |= 1 << (pos & 7);
+	++ pos;
+}
+
+void bff_code_point_index_t::append(uint32_t code_point)
+{
+	if(count % block_size == 0)
+	{
+		// start of a block
+		block_code_points[count / block_size] = code_point;
+		block_positions[count / block_size] = pos;
+	}
+	else
+	{
+		uint32_t v = code_point - last - 1;
+		if(v < escape_gap)
+		{
+			while(v--) put_bit(0);
+			put_bit(1);
+		}
+		else
+		{
+			for(uint32_t i = 0; i < escape_gap; ++i) put_bit(0);
+			for(uint32_t i = 0; i < raw_bits; ++i) put_bit(v & (1 << i));
+		}
+	}
+	last = code_point;
+	++ count;
+}
+
+void bff_code_point_index_t::clear()
+{
+	delete [] block_code_points;
+	delete [] block_positions;
+	delete [] stream;
+	block_code_points = block_positions = nullptr;
+	stream = nullptr;
+	num_glyphs = num_blocks = num_stream_bytes = 0;
+	count = last = pos = 0;
+}
+
+int32_t bff_code_point_index_t::find(uint32_t code_point) const
+{
+	// find the last block which starts at or before the code point
+	uint32_t s = 0, e = num_blocks;
+	while(e - s > 1)
+	{
+		uint32_t m = (s + e) / 2;
+		if(block_code_points[m] <= code_point) s = m; else e = m;
+	}
+	if(num_blocks == 0 || block_code_points[s] > code_point) return -1;
+
+	// decode the block until the code point is reached
+	uint32_t idx = s * block_size;
+	uint32_t end = idx + block_size;
+	if(end > num_glyphs) end = num_glyphs;
+	uint32_t cp = block_code_points[s];
+	uint32_t p = block_positions[s];
+	while(cp < code_point && ++idx < end)
+	{
+		uint32_t w = peek(p);
+		uint32_t v = w ? __builtin_ctz(w) : escape_gap; // number of leading 0s
+		if(v < escape_gap)
+		{
+			p += v + 1;
+		}
+		else
+		{
+			v = peek(p + escape_gap) & ((1U << raw_bits) - 1);
+			p += escape_gap + raw_bits;
+		}
+		cp += v + 1;
+	}
+	return cp == code_point && idx < end ? (int32_t)idx : -1;
+}
+
+
 bff_font_t::bff_font_t() :
 	file(),
 	chrm_size(0),
@@ -119,6 +402,16 @@ void bff_font_t::begin(uint32_t start_addr)
 
 Serial.printf_P(PSTR("Font nominal height: %d\r\n"), nominal_height);
 Serial.printf_P(PSTR("Font num_glyphs    : %d\r\n"), num_glyphs);
+	// the glyph cache is mandatory, so it goes first; the index is not
+	if(!glyph_cache.allocate())
+	{
+		Serial.printf_P(PSTR("Font glyph cache of %d bytes not allocated; free heap %d\r\n"),
+			bff_glyph_cache_t::memory_size, ESP.getFreeHeap());
+		goto error;
+	}
+Serial.printf_P(PSTR("Font glyph cache   : %d\r\n"), bff_glyph_cache_t::memory_size);
+	build_index();
+Serial.printf_P(PSTR("Font free heap     : %d\r\n"), ESP.getFreeHeap());
 	available = true;
 
 	return;
@@ -139,9 +432,59 @@ void bff_font_t::disable()
 	// Mainly used for firmware OTA; During OTA, font data will be overwritten
 	// and being unstable.
 	available = false;
+	file.invalidate();
+
+	// give the memory back for the update
+	glyph_cache.release();
+	code_point_index.clear();
 }
 
 
+/**
+ * Call func with each code point in the char map in order. Stops and
+ * returns false when func returns false or on read error.
+ */
+template <typename FUNC>
+bool bff_font_t::for_each_code_point(FUNC func) const
+{
+	constexpr uint32_t chunk = 8; // records per read
+	uint32_t buf[chunk * 8]; // 32 bytes per record
+	for(uint32_t i = 0; i < num_glyphs; i += chunk)
+	{
+		uint32_t n = num_glyphs - i < chunk ? num_glyphs - i : chunk;
+		file.seek(chrm_offs + i * (4*8));
+		if(n * (4*8) != file.read(reinterpret_cast<uint8_t*>(buf), n * (4*8)))
+			return false;
+		for(uint32_t j = 0; j < n; ++j)
+			if(!func(buf[j * 8])) return false; // TODO: endianness
+	}
+	return true;
+}
+
+void bff_font_t::build_index()
+{
+	// measure the bit stream; code points must be ascending
+	uint32_t num_bits = 0, count = 0, last = 0;
+	bool ok = for_each_code_point([&](uint32_t cp) -> bool {
+		if(count && cp <= last) return false;
+		if(count % bff_code_point_index_t::block_size)
+			num_bits += bff_code_point_index_t::gap_bits(cp - last);
+		last = cp;
+		++ count;
+		return true;
+	});
+
+	if(ok) ok = code_point_index.allocate(num_glyphs, num_bits);
+	if(ok) ok = for_each_code_point([&](uint32_t cp) -> bool { code_point_index.append(cp); return true; });
+	if(!ok)
+	{
+		code_point_index.clear();
+		Serial.printf_P(PSTR("Font index unavailable; searching on flash\r\n"));
+		return;
+	}
+Serial.printf_P(PSTR("Font index size    : %d\r\n"), code_point_index.get_memory_size());
+}
+
 bff_font_t::glyph_info_t bff_font_t::get_glyph_info_by_index(uint32_t index) const
 {
 	glyph_info_t info;
@@ -158,6 +501,16 @@ bff_font_t::glyph_info_t bff_font_t::get_glyph_info_by_index(uint32_t index) con
 
 bff_font_t::glyph_info_t bff_font_t::get_glyph_info(uint32_t codepoint) const
 {
+	if(code_point_index.get_available())
+	{
+		// search in RAM; only the record found is read from flash
+		int32_t idx = code_point_index.find(codepoint);
+		glyph_info_t info;
+		if(idx >= 0) info = get_glyph_info_by_index(idx);
+		if(idx < 0 || info.code_point != (int32_t)codepoint) info.code_point = 0;
+		return info;
+	}
+
 	// all glyphs in BFF are sorted by its codepoint;
 	// so we can use binary search here.
 	uint32_t s = 0;
@@ -201,47 +554,108 @@ bff_font_t::glyph_info_t bff_font_t::get_glyph_info(uint32_t codepoint) const
 
 }
 
-std::shared_ptr<bff_font_t::glyph_t> bff_font_t::get_glyph(uint32_t codepoint) const
+//! 7bit grayscale to 8bit grayscale, then to 4bit
+static constexpr uint8_t bff_level_4bit(int v) { return (((v << 1) + (v >> 6)) + 8) / 17; }
+
+#define BFF_L4(N) bff_level_4bit((N)), bff_level_4bit((N)+1), \
+	bff_level_4bit((N)+2), bff_level_4bit((N)+3),
+#define BFF_L16(N) BFF_L4(N) BFF_L4((N)+4) BFF_L4((N)+8) BFF_L4((N)+12)
+
+static const uint8_t bff_level_4bit_table[128] = {
+	BFF_L16(0) BFF_L16(16) BFF_L16(32) BFF_L16(48)
+	BFF_L16(64) BFF_L16(80) BFF_L16(96) BFF_L16(112) };
+
+/**
+ * Streaming decoder of BFF glyph bitmaps.
+ * The run-length stream is decoded into a small span buffer, as the former
+ * decoder did into the whole bitmap, so that the per-byte loop stays as
+ * tight as possible. Each full span then goes through the differentiation
+ * (if DIFF) and the conversion to 4bpp at once, two pixels to a byte of
+ * the bitmap. The compressed data is read from the current position of
+ * file in chunks, so that no heap is needed.
+ */
+template <bool DIFF>
+static void bff_decode_bitmap(flash_linear_file_t & file, uint32_t compressed_size,
+	uint32_t bb_w, uint32_t size, uint8_t * bitmap)
 {
-	glyph_info_t info = get_glyph_info(codepoint);
-
-	if(info.code_point == 0)
-		return std::shared_ptr<glyph_t>(new glyph_t(codepoint)); // returns non-existent glyph
-	std::shared_ptr<glyph_t> g(new glyph_t(info));
+	static constexpr uint32_t span_size = 256;
+	uint8_t span[span_size + 128]; // run-length decoded bytes; up to two runs may go past span_size
+	uint8_t * ucd = span;
+	uint8_t col[bff_font_t::MAX_GLYPH_WIDTH] = {0}; // vertical sums for the differentiation
+	uint32_t x = 0; // column of the next pixel
+	uint8_t prev = 0; // horizontal sum for the differentiation
+	uint32_t left = size; // number of pixels left
+	uint8_t * out = bitmap;
+
+	// converts the first n bytes of the span into the bitmap; n must be
+	// even but at the end of the bitmap
+	auto convert = [&](uint32_t n) {
+		if(n > left) n = left;
+		left -= n;
+		if(DIFF)
+		{
+			// differentiation and 7bit to 4bit conversion in place, a row at a time
+			for(uint32_t i = 0; i < n; )
+			{
+				uint32_t w = std::min(n - i, bb_w - x);
+				uint8_t * p = span + i;
+				uint8_t * c = col + x;
+				for(uint32_t j = 0; j < w; ++j)
+				{
+					c[j] += p[j];
+					prev = (c[j] + prev) & 0x7f;
+					p[j] = bff_level_4bit_table[prev];
+				}
+				i += w;
+				x += w;
+				if(x == bb_w) x = 0;
+			}
+		}
+		else
+		{
+			for(uint32_t i = 0; i < n; ++i) span[i] = bff_level_4bit_table[span[i] & 0x7f];
+		}
 
-	// uncompress the bitmap data
-	uint8_t * compressed_data = nullptr;
-	uint32_t compression_method = (info.flags & FLAGS_COMPRESSION_METHOD_MASK);
-	if(info.bb_w > 0 && info.bb_h > 0 && info.compressed_size > 0 &&
-		info.bitmap_offset != 0 &&
-		(
-			compression_method == FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH_DIFF ||
-			compression_method == FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH )
-		
-		)
+		// two pixels to a byte
+		const uint8_t * p = span;
+		for(const uint8_t * e = span + (n & ~1u); p < e; p += 2) *(out++) = p[0] | (p[1] << 4);
+		if(n & 1) *(out++) = *p;
+	};
+
+	// process run-length
+	uint8_t chunk[64];
+	uint32_t remain = compressed_size;
+	bool split = false; // whether the chunk begins with the value of a non-zero running
+	uint8_t split_count = 0; // count of that non-zero running
+	while(left && remain)
 	{
+		uint32_t n = std::min<uint32_t>(remain, sizeof(chunk));
+		if(n != file.read(chunk, n)) break;
+		remain -= n;
 
-		compressed_data = new uint8_t [info.compressed_size] ;
-		file.seek(btmp_offs + info.bitmap_offset);
-		if(info.compressed_size !=
-			file.read(compressed_data, info.compressed_size))
-				goto error;
-
-		// process run-length
-		unsigned int bitmap_size = info.bb_w * info.bb_h;
-		uint8_t * cd = compressed_data;
-		uint8_t * cd_limit = compressed_data + info.compressed_size;
-		uint8_t * ucd = g->bitmap;
-		uint8_t * ucd_limit = ucd + bitmap_size;
-
-//fprintf(stderr, "flags:%d comp_size:%d uncomp_size:%d\n", info.flags, info.compressed_size, bitmap_size);
-
-		while(ucd < ucd_limit && cd < cd_limit)
+		const uint8_t * cd = chunk;
+		const uint8_t * cd_limit = chunk + n;
+		if(split)
 		{
+			memset(ucd, *(cd++), split_count);
+			ucd += split_count;
+			split = false;
+		}
+		while(cd < cd_limit)
+		{
+			if(ucd >= span + span_size)
+			{
+				// the span is full
+				convert(span_size);
+				if(!left) break;
+				ucd -= span_size;
+				memcpy(span, span + span_size, ucd - span);
+			}
+
 			uint8_t ccd = *(cd++);
 			if(ccd & 0x80)
 			{
-				*(ucd++) = ccd; // literal
+				*(ucd++) = ccd; // literal; most frequent
 			}
 			else
 			{
@@ -250,110 +664,248 @@ std::shared_ptr<bff_font_t::glyph_t> bff_font_t::get_glyph(uint32_t codepoint) c
 				if(ccd & 0x40)
 				{
 					// non-zero running
-					if(cd >= cd_limit) break;
-					v = *(cd ++);
+					if(cd == cd_limit)
+					{
+						// the value is in the next chunk
+						split = true;
+						split_count = count;
+						break;
+					}
+					v = *(cd++);
 				}
-				// fill
-				while(ucd < ucd_limit && count --)
-					*(ucd++) = v;
+				memset(ucd, v, count);
+				ucd += count;
 			}
 		}
-//fprintf(stderr, "%p %p %p %p\n", cd, cd_limit, ucd, ucd_limit);
+	}
+
+	// remaining bytes, then zeros for broken data
+	convert(ucd - span);
+	while(left)
+	{
+		memset(span, 0, span_size);
+		convert(span_size);
+	}
+}
 
-		ucd = g->bitmap;
-		if(compression_method == FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH_DIFF)
+/**
+ * Decoder of XOR4 compressed glyph bitmaps.
+ * Pixels are 4bit, each XORed with the pixel above (zero for the first
+ * row), in raster order. The stream is a sequence of LEB128 varint tokens;
+ * an even token t is a run of (t >> 1) + 1 zeros, that is, pixels same as
+ * above, and an odd token t is followed by (t >> 1) + 1 literal pixels,
+ * packed two in a byte from the lower nibble. The output is the 4bpp
+ * bitmap of the glyph cache, so pixels are copied from the row above in
+ * place.
+ */
+static void bff_decode_bitmap_xor4(flash_linear_file_t & file, uint32_t compressed_size,
+	uint32_t bb_w, uint32_t size, uint8_t * bitmap)
+{
+	uint8_t chunk[64];
+	const uint8_t * cd = chunk, * cd_limit = chunk;
+	uint32_t remain = compressed_size;
+	uint32_t pos = 0; // pixel position in the bitmap
+
+	// returns the next byte of the stream, or -1 at the end
+	auto next = [&]() -> int {
+		if(cd == cd_limit)
 		{
-			// process differentiation
-			for(int i = info.bb_w; i < bitmap_size; ++i)
-				ucd[i] += ucd[i - info.bb_w];
+			uint32_t n = std::min<uint32_t>(remain, sizeof(chunk));
+			if(n == 0 || n != file.read(chunk, n)) return -1;
+			remain -= n;
+			cd = chunk, cd_limit = chunk + n;
+		}
+		return *(cd++);
+	};
+
+	auto above = [&]() -> uint32_t {
+		if(pos < bb_w) return 0;
+		uint32_t p = pos - bb_w;
+		return (bitmap[p >> 1] >> ((p & 1) << 2)) & 0x0f;
+	};
+
+	auto put = [&](uint32_t n) {
+		if(pos & 1)
+			bitmap[pos >> 1] |= n << 4;
+		else
+			bitmap[pos >> 1] = n;
+		++ pos;
+	};
 
-			uint8_t prev = 0;
-			for(int i = 0; i< bitmap_size ; ++i)
+	while(pos < size)
+	{
+		// read a token
+		uint32_t t = 0;
+		int c;
+		for(uint32_t shift = 0; ; shift += 7)
+		{
+			c = next();
+			if(c < 0) goto broken;
+			t |= (c & 0x7f) << shift;
+			if(!(c & 0x80)) break;
+		}
+
+		uint32_t count = (t >> 1) + 1;
+		if(count > size - pos) count = size - pos;
+		if(!(t & 1))
+		{
+			// same as above
+			if(!(pos & 1) && !(bb_w & 1) && pos >= bb_w)
 			{
-				uint8_t v = (ucd[i] + prev) & 0x7f;
-				prev = v;
-				v = (v << 1) + (v >> 6); // 7bit grayscale to 8bit grayscale
-				ucd[i] =  v;
+				// two pixels per byte; rows are byte aligned
+				uint8_t * d = bitmap + (pos >> 1);
+				const uint8_t * s = d - (bb_w >> 1);
+				for(uint32_t i = count >> 1; i; --i) *(d++) = *(s++);
+				pos += count & ~1U;
+				count &= 1;
 			}
+			for(; count; --count) put(above());
 		}
 		else
 		{
-			for(int i = 0; i< bitmap_size ; ++i)
+			// literals
+			for(; count; count -= count > 1 ? 2 : 1)
 			{
-				uint8_t v = ucd[i] & 0x7f;
-				v = (v << 1) + (v >> 6); // 7bit grayscale to 8bit grayscale
-				ucd[i] =  v;
+				c = next();
+				if(c < 0) goto broken;
+				put((c & 0x0f) ^ above());
+				if(count > 1) put((c >> 4) ^ above());
 			}
 		}
 	}
+	return;
 
+broken:
+	while(pos < size) put(above());
+}
 
-error:
-	if(compressed_data) delete [] compressed_data;
-	return g;
+void bff_font_t::decode_bitmap(const glyph_info_t & info, uint8_t * bitmap) const
+{
+	file.seek(btmp_offs + info.bitmap_offset);
+	switch(info.flags & FLAGS_COMPRESSION_METHOD_MASK)
+	{
+	case FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH_DIFF:
+		bff_decode_bitmap<true>(file, info.compressed_size, info.bb_w, info.bb_w * info.bb_h, bitmap);
+		break;
+	case FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH:
+		bff_decode_bitmap<false>(file, info.compressed_size, info.bb_w, info.bb_w * info.bb_h, bitmap);
+		break;
+	case FLAGS_COMPRESSION_METHOD_XOR4:
+		bff_decode_bitmap_xor4(file, info.compressed_size, info.bb_w, info.bb_w * info.bb_h, bitmap);
+		break;
+	}
 }
 
-std::shared_ptr<bff_font_t::glyph_t> bff_font_t::get_glyph_with_caching(uint32_t codepoint) const
+uint8_t bff_font_t::get_glyph(int32_t codepoint) const
 {
 	// find in cache
-	std::shared_ptr<glyph_t> ptr = glyph_cache.find_and_touch(codepoint);
-	if(!ptr)
+	uint8_t idx = glyph_cache.find(codepoint);
+	if(idx != bff_glyph_cache_t::none) return idx;
+
+	// not found in the cache; retrieve and insert to the cache
+	glyph_info_t info = get_glyph_info(codepoint);
+	bff_glyph_cache_t::entry_t e = bff_glyph_cache_t::entry_t();
+	e.code_point = codepoint;
+	if(info.code_point == 0)
 	{
-		// not found in the cache; retrieve and insert to the cache
-		ptr = get_glyph(codepoint);
-		glyph_cache.insert(ptr);
+		// non-existent glyph; cached as well
+		return glyph_cache.insert(e);
 	}
 
-	return ptr;
+	uint32_t compression_method = (info.flags & FLAGS_COMPRESSION_METHOD_MASK);
+	e.exist = true;
+	e.advance_64 = info.ascend_x < INT16_MAX ? info.ascend_x : INT16_MAX;
+	if(info.bb_w > 0 && info.bb_h > 0 && info.compressed_size > 0 &&
+		info.bb_w <= MAX_GLYPH_WIDTH && info.bitmap_offset != 0 &&
+		(
+			compression_method == FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH_DIFF ||
+			compression_method == FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH ||
+			compression_method == FLAGS_COMPRESSION_METHOD_XOR4 )
+		)
+	{
+		e.bb_x = info.bb_x, e.bb_y = info.bb_y;
+		e.bb_w = info.bb_w, e.bb_h = info.bb_h;
+	}
+
+	idx = glyph_cache.insert(e);
+	if(glyph_cache.get(idx).get_bitmap_size()) // may be dropped if too large
+		decode_bitmap(info, glyph_cache.get_bitmap(idx));
+	return idx;
 }
 
 font_base_t::metrics_t bff_font_t::get_metrics(int32_t chr) const
 {
-	std::shared_ptr<glyph_t> ptr = get_glyph_with_caching(chr);
-	if(ptr->glyph_info.flags & FLAGS_NOT_EXIST)
+	if(!available) return metrics_t{0, 0, false, 0};
+	const bff_glyph_cache_t::entry_t & e = glyph_cache.get(get_glyph(chr));
+	if(!e.exist)
 	{
 		// non exsitent glyph;
-		return metrics_t{0, 0, false};
+		return metrics_t{0, 0, false, 0};
 	}
-	return metrics_t {ptr->glyph_info.ascend_x / 64, nominal_height, true};
+	return metrics_t {e.advance_64 / 64, nominal_height, true, e.advance_64};
+}
+
+
+font_base_t::metrics_t bff_font_t::find_glyph(int32_t chr, glyph_handle_t & handle) const
+{
+	handle = 0;
+	if(!available) return metrics_t{0, 0, false, 0};
+	// the handle is made of the code point and the cache index
+	uint8_t idx = get_glyph(chr);
+	handle = (static_cast<glyph_handle_t>(chr) << 8) | idx;
+	const bff_glyph_cache_t::entry_t & e = glyph_cache.get(idx);
+	if(!e.exist)
+		return metrics_t{0, 0, false, 0};
+	return metrics_t {e.advance_64 / 64, nominal_height, true, e.advance_64};
 }
 
+void bff_font_t::put(int32_t chr, int level, int x, int y, frame_buffer_t & fb, blit_mode_t mode) const
+{
+	if(!available) return;
+	put_cached(get_glyph(chr), level, x, y, fb, mode);
+}
 
-void bff_font_t::put(int32_t chr, int level, int x, int y, frame_buffer_t & fb) const
+void bff_font_t::put_glyph(glyph_handle_t handle, int level, int x, int y,
+	frame_buffer_t & fb, blit_mode_t mode) const
 {
-	std::shared_ptr<glyph_t> ptr = get_glyph_with_caching(chr);
-	if(ptr->glyph_info.flags & FLAGS_NOT_EXIST) return; // non existent
+	if(!available) return;
+	int32_t chr = static_cast<int32_t>(handle >> 8);
+	uint8_t idx = handle & 0xff;
+	if(!glyph_cache.touch(idx, chr)) idx = get_glyph(chr); // evicted since
+	put_cached(idx, level, x, y, fb, mode);
+}
+
+void bff_font_t::put_cached(uint8_t idx, int level, int x, int y, frame_buffer_t & fb, blit_mode_t mode) const
+{
+	const bff_glyph_cache_t::entry_t & e = glyph_cache.get(idx);
+	if(!e.exist) return; // non existent
 
 	// adjust bounding box
-	unsigned int bb_w = ptr->glyph_info.bb_w;
-	x += ptr->glyph_info.bb_x;
-	y += ptr->glyph_info.bb_y;
+	x += e.bb_x;
+	y += e.bb_y;
 	int fx = 0, fy = 0;
-	int w = ptr->glyph_info.bb_w, h = ptr->glyph_info.bb_h;
+	int w = e.bb_w, h = e.bb_h;
 
 	// clip font bounding box
 	if(!fb.clip(fx, fy, x, y, w, h)) return;
 
-	// draw the pattern
-	const unsigned char *p = ptr->bitmap;
+	// draw the pattern; rows are expanded from 4bpp into 8bit alpha
+	const uint8_t *p = glyph_cache.get_bitmap(idx);
+	uint8_t line[MAX_GLYPH_WIDTH];
 
 	for(int yy = y; yy < h+y; ++yy, ++fy)
 	{
-		const uint8_t * line = p + fy * bb_w;
-//		Serial.printf("line %d: %02x\r\n", fy, line);
-		int fxx = fx;
-		for(int xx = x; xx < w+x; ++xx, ++fxx)
+		uint32_t pos = fy * e.bb_w + fx;
+		const uint8_t * src = p + (pos >> 1);
+		int i = 0;
+		if(pos & 1) line[i++] = (*(src++) >> 4) * 17;
+		for(; i + 1 < w; i += 2, ++src)
 		{
-			int alpha = line[fxx];
-			if(alpha)
-			{
-				int v = fb.get_point(xx, yy);
-				v = alpha;
-//				v = (((level - v) * alpha) >> 8 ) + v; // TODO: exact calculation
-				fb.set_point(xx, yy, v);
-			}
+			uint8_t b = *src;
+			line[i] = (b & 0x0f) * 17;
+			line[i + 1] = (b >> 4) * 17;
 		}
+		if(i < w) line[i] = (*src & 0x0f) * 17;
+		fb.blend_row(x, yy, w, line, level, mode);
 	}
 }
-
-
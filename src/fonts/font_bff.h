@@ -5,34 +5,251 @@
 #include <memory>
 #include "FS.h"
 
-// file access emulation via flash access
+#ifndef BFF_FLASH_CACHE_BLOCK_SIZE
+#define BFF_FLASH_CACHE_BLOCK_SIZE 256 //!< flash cache block size in bytes
+#endif
+
+#ifndef BFF_FLASH_CACHE_BLOCKS
+#define BFF_FLASH_CACHE_BLOCKS 4 //!< number of flash cache blocks
+#endif
+
+// file access emulation via flash access.
+// Reads go through a small LRU cache of aligned flash blocks, so that
+// small reads from the same region, such as glyph records and bitmaps of
+// neighboring glyphs, hit the flash only once. This also satisfies the
+// alignment requirement of ESP.flashRead(); the address, the size and
+// the destination must all be 4-byte aligned.
 class flash_linear_file_t
 {
+public:
+	static constexpr uint32_t block_size = BFF_FLASH_CACHE_BLOCK_SIZE; //!< cache block size in bytes
+	static constexpr uint32_t num_blocks = BFF_FLASH_CACHE_BLOCKS; //!< number of cache blocks
+
+	static_assert(block_size >= 4 && !(block_size & (block_size - 1)),
+		"BFF_FLASH_CACHE_BLOCK_SIZE must be a power of two, 4 or more");
+
+private:
+	static constexpr uint32_t invalid_addr = ~0U;
+
+	struct block_t
+	{
+		uint32_t addr; //!< flash address of the block, or invalid_addr
+		uint32_t last_used; //!< value of use_count at the last use
+		uint32_t data[block_size / sizeof(uint32_t)];
+	};
+
 	uint32_t start_addr;
 	uint32_t current_offs;
+	block_t blocks[num_blocks]; //!< cache blocks
+	uint32_t use_count = 0; //!< counter to find the least recently used block
+	uint32_t hits = 0; //!< number of block lookups hit the cache
+	uint32_t misses = 0; //!< number of block lookups missed the cache
+
+	const uint8_t * get_block(uint32_t addr);
 
 public:
-	flash_linear_file_t() : start_addr(0), current_offs(0) {}
+	flash_linear_file_t() : start_addr(0), current_offs(0) { invalidate(); }
 	~flash_linear_file_t() {}
 
-	void init(uint32_t start) { start_addr = start; current_offs = 0; }
+	void init(uint32_t start) { start_addr = start; current_offs = 0; invalidate(); }
 
-	uint32_t read(uint8_t * dest, uint32_t size)
-	{
-		bool success =
-			ESP.flashRead(start_addr + current_offs,
-				reinterpret_cast<uint32_t *>(dest), size);
-		if(success)
-		{
-			current_offs += size;
-			return size;
-		}
-		return 0;
-	}
+	uint32_t read(uint8_t * dest, uint32_t size);
 
 	void seek(uint32_t ofs) { current_offs = ofs; }
 
 	void close() {}
+
+	//! Discard the cache content; the flash is about to be rewritten
+	void invalidate();
+
+	uint32_t get_cache_hits() const { return hits; }
+	uint32_t get_cache_misses() const { return misses; }
+};
+
+
+/**
+ * In-RAM index of the code points of a BFF font.
+ * Glyphs are split into blocks of block_size; the first code point of each
+ * block is kept as is, and the rest are delta-coded into a bit stream.
+ * Each gap to the previous code point, minus one, is coded in unary
+ * (that many 0s and a 1) if less than escape_gap, otherwise as escape_gap
+ * 0s followed by raw_bits bits of the gap, LSB first.
+ */
+class bff_code_point_index_t
+{
+public:
+	static constexpr uint32_t block_size = 64;
+	static constexpr uint32_t escape_gap = 8;
+	static constexpr uint32_t raw_bits = 21;
+
+private:
+	uint32_t num_glyphs = 0; //!< number of glyphs
+	uint32_t num_blocks = 0; //!< number of blocks
+	uint32_t * block_code_points = nullptr; //!< first code point of each block
+	uint32_t * block_positions = nullptr; //!< bit position of each block in the stream
+	uint8_t * stream = nullptr; //!< the bit stream
+	uint32_t num_stream_bytes = 0; //!< size of the bit stream in bytes
+
+	// state of append()
+	uint32_t count = 0; //!< number of code points appended
+	uint32_t last = 0; //!< last code point appended
+	uint32_t pos = 0; //!< bit position to write
+
+	void put_bit(uint32_t bit);
+
+	//! Returns bits from the bit position p; at least 25 bits are valid
+	uint32_t peek(uint32_t p) const
+	{
+		const uint8_t * b = stream + (p >> 3);
+		return (b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24)) >> (p & 7);
+	}
+
+public:
+	~bff_code_point_index_t() { clear(); }
+
+	//! Returns number of bits to code the gap between code points
+	static uint32_t gap_bits(uint32_t gap) { return gap - 1 < escape_gap ? gap : escape_gap + raw_bits; }
+
+	//! Allocate the index for the glyphs, of which gaps take num_bits in total.
+	//! Returns false if memory is not available.
+	bool allocate(uint32_t _num_glyphs, uint32_t num_bits);
+
+	//! Append the next code point. Code points must be appended in
+	//! ascending order, as many as allocated.
+	void append(uint32_t code_point);
+
+	//! Release the index
+	void clear();
+
+	//! Returns whether the index is built
+	bool get_available() const { return stream && count == num_glyphs; }
+
+	//! Returns glyph index of the code point, or -1 if not found
+	int32_t find(uint32_t code_point) const;
+
+	//! Returns RAM usage in bytes
+	uint32_t get_memory_size() const { return num_blocks * 8 + num_stream_bytes; }
+};
+
+
+#ifndef BFF_GLYPH_CACHE_BYTES
+#define BFF_GLYPH_CACHE_BYTES 8192 //!< glyph cache arena size in bytes
+#endif
+
+#ifndef BFF_GLYPH_CACHE_ENTRIES
+#define BFF_GLYPH_CACHE_ENTRIES 192 //!< max number of glyphs in the glyph cache
+#endif
+
+/**
+ * Glyph cache of BFF fonts.
+ * Glyph bitmaps are kept at 4bpp without row padding, the even pixel of
+ * each pair in the lower nibble, and expanded to 8bit alpha row by row on drawing; the panel does
+ * not show more levels at glyph sizes anyway, and twice as many glyphs
+ * fit in the cache. Glyph bitmaps are allocated from a fixed arena, so that loading glyphs
+ * does not touch the heap at all; the arena and the entries are taken from the
+ * heap once, by bff_font_t::begin(), and given back by bff_font_t::disable(). Glyphs are looked up through a hash table
+ * and evicted in clock order. When the end of the arena is reached, glyphs
+ * are evicted until a quarter of the arena is free, then the arena is
+ * compacted.
+ */
+class bff_glyph_cache_t
+{
+public:
+	static constexpr uint32_t arena_size = BFF_GLYPH_CACHE_BYTES;
+	static constexpr uint32_t num_entries = BFF_GLYPH_CACHE_ENTRIES;
+	static constexpr uint8_t none = 0xff; //!< invalid entry index
+
+	static_assert(arena_size <= 65536, "BFF_GLYPH_CACHE_BYTES too large");
+	static_assert(num_entries > 0 && num_entries < none, "BFF_GLYPH_CACHE_ENTRIES out of range");
+
+	// every distinct glyph of the marquee has to stay in the cache, or each
+	// frame loads glyphs from flash again; a 155 glyph marquee has 97 distinct
+	// glyphs in 5237 bytes, and thrashes with 5120 bytes or 96 entries
+	static_assert(arena_size >= 6144, "BFF_GLYPH_CACHE_BYTES too small for the marquee");
+	static_assert(num_entries >= 128, "BFF_GLYPH_CACHE_ENTRIES too small for the marquee");
+
+	struct entry_t
+	{
+		int32_t code_point; //!< code point, or -1 if the entry is free
+		uint16_t offset; //!< bitmap offset in the arena
+		int16_t advance_64; //!< advance in 1/64 px
+		int16_t bb_x, bb_y; //!< bounding box position
+		uint16_t bb_w, bb_h; //!< bounding box size
+		uint8_t next; //!< next entry in the same hash bucket, or none
+		bool referenced; //!< whether used since the clock hand passed
+		bool exist; //!< whether the glyph exists in the font
+
+		uint32_t get_bitmap_size() const { return (bb_w * bb_h + 1) >> 1; }
+	};
+
+	struct stats_t
+	{
+		uint32_t hits; //!< number of lookups found the glyph
+		uint32_t misses; //!< number of lookups not found the glyph
+		uint32_t evictions; //!< number of glyphs evicted
+		uint32_t compactions; //!< number of arena compactions
+		uint32_t arena_used; //!< bytes used by glyph bitmaps
+		uint32_t entries_used; //!< number of glyphs in the cache
+	};
+
+private:
+	static constexpr uint32_t bucket_bits = 7;
+	static constexpr uint32_t num_buckets = 1 << bucket_bits;
+
+	entry_t * entries = nullptr; //!< glyphs, num_entries of them
+	uint8_t buckets[num_buckets]; //!< heads of hash chains
+	uint8_t * arena = nullptr; //!< glyph bitmaps, arena_size bytes
+	uint32_t arena_top = 0; //!< end of allocated bitmaps in the arena
+	uint8_t hand = 0; //!< clock hand
+	stats_t stats;
+
+	static uint32_t hash(int32_t code_point)
+		{ return ((uint32_t)code_point * 2654435761U) >> (32 - bucket_bits); }
+
+	void remove(uint8_t idx);
+	void evict_one();
+	void compact();
+
+public:
+	//! Heap bytes allocate() takes
+	static constexpr uint32_t memory_size = num_entries * sizeof(entry_t) + arena_size;
+
+	bff_glyph_cache_t() { clear(); }
+	~bff_glyph_cache_t() { release(); }
+	bff_glyph_cache_t(const bff_glyph_cache_t &) = delete;
+	bff_glyph_cache_t & operator = (const bff_glyph_cache_t &) = delete;
+
+	//! Allocate the entries and the arena from the heap, unless allocated
+	//! already, and discard all glyphs. Returns false if out of memory.
+	bool allocate();
+
+	//! Free the entries and the arena
+	void release();
+
+	//! Returns whether allocated; other methods but clear() need this
+	bool get_available() const { return entries && arena; }
+
+	//! Discard all glyphs
+	void clear();
+
+	//! Returns entry index of the code point, or none if not cached
+	uint8_t find(int32_t code_point);
+
+	//! Returns whether the entry idx holds the code point, which is given by a
+	//! previous find() or insert(); marks it used if so
+	bool touch(uint8_t idx, int32_t code_point);
+
+	//! Insert a glyph, evicting others if needed, and return its index.
+	//! The bitmap of get_bitmap_size() bytes is allocated but left uninitialized;
+	//! a glyph larger than the arena is stored with an empty bounding box.
+	//! The code point must not be in the cache.
+	uint8_t insert(const entry_t & entry);
+
+	const entry_t & get(uint8_t idx) const { return entries[idx]; }
+	uint8_t * get_bitmap(uint8_t idx) { return arena + entries[idx].offset; }
+	const uint8_t * get_bitmap(uint8_t idx) const { return arena + entries[idx].offset; }
+
+	const stats_t & get_stats() const { return stats; }
 };
 
 
@@ -54,9 +271,10 @@ public:
 	static constexpr uint16_t FLAGS_COMPRESSION_METHOD_MASK = 0x07;
 	static constexpr uint16_t FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH_DIFF = 0x00;
 	static constexpr uint16_t FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH = 0x01;
+	static constexpr uint16_t FLAGS_COMPRESSION_METHOD_XOR4 = 0x02; //!< 4bpp row-XOR with varint runs
+
+	static constexpr int MAX_GLYPH_WIDTH = 128; //!< glyphs wider than this are not drawn
 
-	static constexpr int CACHE_LIMIT = 64;
-	
 #pragma pack(push, 1)
 	struct glyph_info_t
 	{
@@ -74,41 +292,14 @@ public:
 	};
 #pragma pack(pop)
 
-	struct glyph_t
-	{
-		glyph_info_t glyph_info;
-		uint8_t * bitmap;
-		glyph_t(int32_t code_point) : glyph_info(),  bitmap(nullptr)
-		{
-			glyph_info.flags = FLAGS_NOT_EXIST;
-		}
-		glyph_t(const glyph_info_t & info) :
-			glyph_info(info), bitmap(new uint8_t [info.bb_w * info.bb_h])
-		{;}
-		~glyph_t() { if(bitmap) delete [] bitmap; }
-
-
-	private:
-		glyph_t(const glyph_t &);
-		glyph_t(const glyph_t &&);
-	};
-
 private:
-	class glyph_cache_t
-	{
-		typedef std::shared_ptr<glyph_t> ptr_t;
-		typedef std::array<ptr_t, CACHE_LIMIT> array_t; 
-
-		array_t array;
-		size_t top_point;
-	public:
-		glyph_cache_t() : array(), top_point(0) {}
+	mutable bff_glyph_cache_t glyph_cache; //!< glyph cache
 
-		ptr_t find_and_touch(int32_t code_point);
-		void insert(ptr_t glyph); //!< insert new item; the item should not be already in cache 
-	};
+	bff_code_point_index_t code_point_index; //!< code point index
 
-	mutable glyph_cache_t glyph_cache;
+	template <typename FUNC>
+	bool for_each_code_point(FUNC func) const;
+	void build_index();
 
 	bool available = false;
 
@@ -117,10 +308,22 @@ public: // font_base_t methods
 
 	virtual metrics_t get_metrics(int32_t chr) const;
 
-	virtual void put(int32_t chr, int level, int x, int y, frame_buffer_t & fb) const;
+	virtual void put(int32_t chr, int level, int x, int y, frame_buffer_t & fb, blit_mode_t mode) const;
+
+	virtual metrics_t find_glyph(int32_t chr, glyph_handle_t & handle) const;
+
+	virtual void put_glyph(glyph_handle_t handle, int level, int x, int y,
+		frame_buffer_t & fb, blit_mode_t mode) const;
 
 	bool get_available() const { return available; }
 
+	uint32_t get_flash_cache_hits() const { return file.get_cache_hits(); } //!< flash cache hits
+	uint32_t get_flash_cache_misses() const { return file.get_cache_misses(); } //!< flash cache misses
+	uint32_t get_index_memory_size() const { return code_point_index.get_memory_size(); } //!< RAM usage of the code point index in bytes
+
+	//! Returns statistics of the glyph cache
+	const bff_glyph_cache_t::stats_t & get_glyph_cache_stats() const { return glyph_cache.get_stats(); }
+
 public:
 	bff_font_t();
 	~bff_font_t();
@@ -129,8 +332,14 @@ public:
 
 	glyph_info_t get_glyph_info_by_index(uint32_t index) const;
 	glyph_info_t get_glyph_info(uint32_t codepoint) const;
-	std::shared_ptr<glyph_t> get_glyph(uint32_t codepoint) const;
-	std::shared_ptr<glyph_t> get_glyph_with_caching(uint32_t codepoint) const;
+
+	//! Decode the bitmap of the glyph at 4bpp, as the glyph cache keeps it,
+	//! into (bb_w * bb_h + 1) / 2 bytes of bitmap
+	void decode_bitmap(const glyph_info_t & info, uint8_t * bitmap) const;
+
+private:
+	uint8_t get_glyph(int32_t codepoint) const; //!< returns glyph cache index, loading the glyph if needed
+	void put_cached(uint8_t idx, int level, int x, int y, frame_buffer_t & fb, blit_mode_t mode) const;
 };
 
 extern bff_font_t font_bff;
@@ -15,6 +15,12 @@ struct glyph_header_t
 	const /*PROGMEM*/ glyph_t * array; //!< pointer to the array of glyphs
 	int num_glyphs; //!< number of glyphs contained in
 	unsigned char nominal_height; //!< nominal height
+	int32_t first_code_point; //!< code point of the first entry of index
+	int index_size; //!< number of entries in index
+	const uint8_t * index; //!< glyph index by code point - first_code_point;
+		//!< NO_GLYPH for missing ones. in RAM
+
+	static constexpr uint8_t NO_GLYPH = 255;
 };
 
 
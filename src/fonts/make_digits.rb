@@ -40,8 +40,20 @@ puts "static const PROGMEM glyph_t #{name}_array[#{name}_COUNT] = {"
 puts idx
 puts "};"
 puts ""
+# dense code point to glyph index table; 255 for missing ones.
+# this is in RAM, as it is read for every character drawn
+cps = $code_points.map { |c| c =~ /\A'(.)'\z/ ? $1.ord : Integer(c) }
+first = cps.min
+index = Array.new(cps.max - first + 1, 255)
+cps.each_with_index { |c, i| index[c - first] = i }
+
+puts "static const uint8_t #{name}_INDEX[#{index.size}] = {"
+puts index.each_slice(16).map { |s| s.join(", ") }.join(",\n")
+puts "};"
+puts ""
+
 puts "static const PROGMEM glyph_header_t #{name} = {"
-puts "#{name}_array, #{name}_COUNT, #{$height}+1};"
+puts "#{name}_array, #{name}_COUNT, #{$height}+1, #{first}, #{index.size}, #{name}_INDEX};"
 puts ""
 
 
@@ -1,10 +1,24 @@
 #include <Arduino.h>
 #include "frame_buffer.h"
+#include "matrix_drive.h"
 #include "fonts/font.h"
 
-frame_buffer_t buffers[2]; // for double buffering
-frame_buffer_t & current_frame_buffer = buffers[0];
-frame_buffer_t & bg_frame_buffer = buffers[1];
+frame_buffer_t buffers[FRAME_BUFFER_COUNT];
+volatile uint32_t frame_buffer_state = frame_buffer_make_state(0, FRAME_BUFFER_NONE, 1);
+static uint64_t frame_buffer_flip_rows; //!< changed rows of the pending flip, against the front
+static uint32_t frame_buffer_request_seq = 0; //!< sequence number of the last requested flip
+static uint32_t frame_buffer_ready_seq = 0; //!< sequence number of the ready buffer
+static volatile uint32_t frame_buffer_flip_seq = 0; //!< sequence number of the front buffer
+static volatile uint32_t frame_buffer_vsync_count = 0; //!< number of frame_buffer_vsync() calls
+
+/**
+ * Rows of each buffer which are known to be the same as the last requested
+ * frame, unless drawn since (which is in the buffer's dirty bitmap).
+ */
+static uint64_t frame_buffer_fresh[FRAME_BUFFER_COUNT];
+
+static frame_buffer_stat_t frame_buffer_stat;
+static frame_buffer_damage_t frame_buffer_damage;
 
 static int get_utf8_bytes(uint8_t c)
 {
@@ -19,7 +33,7 @@ static int get_utf8_bytes(uint8_t c)
 
 }
 
-static bool utf8tow(const uint8_t * & in, uint32_t *out)
+bool utf8tow(const uint8_t * & in, uint32_t *out)
 {
 	// convert a utf-8 charater from 'in' to wide charater 'out'
 	const uint8_t * p = (const uint8_t * &)in;
@@ -91,30 +105,208 @@ static bool utf8tow(const uint8_t * & in, uint32_t *out)
 	return false;
 }
 
+/**
+ * Fill n pixels from p with v.
+ * Pixels up to the first 32bit boundary and after the last one are
+ * written one by one, and the rest are written by 32bit words.
+ */
+template <typename PIXEL>
+static void fill_span(PIXEL *p, PIXEL v, int n)
+{
+	static_assert(sizeof(PIXEL) == 1 || sizeof(PIXEL) == 2, "unsupported pixel size");
+	while(n > 0 && (reinterpret_cast<uintptr_t>(p) & 3)) *(p++) = v, --n;
+
+	uint32_t pattern = sizeof(PIXEL) == 1 ? v * 0x01010101U : v * 0x00010001U;
+	constexpr int per_word = 4 / sizeof(PIXEL);
+	uint32_t *w = reinterpret_cast<uint32_t *>(p);
+	for(int i = n / per_word; i > 0; --i) *(w++) = pattern;
+
+	p = reinterpret_cast<PIXEL *>(w);
+	for(n %= per_word; n > 0; --n) *(p++) = v;
+}
+
+/**
+ * Blend n pixels of s into d, with the source scaled by opacity (0 .. 255).
+ * For BM_OVER, the opacity is used as the alpha of the source.
+ * d and s are pixel spans; see pixel_span_t.
+ */
+template <typename D, typename S>
+static void blend_span(const D &d, const S &s, int n, uint32_t opacity, blit_mode_t mode, uint32_t max)
+{
+	switch(mode)
+	{
+	case BM_COPY:
+		for(int i = 0; i < n; ++i) d.set(i, div255(s[i] * opacity));
+		break;
+
+	case BM_OVER:
+		for(int i = 0; i < n; ++i) d.set(i, div255(s[i] * opacity + d[i] * (255 - opacity)));
+		break;
+
+	case BM_ADD:
+		for(int i = 0; i < n; ++i)
+		{
+			uint32_t v = d[i] + div255(s[i] * opacity);
+			d.set(i, v > max ? max : v);
+		}
+		break;
+
+	case BM_MAX:
+		for(int i = 0; i < n; ++i)
+		{
+			uint32_t v = div255(s[i] * opacity);
+			if(v > d[i]) d.set(i, v);
+		}
+		break;
+	}
+}
+
+/**
+ * Copy n pixels from s to d. The regions must not overlap.
+ * If both are at the same 32bit alignment, pixels up to the first
+ * boundary and after the last one are copied one by one, and the rest
+ * are copied by 32bit words. Otherwise, memcpy is used.
+ */
+template <typename PIXEL>
+static void copy_span(PIXEL *d, const PIXEL *s, int n)
+{
+	if((reinterpret_cast<uintptr_t>(d) ^ reinterpret_cast<uintptr_t>(s)) & 3)
+	{
+		memcpy(d, s, n * sizeof(PIXEL));
+		return;
+	}
+
+	while(n > 0 && (reinterpret_cast<uintptr_t>(d) & 3)) *(d++) = *(s++), --n;
+
+	constexpr int per_word = 4 / sizeof(PIXEL);
+	uint32_t *wd = reinterpret_cast<uint32_t *>(d);
+	const uint32_t *ws = reinterpret_cast<const uint32_t *>(s);
+	for(int i = n / per_word; i > 0; --i) *(wd++) = *(ws++);
+
+	d = reinterpret_cast<PIXEL *>(wd);
+	s = reinterpret_cast<const PIXEL *>(ws);
+	for(n %= per_word; n > 0; --n) *(d++) = *(s++);
+}
+
+/**
+ * Span of pixels from x of a row, specialized by number of pixels per
+ * storage unit. Pixels are read by [] and written by set(); fill() and
+ * copy() use the word-wide kernels where the layout allows.
+ */
+template <typename FORMAT, typename UNIT, int PPU = FORMAT::pixels_per_unit>
+struct pixel_span_t;
 
-bool frame_buffer_t::clip(int &fx, int &fy, int &x, int &y, int &w, int &h) const
+//! span of unpacked pixels
+template <typename FORMAT, typename UNIT>
+struct pixel_span_t<FORMAT, UNIT, 1>
 {
-	if(x < 0)
-		fx += -x, w -= -x, x = 0;
-	if(y < 0)
-		fy += -y, h -= -h, y = 0;
-	if(x + w >= get_width())
-		w -= (x + w) - get_width();
-	if(y + h >= get_height())
-		h -= (y + h) - get_height();
+	UNIT *p;
+
+	pixel_span_t(UNIT *row, int x) : p(row + x) {}
+
+	uint32_t operator [](int i) const { return p[i]; }
+	void set(int i, uint32_t v) const { p[i] = v; }
+
+	void fill(int n, uint32_t v) const { fill_span(p, (UNIT)v, n); }
+
+	//! copy n pixels from s; the regions must not overlap
+	template <typename S>
+	void copy(const S &s, int n) const { copy_span(p, s.p, n); }
+
+	//! copy n pixels from s, which may overlap
+	template <typename S>
+	void move(const S &s, int n) const { memmove(p, s.p, n * sizeof(UNIT)); }
+};
+
+//! span of 4bit pixels packed into bytes
+template <typename FORMAT, typename UNIT>
+struct pixel_span_t<FORMAT, UNIT, 2>
+{
+	UNIT *row;
+	int x;
+
+	pixel_span_t(UNIT *_row, int _x) : row(_row), x(_x) {}
+
+	uint32_t operator [](int i) const { return FORMAT::get(row, x + i); }
+	void set(int i, uint32_t v) const { FORMAT::put(row, x + i, v); }
+
+	void fill(int n, uint32_t v) const
+	{
+		int i = 0;
+		if(n > 0 && (x & 1)) set(i++, v);
+		int bytes = (n - i) >> 1;
+		fill_span(row + ((x + i) >> 1), (UNIT)(v * 0x11), bytes);
+		i += bytes << 1;
+		if(i < n) set(i, v);
+	}
+
+	template <typename S>
+	void copy(const S &s, int n) const
+	{
+		if((x ^ s.x) & 1)
+		{
+			// nibbles are not aligned
+			for(int i = 0; i < n; ++i) set(i, s[i]);
+			return;
+		}
+		int i = 0;
+		if(n > 0 && (x & 1)) set(i, s[i]), ++i;
+		int bytes = (n - i) >> 1;
+		copy_span(row + ((x + i) >> 1), s.row + ((s.x + i) >> 1), bytes);
+		i += bytes << 1;
+		if(i < n) set(i, s[i]);
+	}
+
+	template <typename S>
+	void move(const S &s, int n) const
+	{
+		if(row == s.row && x > s.x)
+			for(int i = n - 1; i >= 0; --i) set(i, s[i]);
+		else
+			for(int i = 0; i < n; ++i) set(i, s[i]);
+	}
+};
+
+
+template <typename FORMAT>
+bool basic_frame_buffer_t<FORMAT>::clip(int &fx, int &fy, int &x, int &y, int &w, int &h) const
+{
+	if(x < clip_x)
+		fx += clip_x - x, w -= clip_x - x, x = clip_x;
+	if(y < clip_y)
+		fy += clip_y - y, h -= clip_y - y, y = clip_y;
+	if(x + w >= clip_x + clip_w)
+		w -= (x + w) - (clip_x + clip_w);
+	if(y + h >= clip_y + clip_h)
+		h -= (y + h) - (clip_y + clip_h);
 
 	return w >= 0 && h >= 0;
 }
 
+template <typename FORMAT>
+void basic_frame_buffer_t<FORMAT>::set_clip(int x, int y, int w, int h)
+{
+	if(x < 0) w += x, x = 0;
+	if(y < 0) h += y, y = 0;
+	if(x + w > get_width()) w = get_width() - x;
+	if(y + h > get_height()) h = get_height() - y;
+	if(w < 0) w = 0;
+	if(h < 0) h = 0;
+	clip_x = x, clip_y = y, clip_w = w, clip_h = h;
+}
 
-void frame_buffer_t::draw_char(int x, int y, int level, int ch, const font_base_t & font)
+
+void frame_buffer_t::draw_char(int x, int y, int level, int ch, const font_base_t & font,
+	blit_mode_t mode)
 {
-	font.put(ch, level, x, y, *this);
+	font.put(ch, level, x, y, *this, mode);
 }
 
-void frame_buffer_t::draw_text(int x, int y, int level, const __FlashStringHelper *ifsh, const font_base_t & font)
+void frame_buffer_t::draw_text(int x, int y, int level, const __FlashStringHelper *ifsh, const font_base_t & font,
+	blit_mode_t mode)
 {
 	PGM_P p = reinterpret_cast<PGM_P>(ifsh);
+	int32_t pen_64 = 0; // pen position from x in 1/64 px
 
 	uint8_t c;
 	while(0 != (c = pgm_read_byte(p++)))
@@ -132,11 +324,12 @@ void frame_buffer_t::draw_text(int x, int y, int level, const __FlashStringHelpe
 		uint32_t wc = 0;
 		if(utf8tow(bp, &wc))
 		{
-			font_base_t::metrics_t met = font.get_metrics(wc);
+			font_base_t::glyph_handle_t handle;
+			font_base_t::metrics_t met = font.find_glyph(wc, handle);
 			if(met.exist)
 			{
-				draw_char(wc, level, x, y, font);
-				x += met.w;
+				font.put_glyph(handle, level, x + font_base_t::round_64(pen_64), y, *this, mode);
+				pen_64 += met.advance_64;
 			}
 		}
 		else
@@ -144,9 +337,11 @@ void frame_buffer_t::draw_text(int x, int y, int level, const __FlashStringHelpe
 	}
 }
 
-void frame_buffer_t::draw_text(int x, int y, int level, const char *s, const font_base_t & font)
+void frame_buffer_t::draw_text(int x, int y, int level, const char *s, const font_base_t & font,
+	blit_mode_t mode)
 {
 	const uint8_t *p = reinterpret_cast<const uint8_t *>(s);
+	int32_t pen_64 = 0; // pen position from x in 1/64 px
 
 	uint32_t c = 0;
 	while(true)
@@ -155,11 +350,12 @@ void frame_buffer_t::draw_text(int x, int y, int level, const char *s, const fon
 
 		if(utf8tow(p, &c))
 		{
-			font_base_t::metrics_t met = font.get_metrics(c);
+			font_base_t::glyph_handle_t handle;
+			font_base_t::metrics_t met = font.find_glyph(c, handle);
 			if(met.exist)
 			{
-				draw_char(x, y, level, c, font);
-				x += met.w;
+				font.put_glyph(handle, level, x + font_base_t::round_64(pen_64), y, *this, mode);
+				pen_64 += met.advance_64;
 			}
 		}
 		else
@@ -171,59 +367,498 @@ void frame_buffer_t::draw_text(int x, int y, int level, const char *s, const fon
 int frame_buffer_t::get_text_width(const char *s, const font_base_t & font)
 {
 	const uint8_t *p = reinterpret_cast<const uint8_t *>(s);
-	int ret = 0;
+	int32_t ret_64 = 0; // in 1/64 px, rounded at last as draw_text() does
 
 	uint32_t c = 0;
 	while(true)
 	{
-		if(!*p) return ret;
+		if(!*p) return font_base_t::round_64(ret_64);
 
 		if(utf8tow(p, &c))
 		{
 			font_base_t::metrics_t met = font.get_metrics(c);
 			if(met.exist)
-				ret += met.w;
+				ret_64 += met.advance_64;
 		}
 		else
 			return 0;
 	}
+}
 
-	return ret;
+
+template <typename FORMAT>
+void basic_frame_buffer_t<FORMAT>::mark_dirty(int y, int h)
+{
+	if(y < 0) h += y, y = 0;
+	if(y + h > LED_MAX_LOGICAL_ROW) h = LED_MAX_LOGICAL_ROW - y;
+	for(int yy = y; yy < y + h; ++yy)
+		dirty[yy >> 5] |= 1U << (yy & 31);
 }
 
+template <typename FORMAT>
+void basic_frame_buffer_t<FORMAT>::fill(int level)
+{
+	if(clip_w != LED_MAX_LOGICAL_COL || clip_h != LED_MAX_LOGICAL_ROW)
+	{
+		fill(clip_x, clip_y, clip_w, clip_h, level);
+		return;
+	}
+	mark_dirty(0, LED_MAX_LOGICAL_ROW);
+	pixel_span_t<FORMAT, unit_t>(buffer[0], 0).fill(
+		LED_MAX_LOGICAL_ROW * LED_MAX_LOGICAL_COL, FORMAT::from_level(level));
+}
+
+template <typename FORMAT>
+void basic_frame_buffer_t<FORMAT>::fill(int x, int y, int w, int h, int level)
+{
+	int fx = 0, fy = 0;
+	if(!clip(fx, fy, x, y, w, h)) return;
+	mark_dirty(y, h);
+	pixel_t v = FORMAT::from_level(level);
+	if(w == LED_MAX_LOGICAL_COL)
+	{
+		// rows are contiguous
+		pixel_span_t<FORMAT, unit_t>(buffer[y], 0).fill(w * h, v);
+		return;
+	}
+	for(int yy = y; yy < y + h; ++yy)
+		pixel_span_t<FORMAT, unit_t>(buffer[yy], x).fill(w, v);
+}
+
+template <typename FORMAT>
+void basic_frame_buffer_t<FORMAT>::blit(const basic_frame_buffer_t<FORMAT> & src,
+	int sx, int sy, int w, int h, int dx, int dy, blit_mode_t mode, int opacity)
+{
+	// clip against the source
+	if(sx < 0) dx -= sx, w += sx, sx = 0;
+	if(sy < 0) dy -= sy, h += sy, sy = 0;
+	if(sx + w > src.get_width()) w = src.get_width() - sx;
+	if(sy + h > src.get_height()) h = src.get_height() - sy;
 
-void frame_buffer_t::fill(int level)
+	blit_rows(src.buffer[0], LED_MAX_LOGICAL_COL / FORMAT::pixels_per_unit,
+		sx, sy, w, h, dx, dy, mode, opacity);
+}
+
+template <typename FORMAT>
+void basic_frame_buffer_t<FORMAT>::blit_rows(const unit_t *rows, int stride,
+	int sx, int sy, int w, int h, int dx, int dy, blit_mode_t mode, int opacity)
 {
-	for(int yy = 0; yy < LED_MAX_LOGICAL_ROW; ++yy)
+	// clip against the destination
+	if(!clip(sx, sy, dx, dy, w, h)) return;
+	if(w <= 0 || h <= 0) return;
+	mark_dirty(dy, h);
+
+	// copy rows bottom to top if the regions overlap downward in the same buffer
+	bool same = rows == buffer[0];
+	bool reverse = same && dy > sy;
+	for(int i = 0; i < h; ++i)
 	{
-		for(int xx = 0; xx < LED_MAX_LOGICAL_COL; ++xx)
+		int r = reverse ? h - 1 - i : i;
+		pixel_span_t<FORMAT, unit_t> d(buffer[dy + r], dx);
+		pixel_span_t<FORMAT, const unit_t> s(rows + (sy + r) * stride, sx);
+		if(opacity < 255)
 		{
-			buffer[yy][xx] = level;
+			blend_span(d, s, w, opacity, mode, FORMAT::from_level(255));
+			continue;
+		}
+		switch(mode)
+		{
+		case BM_COPY:
+		case BM_OVER: // the source is opaque
+			if(same)
+				d.move(s, w);
+			else
+				d.copy(s, w);
+			break;
+
+		case BM_ADD:
+		{
+			const uint32_t max = FORMAT::from_level(255);
+			for(int xx = 0; xx < w; ++xx)
+			{
+				uint32_t v = d[xx] + s[xx];
+				d.set(xx, v > max ? max : v);
+			}
+			break;
+		}
+
+		case BM_MAX:
+			for(int xx = 0; xx < w; ++xx)
+				if(s[xx] > d[xx]) d.set(xx, s[xx]);
+			break;
 		}
 	}
 }
 
-void frame_buffer_t::fill(int x, int y, int w, int h, int level)
+template <typename FORMAT>
+void basic_frame_buffer_t<FORMAT>::blend_row(int x, int y, int w, const uint8_t *alpha,
+	int level, blit_mode_t mode)
 {
-	for(int yy = y; yy < y + h; ++yy)
+	dirty[y >> 5] |= 1U << (y & 31);
+	pixel_span_t<FORMAT, unit_t> d(buffer[y], x);
+	const uint32_t l = FORMAT::from_level(level);
+	const uint32_t max = FORMAT::from_level(255);
+
+	switch(mode)
 	{
-		for(int xx = x; xx < x + w; ++xx)
+	case BM_COPY:
+		for(int i = 0; i < w; ++i)
+			d.set(i, div255(l * alpha[i]));
+		break;
+
+	case BM_OVER:
+		for(int i = 0; i < w; ++i)
+		{
+			uint32_t a = alpha[i];
+			if(a == 0) continue;
+			if(a == 255) { d.set(i, l); continue; }
+			d.set(i, div255(l * a + d[i] * (255 - a)));
+		}
+		break;
+
+	case BM_ADD:
+		for(int i = 0; i < w; ++i)
+		{
+			uint32_t a = alpha[i];
+			if(a == 0) continue;
+			uint32_t v = d[i] + div255(l * a);
+			d.set(i, v > max ? max : v);
+		}
+		break;
+
+	case BM_MAX:
+		for(int i = 0; i < w; ++i)
 		{
-			buffer[yy][xx] = level;
+			uint32_t v = div255(l * alpha[i]);
+			if(v > d[i]) d.set(i, v);
 		}
+		break;
 	}
 }
 
-void frame_buffer_flip()
+/**
+ * Expand bits of a mask into a 32bit word of pixels of BPP bits each;
+ * bit N selects all bits of the Nth pixel of the word. Pixels are in the
+ * little endian order, as of the frame buffer rows.
+ */
+template <int BPP>
+static uint32_t expand_mask(uint32_t bits);
+
+template <>
+inline uint32_t expand_mask<16>(uint32_t bits)
+{
+	return ((bits * 0x8001U) & 0x00010001U) * 0xffffU;
+}
+
+template <>
+inline uint32_t expand_mask<8>(uint32_t bits)
+{
+	return ((bits * 0x00204081U) & 0x01010101U) * 0xffU;
+}
+
+template <>
+inline uint32_t expand_mask<4>(uint32_t bits)
 {
-	if(&current_frame_buffer == buffers + 0)
+	bits = (bits | (bits << 12)) & 0x000f000fU;
+	bits = (bits | (bits << 6)) & 0x03030303U;
+	bits = (bits | (bits << 3)) & 0x11111111U;
+	return bits * 0xfU;
+}
+
+template <typename FORMAT>
+void basic_frame_buffer_t<FORMAT>::draw_mask(int x, int y, int w, int h, const uint32_t *rows,
+	int level, blit_mode_t mode)
+{
+	constexpr int bpp = sizeof(unit_t) * 8 / FORMAT::pixels_per_unit;
+	constexpr int per_word = 32 / bpp;
+	static_assert(sizeof(buffer[0]) % 4 == 0, "rows must be 32bit aligned");
+
+	// clip once for the whole bitmap
+	int fx = 0, fy = 0;
+	if(!clip(fx, fy, x, y, w, h) || w <= 0 || h <= 0) return;
+	mark_dirty(y, h);
+
+	const uint32_t l = FORMAT::from_level(level);
+	const uint32_t max = FORMAT::from_level(255);
+	const uint32_t pattern = l * (0xffffffffU / ((1ULL << bpp) - 1)); // l in every pixel
+	const uint32_t span = w < 32 ? (1U << w) - 1 : ~0U;
+	const int first_word = x / per_word, last_word = (x + w - 1) / per_word;
+
+	for(int r = 0; r < h; ++r)
+	{
+		uint32_t bits = (rows[fy + r] >> fx) & span;
+		unit_t *row = buffer[y + r];
+
+		switch(mode)
+		{
+		case BM_COPY:
+		case BM_OVER:
+		{
+			if(!bits && mode == BM_OVER) break;
+			// merge by 32bit words; the write mask is the span for BM_COPY
+			uint32_t *words = reinterpret_cast<uint32_t *>(row);
+			for(int i = first_word; i <= last_word; ++i)
+			{
+				int shift = i * per_word - x; // bit of the first pixel of the word
+				uint32_t b = shift >= 0 ? bits >> shift : bits << -shift;
+				uint32_t s = mode == BM_COPY ? (shift >= 0 ? span >> shift : span << -shift) : b;
+				constexpr uint32_t lanes = (1U << per_word) - 1;
+				uint32_t m = expand_mask<bpp>(s & lanes);
+				words[i] = (words[i] & ~m) | (pattern & expand_mask<bpp>(b & lanes));
+			}
+			break;
+		}
+
+		case BM_ADD:
+		case BM_MAX:
+		{
+			// only set bits
+			pixel_span_t<FORMAT, unit_t> d(row, x);
+			while(bits)
+			{
+				int i = __builtin_ctz(bits);
+				bits &= bits - 1;
+				if(mode == BM_ADD)
+				{
+					uint32_t v = d[i] + l;
+					d.set(i, v > max ? max : v);
+				}
+				else if(l > d[i])
+				{
+					d.set(i, l);
+				}
+			}
+			break;
+		}
+		}
+	}
+}
+
+template class basic_frame_buffer_t<frame_buffer_format_8bpp_t>;
+template class basic_frame_buffer_t<frame_buffer_format_12bpp_t>;
+template class basic_frame_buffer_t<frame_buffer_format_4bpp_t>;
+
+void frame_buffer_copy_forward()
+{
+	frame_buffer_t & bg = get_bg_frame_buffer(); // this may wait for a buffer
+	uint32_t back = frame_buffer_back_index(frame_buffer_state);
+	const frame_buffer_t & last_fb = get_last_frame_buffer();
+
+	// rows which are fresh and not drawn since are the same already
+	for(int y = 0; y < LED_MAX_LOGICAL_ROW; ++y)
 	{
-		current_frame_buffer = buffers[1];
-		bg_frame_buffer      = buffers[0];
+		if((frame_buffer_fresh[back] & ((uint64_t)1 << y)) && !bg.is_dirty(y)) continue;
+		bg.blit(last_fb, 0, y, LED_MAX_LOGICAL_COL, 1, 0, y);
+	}
+}
+
+uint32_t frame_buffer_flip()
+{
+	frame_buffer_t & bg = get_bg_frame_buffer(); // this may wait for a buffer
+	uint32_t st = frame_buffer_state;
+	uint32_t back = frame_buffer_back_index(st);
+
+	// the last requested frame; the ready one if any, or the front.
+	// the scan interrupt may make the ready one front meanwhile, but
+	// it does not change the content.
+	uint32_t last = frame_buffer_ready_index(st);
+	if(last == FRAME_BUFFER_NONE) last = frame_buffer_front_index(st);
+	const frame_buffer_t & last_fb = buffers[last];
+
+	// find rows which differ from the last requested frame.
+	// a row can differ only if it is drawn since, or is not fresh.
+	uint64_t candidates = ~frame_buffer_fresh[back];
+	for(int y = 0; y < LED_MAX_LOGICAL_ROW; ++y)
+		if(bg.is_dirty(y)) candidates |= (uint64_t)1 << y;
+
+	uint64_t changed = 0;
+	int changed_rows = 0;
+	for(int y = 0; y < LED_MAX_LOGICAL_ROW; ++y)
+	{
+		if((candidates & ((uint64_t)1 << y)) &&
+			memcmp(bg.array()[y], last_fb.array()[y], sizeof(bg.array()[y])))
+		{
+			changed |= (uint64_t)1 << y;
+			++ changed_rows;
+		}
+	}
+	bg.clear_dirty();
+
+	// every other buffer now may differ on the changed rows
+	for(int i = 0; i < FRAME_BUFFER_COUNT; ++i)
+		if(i != (int)back) frame_buffer_fresh[i] &= ~changed;
+	frame_buffer_fresh[back] = ~(uint64_t)0;
+
+	int damaged = frame_buffer_damage.empty() ?
+		LED_MAX_LOGICAL_COL * LED_MAX_LOGICAL_ROW : frame_buffer_damage.get_area();
+	frame_buffer_damage.clear();
+
+	++ frame_buffer_stat.flip_count;
+	frame_buffer_stat.changed_rows += changed_rows;
+	frame_buffer_stat.last_changed_rows = changed_rows;
+	frame_buffer_stat.damaged_pixels += damaged;
+	frame_buffer_stat.last_damaged_pixels = damaged;
+
+	// queue the buffer
+	uint32_t seq = ++ frame_buffer_request_seq;
+	noInterrupts();
+	st = frame_buffer_state;
+	uint32_t front = frame_buffer_front_index(st);
+	uint32_t ready = frame_buffer_ready_index(st);
+	uint32_t next_back = FRAME_BUFFER_NONE;
+	if(ready != FRAME_BUFFER_NONE)
+	{
+		// replace the frame not yet shown; the replaced one is drawn on next
+		next_back = ready;
+		++ frame_buffer_stat.dropped_count;
 	}
 	else
 	{
-		current_frame_buffer = buffers[0];
-		bg_frame_buffer      = buffers[1];
+		// find a free buffer
+		for(uint32_t i = 0; i < FRAME_BUFFER_COUNT; ++i)
+			if(i != front && i != back) next_back = i;
+	}
+	frame_buffer_flip_rows |= changed;
+	frame_buffer_ready_seq = seq;
+	frame_buffer_state = frame_buffer_make_state(front, back, next_back);
+	interrupts();
+
+	if(!led_is_scanning()) frame_buffer_wait_flip(); // no vsync available
+	return seq;
+}
+
+uint64_t ICACHE_RAM_ATTR frame_buffer_vsync()
+{
+	++ frame_buffer_vsync_count;
+	uint32_t st = frame_buffer_state;
+	uint32_t ready = frame_buffer_ready_index(st);
+	if(ready == FRAME_BUFFER_NONE) return 0;
+
+	// the ready buffer becomes front. the old front becomes back if
+	// the main loop is waiting for a buffer, otherwise it becomes free.
+	uint32_t back = frame_buffer_back_index(st);
+	if(back == FRAME_BUFFER_NONE) back = frame_buffer_front_index(st);
+	frame_buffer_state = frame_buffer_make_state(ready, FRAME_BUFFER_NONE, back);
+	frame_buffer_flip_seq = frame_buffer_ready_seq;
+
+	uint64_t rows = frame_buffer_flip_rows;
+	frame_buffer_flip_rows = 0;
+	return rows;
+}
+
+void frame_buffer_wait_bg()
+{
+	while(frame_buffer_back_index(frame_buffer_state) == FRAME_BUFFER_NONE)
+	{
+		if(!led_is_scanning())
+		{
+			// no scan interrupt to do the flip; do it here
+			led_update_scanout(frame_buffer_vsync());
+			break;
+		}
+		led_encode_behind_beam(); // the flip waits for the pass in progress
+		yield();
 	}
 }
+
+void frame_buffer_wait_flip()
+{
+	while(frame_buffer_ready_index(frame_buffer_state) != FRAME_BUFFER_NONE)
+	{
+		if(!led_is_scanning())
+		{
+			// no scan interrupt to do the flip; do it here
+			led_update_scanout(frame_buffer_vsync());
+			break;
+		}
+		led_encode_behind_beam(); // the flip waits for the pass in progress
+		yield();
+	}
+}
+
+uint32_t frame_buffer_get_flip_seq()
+{
+	return frame_buffer_flip_seq;
+}
+
+uint32_t frame_buffer_get_vsync_count()
+{
+	return frame_buffer_vsync_count;
+}
+
+const frame_buffer_stat_t & frame_buffer_get_stat()
+{
+	return frame_buffer_stat;
+}
+
+
+static bool rect_overlaps(const frame_buffer_damage_t::rect_t & a, const frame_buffer_damage_t::rect_t & b)
+{
+	return a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h;
+}
+
+static frame_buffer_damage_t::rect_t rect_bound(const frame_buffer_damage_t::rect_t & a, const frame_buffer_damage_t::rect_t & b)
+{
+	int x = a.x < b.x ? a.x : b.x;
+	int y = a.y < b.y ? a.y : b.y;
+	int r = a.x + a.w > b.x + b.w ? a.x + a.w : b.x + b.w;
+	int bottom = a.y + a.h > b.y + b.h ? a.y + a.h : b.y + b.h;
+	return frame_buffer_damage_t::rect_t { x, y, r - x, bottom - y };
+}
+
+void frame_buffer_damage_t::add(int x, int y, int w, int h)
+{
+	if(x < 0) w += x, x = 0;
+	if(y < 0) h += y, y = 0;
+	if(x + w > LED_MAX_LOGICAL_COL) w = LED_MAX_LOGICAL_COL - x;
+	if(y + h > LED_MAX_LOGICAL_ROW) h = LED_MAX_LOGICAL_ROW - y;
+	if(w <= 0 || h <= 0) return;
+
+	rect_t r = { x, y, w, h };
+	bool merged;
+	do
+	{
+		merged = false;
+		// merge with an overlapping one; the result may overlap others again
+		for(int i = 0; i < count; ++i)
+		{
+			if(rect_overlaps(rects[i], r))
+			{
+				r = rect_bound(rects[i], r);
+				rects[i] = rects[--count];
+				merged = true;
+				break;
+			}
+		}
+
+		if(!merged && count == max_rects)
+		{
+			// no room; merge with the one which adds least pixels
+			int best = 0, best_growth = -1;
+			for(int i = 0; i < count; ++i)
+			{
+				rect_t b = rect_bound(rects[i], r);
+				int growth = b.w * b.h - rects[i].w * rects[i].h;
+				if(best_growth < 0 || growth < best_growth) best = i, best_growth = growth;
+			}
+			r = rect_bound(rects[best], r);
+			rects[best] = rects[--count];
+			merged = true;
+		}
+	} while(merged);
+
+	rects[count++] = r;
+}
+
+int frame_buffer_damage_t::get_area() const
+{
+	// rectangles do not overlap
+	int area = 0;
+	for(int i = 0; i < count; ++i) area += rects[i].w * rects[i].h;
+	return area;
+}
+
+frame_buffer_damage_t & frame_buffer_get_damage()
+{
+	return frame_buffer_damage;
+}
@@ -6,13 +6,118 @@ static constexpr int LED_MAX_LOGICAL_COL = 64;
 
 class font_base_t;
 
-class frame_buffer_t
+//! 8bit-per-pixel frame buffer format.
+//! Each pixel holds 8bit intensity level (0 .. 255).
+struct frame_buffer_format_8bpp_t
+{
+	typedef uint8_t pixel_t;
+	typedef uint8_t unit_t; //!< storage unit of a row
+	static constexpr int pixels_per_unit = 1;
+
+	//! convert 8bit intensity level to pixel value
+	static pixel_t from_level(int level) { return level; }
+	//! convert pixel value to 8bit intensity level
+	static int ICACHE_RAM_ATTR to_level(pixel_t p) { return p; }
+	//! convert 12bit intensity level to pixel value
+	static pixel_t from_deep(int v) { return v >> 4; }
+	//! convert pixel value to 12bit intensity level
+	static int to_deep(pixel_t p) { return (p << 4) | (p >> 4); }
+
+	//! get pixel value at x of the row
+	static pixel_t ICACHE_RAM_ATTR get(const unit_t *row, int x) { return row[x]; }
+	//! set pixel value at x of the row
+	static void put(unit_t *row, int x, pixel_t p) { row[x] = p; }
+};
+
+//! 16bit-per-pixel frame buffer format.
+//! Each pixel holds 12bit intensity level (0 .. 4095), which maps
+//! to LED1642's 4096 brightness steps without loss.
+struct frame_buffer_format_12bpp_t
+{
+	typedef uint16_t pixel_t;
+	typedef uint16_t unit_t;
+	static constexpr int pixels_per_unit = 1;
+
+	static pixel_t from_level(int level) { return (level << 4) | (level >> 4); }
+	static int ICACHE_RAM_ATTR to_level(pixel_t p) { return p >> 4; }
+	static pixel_t from_deep(int v) { return v; }
+	static int to_deep(pixel_t p) { return p; }
+
+	static pixel_t ICACHE_RAM_ATTR get(const unit_t *row, int x) { return row[x]; }
+	static void put(unit_t *row, int x, pixel_t p) { row[x] = p; }
+};
+
+//! 4bit-per-pixel packed frame buffer format.
+//! Each pixel holds 4bit intensity level (0 .. 15); two pixels are
+//! packed into a byte, the left one in the lower nibble. This halves
+//! the frame buffer RAM usage of the 8bit format.
+struct frame_buffer_format_4bpp_t
+{
+	typedef uint8_t pixel_t;
+	typedef uint8_t unit_t;
+	static constexpr int pixels_per_unit = 2;
+
+	static pixel_t from_level(int level) { return (level + 8) / 17; }
+	static int ICACHE_RAM_ATTR to_level(pixel_t p) { return p * 17; }
+	static pixel_t from_deep(int v) { return (v + 136) / 273; }
+	static int to_deep(pixel_t p) { return p * 273; }
+
+	static pixel_t ICACHE_RAM_ATTR get(const unit_t *row, int x)
+	{
+		return (row[x >> 1] >> ((x & 1) << 2)) & 0x0f;
+	}
+	static void put(unit_t *row, int x, pixel_t p)
+	{
+		int shift = (x & 1) << 2;
+		row[x >> 1] = (row[x >> 1] & ~(0x0f << shift)) | (p << shift);
+	}
+};
+
+// the frame buffer format used by the firmware;
+// define FRAME_BUFFER_FORMAT in BUILD_EXTRA_FLAGS to override
+#ifndef FRAME_BUFFER_FORMAT
+#define FRAME_BUFFER_FORMAT frame_buffer_format_8bpp_t
+#endif
+
+//! blit and blend mode.
+//! For sources with alpha (such as glyphs), the source intensity is
+//! level * alpha / 255. Sources without alpha are opaque.
+enum blit_mode_t : uint8_t
+{
+	BM_COPY, //!< replace the destination with the source
+	BM_ADD, //!< add the source to the destination, saturating at the maximum
+	BM_MAX, //!< take brighter one of the source and the destination
+	BM_OVER, //!< composite the source over the destination by its alpha
+};
+
+//! Returns x / 255, rounded to nearest; the same as (x + 127) / 255.
+//! Exact for x up to 4095 * 255, which covers blending of 12bit pixels
+//! by 8bit alpha.
+static inline uint32_t div255(uint32_t x)
+{
+	uint32_t t = x + 128;
+	uint32_t q = (t + (t >> 8)) >> 8; // exact for x below 65663
+	uint32_t y = x + 127;
+	if(q * 255 > y) --q;
+	else if(y - q * 255 >= 255) ++q;
+	return q;
+}
+
+//! frame buffer storage and primitive drawing, parameterized by pixel format
+template <typename FORMAT>
+class basic_frame_buffer_t
 {
 public:
-	typedef unsigned char array_t[LED_MAX_LOGICAL_ROW][LED_MAX_LOGICAL_COL];
+	typedef FORMAT format_t;
+	typedef typename FORMAT::pixel_t pixel_t;
+	typedef typename FORMAT::unit_t unit_t;
+	typedef unit_t array_t[LED_MAX_LOGICAL_ROW][LED_MAX_LOGICAL_COL / FORMAT::pixels_per_unit];
 
 private:
 	array_t buffer;
+	uint32_t dirty[2] = {0}; //!< dirty row bitmap; bit N of dirty[y/32] for row y
+	int clip_x = 0, clip_y = 0; //!< clip rectangle origin
+	int clip_w = LED_MAX_LOGICAL_COL, clip_h = LED_MAX_LOGICAL_ROW; //!< clip rectangle size
 
 public:
 	//! returns width
@@ -24,60 +129,282 @@ public:
 	//! returns wheter the box is remaining
 	bool clip(int &fx, int &fy, int &x, int &y, int &w, int &h) const;
 
-	//! Returns array
+	//! Set clip rectangle; drawing by fill(), blit() and fonts is
+	//! confined in this rectangle
+	void set_clip(int x, int y, int w, int h);
+
+	//! Get clip rectangle
+	void get_clip(int &x, int &y, int &w, int &h) const { x = clip_x, y = clip_y, w = clip_w, h = clip_h; }
+
+	//! Reset clip rectangle to the whole buffer
+	void reset_clip() { set_clip(0, 0, LED_MAX_LOGICAL_COL, LED_MAX_LOGICAL_ROW); }
+
+	//! Returns array; rows are in the storage units of the format
 	array_t & ICACHE_RAM_ATTR array() { return buffer; }
+	const array_t & ICACHE_RAM_ATTR array() const { return buffer; }
 
-	//! Set point at specified intencity level.
+	//! Set point at specified intencity level (0 .. 255).
 	//! Note that this method does not check the boundary.
 	void set_point(int x, int y, int level)
 	{
-		buffer[y][x] = level;
+		FORMAT::put(buffer[y], x, FORMAT::from_level(level));
+		dirty[y >> 5] |= 1U << (y & 31);
 	}
-	//! get intencity level at specified point.
+	//! get intencity level (0 .. 255) at specified point.
 	//! Note that this method does not check the boundary.
 	int get_point(int x, int y) const
 	{
-		return buffer[y][x] ;
+		return FORMAT::to_level(FORMAT::get(buffer[y], x));
+	}
+
+	//! Set point at specified 12bit intencity level (0 .. 4095).
+	//! Note that this method does not check the boundary.
+	void set_point_deep(int x, int y, int v)
+	{
+		FORMAT::put(buffer[y], x, FORMAT::from_deep(v));
+		dirty[y >> 5] |= 1U << (y & 31);
+	}
+	//! get 12bit intencity level (0 .. 4095) at specified point.
+	//! Note that this method does not check the boundary.
+	int get_point_deep(int x, int y) const
+	{
+		return FORMAT::to_deep(FORMAT::get(buffer[y], x));
+	}
+
+	//! Mark rows from y to y+h-1 as modified.
+	//! Call this after writing the buffer directly via array().
+	void mark_dirty(int y, int h);
+
+	//! Returns whether the row is modified since last clear_dirty()
+	bool is_dirty(int y) const { return dirty[y >> 5] & (1U << (y & 31)); }
+
+	//! Clear dirty row bitmap
+	void clear_dirty() { dirty[0] = dirty[1] = 0; }
+
+	//! fill all region (in the clip rectangle) with specified value
+	void fill(int level);
+
+	//! fill specified region with specified value
+	void fill(int x, int y, int w, int h, int level);
+
+	//! Blend w pixels from (x, y) with the intensity level (0 .. 255),
+	//! using alpha values (0 .. 255) of each pixel.
+	//! Note that this method does not check the boundary.
+	void blend_row(int x, int y, int w, const uint8_t *alpha, int level, blit_mode_t mode);
+
+	//! Blend one opaque point at specified intencity level (0 .. 255).
+	//! Note that this method does not check the boundary.
+	void blend_point(int x, int y, int level, blit_mode_t mode)
+	{
+		static const uint8_t opaque = 255;
+		blend_row(x, y, 1, &opaque, level, mode);
 	}
 
+	//! Draw a 1bpp bitmap of w x h (w up to 32) at (x, y) with the
+	//! intensity level (0 .. 255). Each of rows holds a row, the leftmost
+	//! pixel in bit 0. Set bits are opaque and clear bits are transparent,
+	//! except that BM_COPY clears pixels of clear bits.
+	//! The bitmap is clipped against the clip rectangle.
+	void draw_mask(int x, int y, int w, int h, const uint32_t *rows, int level, blit_mode_t mode);
+
+	//! Copy a region of w x h at (sx, sy) of src to (dx, dy) of this buffer.
+	//! The region is clipped against both buffers. The source is scaled by
+	//! opacity (0 .. 255), which is also the alpha for BM_OVER. src may be
+	//! this buffer; overlapping regions are handled for opaque BM_COPY.
+	void blit(const basic_frame_buffer_t & src, int sx, int sy, int w, int h,
+		int dx, int dy, blit_mode_t mode = BM_COPY, int opacity = 255);
+
+	//! Same as blit(), but from pixel rows out of a frame buffer, such as
+	//! a layer surface; source row N starts at rows + N * stride units.
+	//! The region must be within the source.
+	void blit_rows(const unit_t *rows, int stride, int sx, int sy, int w, int h,
+		int dx, int dy, blit_mode_t mode = BM_COPY, int opacity = 255);
+};
+
+//! Convert a UTF-8 character from in to wide character out, and advance in.
+//! Returns false on invalid sequence.
+bool utf8tow(const uint8_t * & in, uint32_t *out);
+
+//! the frame buffer
+class frame_buffer_t : public basic_frame_buffer_t<FRAME_BUFFER_FORMAT>
+{
+public:
 	//! Draw a character at specified position
-	void draw_char(int x, int y, int level, int ch, const font_base_t & font); 
+	void draw_char(int x, int y, int level, int ch, const font_base_t & font,
+		blit_mode_t mode = BM_OVER);
 
 	//! Draw text at specified position
-	void draw_text(int x, int y, int level, const __FlashStringHelper *ifsh, const font_base_t & font); 
+	void draw_text(int x, int y, int level, const __FlashStringHelper *ifsh, const font_base_t & font,
+		blit_mode_t mode = BM_OVER);
 
-	void draw_text(int x, int y, int level, const String &s, const font_base_t & font)
+	void draw_text(int x, int y, int level, const String &s, const font_base_t & font,
+		blit_mode_t mode = BM_OVER)
 	{
-			draw_text(x, y, level, s.c_str(), font);
+			draw_text(x, y, level, s.c_str(), font, mode);
 	}
 
-	void draw_text(int x, int y, int level, const char *s, const font_base_t & font);
+	void draw_text(int x, int y, int level, const char *s, const font_base_t & font,
+		blit_mode_t mode = BM_OVER);
 
-	//! Get text width specified by the string and font
+	//! Get text width specified by the string and font.
+	//! Glyph advances are summed in 1/64 px, then rounded to px; draw_text()
+	//! places glyphs at the rounded pen positions likewise.
 	int get_text_width(const String &s, const font_base_t & font)
 	{
 		return get_text_width(s.c_str(), font);
 	}
 
 	int get_text_width(const char *s, const font_base_t & font);
+};
 
-	//! fill all region with specified value
-	void fill(int level);
 
-	//! fill specified region with specified value
-	void fill(int x, int y, int w, int h, int level);
+// number of frame buffers; 2 for double buffering, 3 for triple buffering.
+// define FRAME_BUFFER_COUNT in BUILD_EXTRA_FLAGS to override
+#ifndef FRAME_BUFFER_COUNT
+#define FRAME_BUFFER_COUNT 2
+#endif
+static_assert(FRAME_BUFFER_COUNT == 2 || FRAME_BUFFER_COUNT == 3, "FRAME_BUFFER_COUNT must be 2 or 3");
+
+// the framebuffer
+extern frame_buffer_t buffers[FRAME_BUFFER_COUNT];
+
+/**
+ * Ownership of the frame buffers, as indices into buffers[].
+ * bit 0-1: front; being shown, owned by the LED scan interrupt
+ * bit 2-3: ready; waiting to be shown at next vsync
+ * bit 4-5: back; to be drawn on by the main loop
+ * FRAME_BUFFER_NONE in a field means no buffer is in that state.
+ * All fields are packed into one word, so that every transition is done
+ * by one store; the scan interrupt is the only writer of the front field.
+ */
+extern volatile uint32_t frame_buffer_state;
+static constexpr uint32_t FRAME_BUFFER_NONE = 3;
+
+static inline ICACHE_RAM_ATTR uint32_t frame_buffer_front_index(uint32_t st) { return st & 3; }
+static inline ICACHE_RAM_ATTR uint32_t frame_buffer_ready_index(uint32_t st) { return (st >> 2) & 3; }
+static inline ICACHE_RAM_ATTR uint32_t frame_buffer_back_index (uint32_t st) { return (st >> 4) & 3; }
+static inline ICACHE_RAM_ATTR uint32_t frame_buffer_make_state(uint32_t front, uint32_t ready, uint32_t back)
+{
+	return front | (ready << 2) | (back << 4);
+}
+
+//! Wait until a background buffer is available to draw on
+void frame_buffer_wait_bg();
+
+//! Wait until the requested flip is shown
+void frame_buffer_wait_flip();
+
+static inline ICACHE_RAM_ATTR frame_buffer_t & get_current_frame_buffer()
+{
+	return buffers[frame_buffer_front_index(frame_buffer_state)];
+}
+//! Returns the frame buffer last requested to be shown;
+//! the ready one if any, or the front
+static inline frame_buffer_t & get_last_frame_buffer()
+{
+	uint32_t st = frame_buffer_state;
+	uint32_t last = frame_buffer_ready_index(st);
+	if(last == FRAME_BUFFER_NONE) last = frame_buffer_front_index(st);
+	return buffers[last];
+}
+static inline ICACHE_RAM_ATTR frame_buffer_t & get_bg_frame_buffer()
+{
+	// with double buffering, no buffer can be drawn on until
+	// the requested flip is done
+	if(frame_buffer_back_index(frame_buffer_state) == FRAME_BUFFER_NONE)
+		frame_buffer_wait_bg();
+	return buffers[frame_buffer_back_index(frame_buffer_state)];
+}
+
+//! frame buffer statistics
+struct frame_buffer_stat_t
+{
+	uint32_t flip_count; //!< total number of flips
+	uint32_t changed_rows; //!< total number of rows which differed from the previous frame
+	int last_changed_rows; //!< number of rows which differed from the previous frame at the last flip
+	uint32_t dropped_count; //!< number of frames replaced by a newer one before shown
+	uint32_t damaged_pixels; //!< total number of pixels in the damage region
+	int last_damaged_pixels; //!< number of pixels in the damage region at the last flip
 };
 
+/**
+ * Damage region; the part of the frame to be redrawn, as a union of up to
+ * max_rects rectangles. Overlapping rectangles are merged into their
+ * bounding box, and so are the closest ones when there is no more room,
+ * thus the rectangles never overlap each other.
+ */
+class frame_buffer_damage_t
+{
+public:
+	static constexpr int max_rects = 4;
 
-// the framebuffer
-extern frame_buffer_t buffers[2]; // for double buffering
-extern frame_buffer_t & current_frame_buffer;
-extern frame_buffer_t & bg_frame_buffer;
+	struct rect_t
+	{
+		int x, y, w, h;
+	};
+
+private:
+	rect_t rects[max_rects];
+	int count = 0;
+
+public:
+	//! Add a rectangle; clipped against the frame
+	void add(int x, int y, int w, int h);
+
+	//! Add the whole frame
+	void add_all() { clear(); add(0, 0, LED_MAX_LOGICAL_COL, LED_MAX_LOGICAL_ROW); }
+
+	//! Clear the region
+	void clear() { count = 0; }
+
+	//! Returns whether the region is empty
+	bool empty() const { return count == 0; }
+
+	//! Returns whether the region covers the whole frame
+	bool is_all() const { return get_area() == LED_MAX_LOGICAL_COL * LED_MAX_LOGICAL_ROW; }
+
+	//! Returns number of rectangles
+	int get_count() const { return count; }
+
+	//! Returns the rectangle at the index
+	const rect_t & get(int i) const { return rects[i]; }
+
+	//! Returns number of pixels in the region
+	int get_area() const;
+};
+
+//! Returns the damage region accumulated for the next flip.
+//! frame_buffer_flip() clears the region.
+frame_buffer_damage_t & frame_buffer_get_damage();
+
+//! Make the background frame buffer the same as the last requested frame,
+//! so that only the damage region needs to be drawn again. Only rows which
+//! may differ are copied.
+void frame_buffer_copy_forward();
+
+//! Request to show the background frame buffer.
+//! The buffers are swapped by the LED scan interrupt at the top of the next
+//! frame, so that no frame is shown half old and half new. With triple
+//! buffering, a frame still waiting to be shown is replaced by the new one.
+//! The damage region is accounted in the statistics and cleared; a frame
+//! drawn without reporting any damage counts as entirely damaged.
+//! Returns the flip sequence number which frame_buffer_get_flip_seq()
+//! reaches when the frame is shown.
+uint32_t frame_buffer_flip();
+
+//! Returns the flip sequence number of the frame being shown
+uint32_t frame_buffer_get_flip_seq();
+
+//! Returns the number of vsyncs so far, at each of which a requested flip
+//! could be performed. While the LEDs are scanned, this advances once a
+//! frame, as long as the main loop keeps up with led_encode_behind_beam().
+uint32_t frame_buffer_get_vsync_count();
 
-static inline ICACHE_RAM_ATTR frame_buffer_t & get_current_frame_buffer() { return current_frame_buffer;}
-static inline ICACHE_RAM_ATTR frame_buffer_t & get_bg_frame_buffer() { return bg_frame_buffer;}
+//! Perform the requested flip; called by the LED scan interrupt at vsync.
+//! Returns bitmap of logical rows which differ from the previous frame.
+uint64_t frame_buffer_vsync();
 
-//! swap current frame buffer
-void frame_buffer_flip();
+//! get frame buffer statistics
+const frame_buffer_stat_t & frame_buffer_get_stat();
 
 #endif
@@ -0,0 +1,165 @@
+#include <Arduino.h>
+#include <algorithm>
+#include <new>
+#include "layer.h"
+
+layer_t::layer_t(draw_t _draw, int _x, int _y, int _w, int _h, bool retained) :
+	draw(_draw), surface(nullptr),
+	x(_x), y(_y), w(_w), h(_h), drawn_x(_x), drawn_y(_y)
+{
+	if(retained)
+	{
+		surface = new (std::nothrow) frame_buffer_t::unit_t[surface_stride() * h]();
+		if(!surface)
+			Serial.printf_P(PSTR("Layer surface of %dx%d not allocated; drawn directly\r\n"), w, h);
+	}
+}
+
+layer_t::~layer_t()
+{
+	delete [] surface;
+}
+
+/**
+ * Exchange the region of fb at (ix, iy, iw, ih), which must be within
+ * the layer rectangle, with the same region of the surface
+ */
+void layer_t::exchange_surface(frame_buffer_t & fb, int ix, int iy, int iw, int ih)
+{
+	typedef frame_buffer_t::format_t format_t;
+	int stride = surface_stride();
+	for(int yy = iy; yy < iy + ih; ++yy)
+	{
+		frame_buffer_t::unit_t *s = surface + (yy - y) * stride;
+		frame_buffer_t::unit_t *d = fb.array()[yy];
+		for(int xx = ix; xx < ix + iw; ++xx)
+		{
+			frame_buffer_t::pixel_t t = format_t::get(d, xx);
+			format_t::put(d, xx, format_t::get(s, xx - x));
+			format_t::put(s, xx - x, t);
+		}
+	}
+	fb.mark_dirty(iy, ih);
+}
+
+/**
+ * Draw the content into the surface.
+ * The draw callback needs a frame buffer, so the content is drawn into fb
+ * in the layer rectangle, whatever the clip rectangle is, then exchanged
+ * with the surface. fb is left as it was.
+ */
+void layer_t::render(frame_buffer_t & fb)
+{
+	int cx, cy, cw, ch;
+	fb.get_clip(cx, cy, cw, ch);
+
+	// the part of the layer rectangle within the frame
+	int ix, iy, iw, ih;
+	fb.set_clip(x, y, w, h);
+	fb.get_clip(ix, iy, iw, ih);
+
+	exchange_surface(fb, ix, iy, iw, ih); // keep what is below in the surface
+	fb.fill(0);
+	draw(fb);
+	exchange_surface(fb, ix, iy, iw, ih); // the content to the surface, what is below back
+
+	fb.set_clip(cx, cy, cw, ch);
+}
+
+void layer_t::set_position(int _x, int _y)
+{
+	if(x == _x && y == _y) return;
+	// the content is drawn in frame coordinates
+	if(surface) content_dirty = true;
+	x = _x, y = _y;
+	changed = true;
+}
+
+void layer_t::set_opacity(int o)
+{
+	if(opacity == o) return;
+	opacity = o;
+	changed = true;
+}
+
+void layer_t::set_mode(blit_mode_t m)
+{
+	if(mode == m) return;
+	mode = m;
+	changed = true;
+}
+
+void layer_t::set_visible(bool b)
+{
+	if(visible == b) return;
+	visible = b;
+	changed = true;
+}
+
+
+void compositor_t::add(layer_t * layer)
+{
+	layers.push_back(layer);
+	changed = true;
+}
+
+void compositor_t::remove(layer_t * layer)
+{
+	std::vector<layer_t *>::iterator it =
+		std::find(layers.begin(), layers.end(), layer);
+	if(it != layers.end())
+	{
+		layers.erase(it);
+		changed = true;
+	}
+}
+
+void compositor_t::report_damage(frame_buffer_damage_t & damage)
+{
+	if(changed) damage.add_all();
+	changed = false;
+
+	for(auto && l : layers)
+	{
+		if(!l->changed) continue;
+		l->changed = false;
+		damage.add(l->drawn_x, l->drawn_y, l->w, l->h);
+		if(l->x != l->drawn_x || l->y != l->drawn_y)
+		{
+			damage.add(l->x, l->y, l->w, l->h);
+			l->drawn_x = l->x, l->drawn_y = l->y;
+		}
+	}
+}
+
+void compositor_t::compose(frame_buffer_t & fb)
+{
+	int cx, cy, cw, ch;
+	fb.get_clip(cx, cy, cw, ch);
+
+	for(auto && l : layers)
+	{
+		if(!l->visible) continue;
+
+		// skip layers outside the clip rectangle
+		int fx = 0, fy = 0, x = l->x, y = l->y, w = l->w, h = l->h;
+		if(!fb.clip(fx, fy, x, y, w, h) || w <= 0 || h <= 0) continue;
+
+		if(!l->surface)
+		{
+			// direct layer; drawn in the layer rectangle within the clip rectangle
+			fb.set_clip(x, y, w, h);
+			l->draw(fb);
+			fb.set_clip(cx, cy, cw, ch);
+			l->content_dirty = false;
+			continue;
+		}
+
+		if(l->content_dirty)
+		{
+			l->render(fb);
+			l->content_dirty = false;
+		}
+		fb.blit_rows(l->surface, l->surface_stride(), fx, fy, w, h, x, y, l->mode, l->opacity);
+	}
+}
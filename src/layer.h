@@ -0,0 +1,103 @@
+#ifndef LAYER_H_
+#define LAYER_H_
+
+#include <vector>
+#include <functional>
+#include "frame_buffer.h"
+
+/**
+ * A layer of the compositor.
+ * A retained layer owns an off-screen surface of the layer size, into which
+ * the content is drawn only when the layer is invalidated; the surface is
+ * then blitted at every composition. A direct layer has no surface and is
+ * drawn straight into the target at every composition; this is cheaper in
+ * RAM for the content which changes every time anyway.
+ * Either is drawn clipped to the layer rectangle, by the clip rectangle of
+ * the frame buffer; the point primitives, which do not check it, must be
+ * kept in the layer rectangle by the callback. A direct layer is drawn with
+ * the blit modes of its own drawing, so opacity and mode do not apply.
+ * A retained layer whose surface cannot be allocated is drawn as a direct
+ * layer.
+ */
+class layer_t
+{
+public:
+	//! Draw callback. Draw the content in the layer rectangle of fb, in
+	//! frame coordinates; the clip rectangle of fb is within the layer
+	//! rectangle, and is cleared beforehand for retained layers.
+	typedef std::function<void (frame_buffer_t & fb)> draw_t;
+
+protected:
+	draw_t draw; //!< draw callback
+	frame_buffer_t::unit_t * surface; //!< off-screen surface, w x h pixels; nullptr for direct layers
+	int x, y, w, h; //!< layer rectangle in the frame
+	int opacity = 255; //!< opacity (0 .. 255); applies to retained layers only
+	blit_mode_t mode = BM_MAX; //!< how the surface is combined with lower layers; retained layers only
+	bool visible = true; //!< whether the layer is visible
+	bool content_dirty = true; //!< whether the content needs to be drawn again
+	bool changed = true; //!< whether the layer needs to be composited again
+	int drawn_x = 0, drawn_y = 0; //!< position as of last reported damage
+
+public:
+	layer_t(draw_t _draw, int _x, int _y, int _w, int _h, bool retained);
+	~layer_t();
+
+	//! Request to draw the content again
+	void invalidate() { content_dirty = changed = true; }
+
+	//! Move the layer rectangle
+	void set_position(int _x, int _y);
+
+	void set_opacity(int o);
+	void set_mode(blit_mode_t m);
+	void set_visible(bool b);
+
+	bool get_visible() const { return visible; }
+	bool get_retained() const { return surface != nullptr; } //!< whether the layer has its surface
+
+private:
+	//! Returns number of storage units of a surface row
+	int surface_stride() const
+	{
+		return (w + frame_buffer_t::format_t::pixels_per_unit - 1) /
+			frame_buffer_t::format_t::pixels_per_unit;
+	}
+
+	void exchange_surface(frame_buffer_t & fb, int ix, int iy, int iw, int ih);
+	void render(frame_buffer_t & fb);
+
+	friend class compositor_t;
+};
+
+/**
+ * Layer compositor.
+ * Layers are composited bottom to top into the target frame buffer.
+ * Rectangles of changed layers are reported as the damage region, so that
+ * only they are composited again.
+ */
+class compositor_t
+{
+	std::vector<layer_t *> layers; //!< layers, bottom to top; not owned
+	bool changed = true; //!< whether the layer list is changed
+
+public:
+	//! Add a layer on the top
+	void add(layer_t * layer);
+
+	//! Remove a layer
+	void remove(layer_t * layer);
+
+	//! Request to composite again, such as when the target is
+	//! overwritten by others
+	void invalidate() { changed = true; }
+
+	//! Add rectangles of changed layers to the damage region;
+	//! both old and new rectangles for moved ones
+	void report_damage(frame_buffer_damage_t & damage);
+
+	//! Composite layers into the clip rectangle of fb,
+	//! which must be cleared beforehand
+	void compose(frame_buffer_t & fb);
+};
+
+#endif
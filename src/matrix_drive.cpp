@@ -4,6 +4,7 @@
 #include <ESP8266WiFi.h>
 #include "frame_buffer.h"
 #include "matrix_drive.h"
+#include "matrix_encode.h"
 #include "panic.h"
 #include "settings.h"
 
@@ -14,10 +15,6 @@
 
 #define BUTTON_SENS_GPIO 16
 
-#define LED_MAX_ROW 24
-#define LED_MAX_COL 128
-
-
 // inline fast version of digitalWrite
 #define dW(pin, val)  do { if(pin < 16){ \
     if(val) GPOS = (1 << pin); \
@@ -215,8 +212,10 @@ static void set_i2s_div_pat(int div, uint32_t pat)
  */
 void led_start_pwm_clock()
 {
+	bool changed = !led_pwm_clock_running;
 	led_pwm_clock_running = true;
 	_set_i2s_div();
+	if(changed) led_update_scanout(); // scanout must be re-encoded using gamma table
 }
 
 /**
@@ -232,10 +231,22 @@ void led_start_pwm_clock()
  */
 void led_stop_pwm_clock()
 {
+	bool changed = led_pwm_clock_running;
 	led_pwm_clock_running = false;
 	_set_i2s_div();
+	if(changed) led_update_scanout(); // scanout must be re-encoded using b&w table
 }
 
+/**
+ * SPI clock frequency
+ */
+static constexpr uint32_t led_spi_frequency = 13333333;
+
+/**
+ * CPU cycle count at the start of the last SPI transaction
+ */
+static uint32_t led_spi_start_tick;
+
 /**
  * Initialize SPI hardware and clock generator for LED1642
  */
@@ -244,7 +255,7 @@ static void led_init_spi_and_ledclock()
 	// setup hardware SPI
 	SPI.begin();
 	SPI.setHwCs(false);
-	SPI.setFrequency((int)13333333);
+	SPI.setFrequency((int)led_spi_frequency);
 	SPI1U = SPIUMOSI | SPIUSSE | SPIUFWDUAL;
 	SPI1C |= SPICFASTRD | SPICDOUT; // use DIO
 	SPI1C &= ~(SPICWBO | SPICRBO); // MSB first
@@ -284,97 +295,65 @@ static void ICACHE_RAM_ATTR led_spi_set_length(int bits)
     SPI1U1 = ((SPI1U1 & mask) | ((bits << SPILMOSI) | (0 << SPILMISO)));
 }
 
-
-static constexpr uint32_t bit_interleave8(uint32_t v)
-{
-	// 0b0000000000000000ABCDEFGHIJKLMNOP ->
-	// 0b00000000ABCDEFGH00000000IJKLMNOP
-	return (v  | v << 8) &
-	   0b00000000111111110000000011111111u;
-}
-
-static constexpr uint32_t bit_interleave4(uint32_t v)
-{
-	// 0b00000000ABCDEFGH00000000IJKLMNOP ->
-	// 0b0000ABCD0000EFGH0000IJKL0000MNOP
-	return (v  | v << 4) &
-	   0b00001111000011110000111100001111u;
-}
-
-static constexpr uint32_t bit_interleave2(uint32_t v)
-{
-	// 0b0000ABCD0000EFGH0000IJKL0000MNOP ->
-	// 0b00AB00CD00EF00GH00IJ00KL00MN00OP
-	return (v  | v << 2) &
-	   0b00110011001100110011001100110011u;
-}
-
-static constexpr uint32_t bit_interleave1(uint32_t v)
+/**
+ * Wait for previous SPI transaction
+ */
+static inline void ICACHE_RAM_ATTR led_spi_wait()
 {
-	// 0b00AB00CD00EF00GH00IJ00KL00MN00OP
-	// 0b0A0B0C0D0E0F0G0H0I0J0K0L0M0N0O0P
-	return (v  | v << 1) &
-	   0b01010101010101010101010101010101u;
+	while(SPI1CMD & SPIBUSY) /**/ ;
 }
 
-
 /**
- * bit interleave function
+ * Returns whether SPI transaction is in progress
  */
-static constexpr uint32_t bit_interleave(uint16_t v)
+static inline bool ICACHE_RAM_ATTR led_spi_busy()
 {
-	// Every bit in v goes to even bit of the result.
-	// This is optimization for SPI DIO, which send every even bit
-	// to the MOSI line, and every odd bit to the MISO line.
-	return
-		bit_interleave1(
-		bit_interleave2(
-		bit_interleave4(
-		bit_interleave8(v))));
+	return SPI1CMD & SPIBUSY;
 }
 
 /**
- * 8bit swap function
- */
- static constexpr uint32_t ICACHE_RAM_ATTR bit_8_swap(uint32_t v) {
- 	return ((v >> 8) & 0x00ff00ff) | ((v & 0x00ff00ff) << 8); }
-/**
- * 16bit swap function
+ * Returns pointer to the top of SPI FIFO
  */
-static constexpr uint32_t ICACHE_RAM_ATTR bit_16_swap(uint32_t v) {
-	return ((v >> 16) & 0x0000ffff) | ((v & 0x0000ffff) <<16); }
+static inline volatile uint32_t * ICACHE_RAM_ATTR led_spi_fifo()
+{
+	return &SPI1W0;
+}
 
 /**
- * byte reverse function
+ * Begin SPI transaction
  */
-static constexpr uint32_t ICACHE_RAM_ATTR byte_reverse(uint32_t v)
+static inline void ICACHE_RAM_ATTR led_spi_start()
 {
-	return bit_16_swap(bit_8_swap(v));
+	led_spi_start_tick = ESP.getCycleCount();
+	SPI1CMD |= SPIBUSY;
 }
 
 /**
- * Gamma curve function
+ * Returns the CPU cycle count at which the SPI transaction in progress
+ * ends, computed from its length; two bits are sent per clock in DIO mode
  */
-static constexpr uint32_t gamma_255_to_4095(int in)
+static inline uint32_t ICACHE_RAM_ATTR led_spi_end_tick()
 {
-  return byte_reverse(
-  	bit_interleave(
-  	(uint32_t) (pow((double)(in+20) / (255.0+20), 3.5) * 3800)));  
+	uint32_t bits = ((SPI1U1 >> SPILMOSI) & SPIMMOSI) + 1;
+	return led_spi_start_tick + (bits + 1) / 2 * (F_CPU / led_spi_frequency);
 }
 
-#define G4(N) gamma_255_to_4095((N)), gamma_255_to_4095((N)+1), \
-      gamma_255_to_4095((N)+2), gamma_255_to_4095((N)+3), 
+#define I4(N) bit_interleave_swapped8((N)), bit_interleave_swapped8((N)+1), \
+      bit_interleave_swapped8((N)+2), bit_interleave_swapped8((N)+3),
 
-#define G16(N) G4(N) G4((N)+4) G4((N)+8) G4((N)+12) 
-#define G64(N) G16(N) G16((N)+16) G16((N)+32) G16((N)+48) 
+#define I16(N) I4(N) I4((N)+4) I4((N)+8) I4((N)+12)
+#define I64(N) I16(N) I16((N)+16) I16((N)+32) I16((N)+48)
 
 /**
- * Gamma curve table
+ * Byte-wise interleave table, to interleave 12bit PWM values at runtime
  */
-static constexpr uint32_t gamma_table[256] = {
-	G64(0) G64(64) G64(128) G64(192)
-	}; // this table must be accessible from interrupt routine;
-	// do not place in FLASH !!
+static constexpr uint16_t interleave_table[256] = {
+	I64(0) I64(64) I64(128) I64(192)
+	};
+
+static_assert(
+	((uint32_t)bit_interleave_swapped8(0x34) << 16 | bit_interleave_swapped8(0x0c)) ==
+		byte_reverse(bit_interleave(0x0c34)), "bit_interleave_swapped8 mismatch");
 
 
 
@@ -387,8 +366,8 @@ static constexpr uint32_t gamma_table[256] = {
 static void ICACHE_RAM_ATTR led_sel_row_prepare(int n)
 {
 	static constexpr uint32_t bit_sel_pattern[LED_MAX_ROW + 1] = {
-		-1, // for -1
-#define BP(N) (~byte_reverse(1U << (31-(N))))
+		row_sel_pattern(-1), // for -1
+#define BP(N) row_sel_pattern(N)
 #define BP8(N) \
 	BP((N)+0),BP((N)+1),BP((N)+2),BP((N)+3), \
 	BP((N)+4),BP((N)+5),BP((N)+6),BP((N)+7) 
@@ -397,7 +376,7 @@ static void ICACHE_RAM_ATTR led_sel_row_prepare(int n)
 		BP8(16) };
 
 	// wait for SPI transaction
-	while(SPI1CMD & SPIBUSY) /**/ ;
+	led_spi_wait();
 
 	// SPI setup
 	SPI1U &= ~ SPIUFWDUAL;
@@ -406,7 +385,7 @@ static void ICACHE_RAM_ATTR led_sel_row_prepare(int n)
 	led_spi_set_length(LED_MAX_ROW + (LED_MAX_COL/16) * 16);
 
 	// row selection
-	volatile uint32_t * fifoPtr = &SPI1W0;
+	volatile uint32_t * fifoPtr = led_spi_fifo();
 
 	// bit 31 = row0, 30 = row1 ... and so on
 	*(fifoPtr++) = bit_sel_pattern[n + 1];
@@ -419,11 +398,11 @@ static void ICACHE_RAM_ATTR led_sel_row_prepare(int n)
 	for(int i = 0; i < remain_len; ++i) *(fifoPtr ++) = 0;
 
 	// begin SPI transaction
-	SPI1CMD |= SPIBUSY;
+	led_spi_start();
 }
 static void ICACHE_RAM_ATTR led_sel_row_blank()
 {
-	while(SPI1CMD & SPIBUSY) /**/ ; // wait for previous SPI transaction
+	led_spi_wait(); // wait for previous SPI transaction
 
 	// let HC595 latching the data
 	led_hc595_latch_out(true);
@@ -459,9 +438,9 @@ static void ICACHE_RAM_ATTR button_read_gpio()
 	button_read = value;
 }
 
-static constexpr int max_phase = 12; //!< phase count
+static constexpr int max_phase = LED_NUM_PHASES; //!< phase count
 	// current_phase
-	// 0:             : set LED1642 control word
+	// 0:             : set LED1642 control word, start encoding pass (row 0)
 	// 1:             : read buttons, increment row, led ([0])
 	// 2:             : led ([2])
 	// 3:             : led ([4])
@@ -556,20 +535,166 @@ static_assert(phase_sum(timer_interval_values[0], max_phase-1) == timer_interval
 static_assert(phase_sum(timer_interval_values[1], max_phase-1) == timer_interval_values[1].timer_interval, "timer_interval[1] sum mismatch");
 static_assert(phase_sum(timer_interval_values[2], max_phase-1) == timer_interval_values[2].timer_interval, "timer_interval[2] sum mismatch");
 
-static inline uint32_t ICACHE_RAM_ATTR led_tbl_gamma(uint8_t x) { return gamma_table[x]; }
-static inline uint32_t ICACHE_RAM_ATTR led_tbl_bw(uint8_t x)
+/**
+ * Phase schedule in use.
+ * Initially copied from timer_interval_values[].timer_duration_phase,
+ * and may be replaced by the calibrated one. Each row must sum up to
+ * timer_interval_values[].timer_interval.
+ */
+static int32_t led_phase_schedule[LED_NUM_INTERVAL_MODE][max_phase];
+
+/**
+ * Remaining rows to measure for phase schedule calibration;
+ * 0 = not calibrating
+ */
+static volatile int led_phase_calib_rows = 0;
+
+/**
+ * Interval index under calibration
+ */
+static int led_phase_calib_index = 0;
+
+/**
+ * Worst-case cost of each phase in CPU cycle, measured from the scheduled
+ * tick of the phase to the completion of the SPI transaction.
+ */
+static uint32_t led_phase_cost_max[max_phase];
+
+/**
+ * Number of rows to measure for calibration
+ */
+static constexpr int led_phase_calib_num_rows = 24 * 60 * 10;
+
+static inline uint32_t ICACHE_RAM_ATTR led_tbl_bw(frame_buffer_t::pixel_t x)
 {
 	// black & white (2 level) display
-	return x >= 0x80 ? byte_reverse(0b01010101010101010101010101010101) : 0;
+	return frame_buffer_t::format_t::to_level(x) >= 0x80 ?
+		byte_reverse(0b01010101010101010101010101010101) : 0;
 }
 
 
 /**
- * set one line brightness
+ * Gamma LUT, specialized by the frame buffer format
  */
-static void ICACHE_RAM_ATTR led_set_brightness_one_row(int start_led, bool do_global_latch = false)
+template <typename FORMAT> struct basic_led_gamma_lut_t;
+
+/**
+ * Gamma LUT for 8bit pixels; holds encoded word for each level
+ */
+template <> struct basic_led_gamma_lut_t<frame_buffer_format_8bpp_t>
+{
+	uint32_t table[256];
+
+	void generate(const led_gamma_params_t & params)
+	{
+		for(int i = 0; i < 256; ++i)
+			table[i] = byte_reverse(bit_interleave(
+				gamma_curve(i, 255, params.black_offset,
+					params.exponent_100, params.ceiling)));
+	}
+
+	uint32_t ICACHE_RAM_ATTR encode(uint8_t x) const { return table[x]; }
+};
+
+/**
+ * Gamma LUT for 12bit deep pixels; holds 257 knots of the curve,
+ * between which the input is linearly interpolated.
+ */
+template <> struct basic_led_gamma_lut_t<frame_buffer_format_12bpp_t>
+{
+	uint16_t knots[257];
+
+	void generate(const led_gamma_params_t & params)
+	{
+		for(int k = 0; k <= 256; ++k)
+			knots[k] = gamma_curve(k * 16, 4095, params.black_offset * 4095 / 255,
+					params.exponent_100, params.ceiling);
+	}
+
+	uint32_t ICACHE_RAM_ATTR encode(uint16_t x) const
+	{
+		x &= 0xfff;
+		int k = x >> 4, f = x & 15;
+		uint32_t g = knots[k] + (((knots[k + 1] - knots[k]) * f) >> 4);
+		return ((uint32_t)interleave_table[g & 0xff] << 16) | interleave_table[g >> 8];
+	}
+};
+
+/**
+ * Gamma LUT for 4bit packed pixels; holds encoded word for each of
+ * 16 levels, taken from the same curve as the 8bit one
+ */
+template <> struct basic_led_gamma_lut_t<frame_buffer_format_4bpp_t>
+{
+	uint32_t table[16];
+
+	void generate(const led_gamma_params_t & params)
+	{
+		for(int i = 0; i < 16; ++i)
+			table[i] = byte_reverse(bit_interleave(
+				gamma_curve(frame_buffer_format_4bpp_t::to_level(i), 255, params.black_offset,
+					params.exponent_100, params.ceiling)));
+	}
+
+	uint32_t ICACHE_RAM_ATTR encode(uint8_t x) const { return table[x]; }
+};
+
+typedef basic_led_gamma_lut_t<frame_buffer_t::format_t> led_gamma_lut_t;
+
+/**
+ * Double-buffered gamma LUT.
+ * New LUT is always generated into the one not in use,
+ * then led_gamma_lut is switched to it.
+ */
+static led_gamma_lut_t led_gamma_luts[2];
+
+/**
+ * Gamma LUT in use
+ */
+static const led_gamma_lut_t * volatile led_gamma_lut = led_gamma_luts + 0;
+
+/**
+ * Gamma LUT to be used from the next frame; nullptr if none.
+ * The scan interrupt switches led_gamma_lut to this at vsync.
+ */
+static const led_gamma_lut_t * volatile led_gamma_lut_next = nullptr;
+
+/**
+ * Parameters of the gamma LUT in use
+ */
+static led_gamma_params_t led_gamma_params;
+static bool led_gamma_valid = false; //!< whether led_gamma_params is valid
+
+/**
+ * Default gamma parameters
+ */
+static constexpr led_gamma_params_t led_default_gamma_params = { 350, 20, 3800 };
+
+
+static constexpr int led_scanout_groups = 8; //!< number of SPI transactions per row
+static constexpr int led_scanout_words = 16; //!< number of FIFO words per one SPI transaction
+
+/**
+ * Pre-encoded scanout buffer.
+ * Every word is ready to be copied into the SPI FIFO as is;
+ * gamma converted, bit-interleaved, and latch pattern merged.
+ * This buffer is written by led_encode_row(), which is called from the
+ * main loop by led_encode_behind_beam() once the scan is running; the
+ * timer interrupt routine only copies it into the SPI FIFO.
+ * This takes 12KB, whatever the frame buffer format. The whole frame is
+ * kept, rather than a row or two encoded just ahead of the beam, so that
+ * the main loop may fall behind by up to a frame (11ms to 15ms) without
+ * the interrupt having to encode anything; a row ahead would have to be
+ * ready every 0.5ms, which the main loop cannot promise under WiFi load.
+ */
+static uint32_t led_scanout[LED_MAX_ROW][led_scanout_groups][led_scanout_words];
+
+/**
+ * Encode one scan row (two logical rows of the frame buffer)
+ * into the scanout buffer
+ */
+static void ICACHE_RAM_ATTR led_encode_row(const frame_buffer_t & fb, int row)
 {
-	// TODO: write stride explanation here
 	/*
 		led order:
 		  0   2   4   6   8  10  12  14  ...
@@ -579,78 +704,200 @@ static void ICACHE_RAM_ATTR led_set_brightness_one_row(int start_led, bool do_gl
 	0:	  0   1   2   3   4   5   6   7 ...
 	1:	  0   1   2   3   4   5   6   7 ...
 
-		16 LEDs can be set at most per one call to this function
+		16 LEDs are sent per one SPI transaction (a group).
 
 		first (on VRAM address)
-		offset row0 start_led + 0  +   : 0,  1*16,  2*16,  3*16,  4*16,  5*16,  6*16,  7*16(LATCH),
-		offset row1 start_led + 0  +   : 0,  1*16,  2*16,  3*16,  4*16,  5*16,  6*16,  7*16(LATCH),
-		
-			
-	*/ 
-
-
-
-//	static_assert(LED_MAX_COL == 64, "sorry at this point LED_MAX_COL is not flexible");
-	const uint8_t *buf = get_current_frame_buffer().array()[current_row*2];
-	const uint8_t *buf2 = get_current_frame_buffer().array()[current_row*2+1];
-
-	volatile uint32_t * fifoPtr = &SPI1W0;
-
-	while(SPI1CMD & SPIBUSY) /**/ ; // wait for previous SPI transaction
-	led_spi_set_length(32*16);
-
-	constexpr uint32_t global_latch_pattern =
-		byte_reverse(0b00000000000000000000001010101010);
-	constexpr uint32_t data_latch_pattern   =
-		byte_reverse(0b00000000000000000000000000101010);
-
-	// fill fifo with buffer, with
-	// converting gamma and adding latch pattern
-#define WR(N, L, TBL) do { \
-	uint32_t w = TBL(*(N)); w += L; \
-	*(fifoPtr++) = w; } while(0)
-#define PL(TBL, I,C,L) WR((I)+start_led+(C), (L), TBL)
-#define REG(TBL) do { \
-	PL(TBL, 0*8,buf,  0); \
-	PL(TBL, 1*8,buf,  0); \
-	PL(TBL, 2*8,buf,  0); \
-	PL(TBL, 3*8,buf,  0); \
-	PL(TBL, 4*8,buf,  0); \
-	PL(TBL, 5*8,buf,  0); \
-	PL(TBL, 6*8,buf,  0); \
-	PL(TBL, 7*8,buf,  data_latch_pattern); \
-	PL(TBL, 0*8,buf2, 0); \
-	PL(TBL, 1*8,buf2, 0); \
-	PL(TBL, 2*8,buf2, 0); \
-	PL(TBL, 3*8,buf2, 0); \
-	PL(TBL, 4*8,buf2, 0); \
-	PL(TBL, 5*8,buf2, 0); \
-	PL(TBL, 6*8,buf2, 0); \
-	PL(TBL, 7*8,buf2, do_global_latch ? global_latch_pattern : data_latch_pattern); \
-	} while(0)
+		offset row0 group + 0  +   : 0,  1*8,  2*8,  3*8,  4*8,  5*8,  6*8,  7*8(LATCH),
+		offset row1 group + 0  +   : 0,  1*8,  2*8,  3*8,  4*8,  5*8,  6*8,  7*8(LATCH),
+
+		The last word of the last group has global latch instead of
+		data latch.
+	*/
+
+	typedef frame_buffer_t::format_t format_t;
+	const led_gamma_lut_t *lut = led_gamma_lut;
+	const frame_buffer_t::unit_t *buf = fb.array()[row*2];
+	const frame_buffer_t::unit_t *buf2 = fb.array()[row*2+1];
+
+#define ENC(TBL) do { \
+	for(int g = 0; g < led_scanout_groups; ++g) \
+	{ \
+		uint32_t *w = led_scanout[row][g]; \
+		for(int i = 0; i < 8; ++i) w[i    ] = TBL(format_t::get(buf , i*8 + g)); \
+		for(int i = 0; i < 8; ++i) w[i + 8] = TBL(format_t::get(buf2, i*8 + g)); \
+		w[7]  += data_latch_pattern; \
+		w[15] += (g == led_scanout_groups - 1) ? \
+			global_latch_pattern : data_latch_pattern; \
+	} } while(0)
 
 	if(led_pwm_clock_running)
-		REG(led_tbl_gamma);
+		ENC(lut->encode);
 	else
-		REG(led_tbl_bw);
+		ENC(led_tbl_bw);
 
+#undef ENC
+}
 
-	// begin SPI transaction
-	SPI1CMD |= SPIBUSY;
+/**
+ * Scan engine telemetry.
+ * Written only by the timer interrupt handler, which brackets every update
+ * with increments of led_telemetry_seq; the sequence number is odd
+ * while the block is being updated. Readers retry until they see the same
+ * even sequence number before and after copying the block.
+ */
+static led_telemetry_t led_telemetry;
+static volatile uint32_t led_telemetry_seq = 0;
+
+static bool led_scanning = false; //!< whether the scan interrupt is running
+static uint64_t led_encode_request = 0; //!< logical rows requested to be re-encoded from the next pass
+static volatile uint64_t led_encode_pass_rows = 0; //!< logical rows still to be re-encoded in the current pass
+static volatile int led_encode_safe_rows = 0; //!< number of scan rows the beam has passed in this frame
+static uint32_t led_encode_pass_frame = 0; //!< frame_count at the start of the current pass
+
+/**
+ * Returns whether the scan interrupt is running
+ */
+bool led_is_scanning()
+{
+	return led_scanning;
 }
 
 /**
- Returns configuration pattern from register number. this return value can be used
- in led_set_led1642_reg().
+ * Encode current frame buffer into the scanout buffer.
+ * This must be called every time the current frame buffer
+ * content has changed.
+ * While the scan interrupt is running, the rows are only marked
+ * and encoded by led_encode_behind_beam() from the next pass.
+ * @param	changed_rows	bitmap of logical rows to be re-encoded;
+ * 		bit N for row N. Scan rows whose two logical rows are
+ *		both unchanged are skipped.
  */
-static constexpr uint32_t ICACHE_RAM_ATTR config_reg_pattern_from_num(int n)
+void led_update_scanout(uint64_t changed_rows)
 {
-	// n = 1 ->  0b0010
-	// n = 2 ->  0b1010 ...
-	// n = 3 ->  0b101010 ...
-	return byte_reverse(((1U << n*2) - 1) & 0xaaaaaaaau);
+	if(led_scanning)
+	{
+		noInterrupts();
+		led_encode_request |= changed_rows;
+		interrupts();
+		return;
+	}
+
+	const frame_buffer_t & fb = get_current_frame_buffer();
+	for(int row = 0; row < LED_MAX_ROW; ++row)
+	{
+		if(changed_rows & ((uint64_t)3 << (row*2)))
+			led_encode_row(fb, row);
+	}
 }
 
+/**
+ * Start an encoding pass; called by the scan interrupt at vsync, that is
+ * phase 0 of row 0. Only pointers are switched here: the requested flip
+ * and gamma LUT change are done, and the rows to encode are marked for
+ * led_encode_behind_beam(). No flip is done until the previous pass is
+ * complete, so that the rows of a pass are all encoded from the same
+ * frame buffer. Thus every frame shows the content of exactly one flip,
+ * as long as the main loop keeps up.
+ */
+static void ICACHE_RAM_ATTR led_start_encode_pass()
+{
+	if(led_encode_pass_rows) return; // previous pass not complete yet
+
+	uint64_t rows = led_encode_request | frame_buffer_vsync();
+	led_encode_request = 0;
+	if(led_gamma_lut_next)
+	{
+		led_gamma_lut = led_gamma_lut_next;
+		led_gamma_lut_next = nullptr;
+		rows = ~(uint64_t)0;
+	}
+	led_encode_pass_frame = led_telemetry.frame_count;
+	led_encode_pass_rows = rows & (((uint64_t)1 << LED_MAX_LOGICAL_ROW) - 1);
+}
+
+/**
+ * Encode rows of the current pass which the beam has passed in this frame.
+ * The scanout of such a row is not needed until the next frame, so it
+ * can be rewritten while the scan interrupt is running. Call this from
+ * the main loop as often as possible; a pass must be complete within
+ * a frame (about 11ms to 15ms, depending on the interval mode), otherwise
+ * the rows left are shown old for a frame, which is counted in
+ * led_telemetry_t::late_rows.
+ */
+void led_encode_behind_beam()
+{
+	if(!led_scanning) return;
+
+	for(;;)
+	{
+		uint64_t rows = led_encode_pass_rows;
+		if(!rows) return;
+		int row = __builtin_ctzll(rows) / 2;
+		if(row >= led_encode_safe_rows) return; // the beam has not passed it yet
+
+		led_encode_row(get_current_frame_buffer(), row);
+
+		noInterrupts();
+		led_encode_pass_rows &= ~((uint64_t)3 << (row*2));
+		interrupts();
+	}
+}
+
+
+/**
+ * Set gamma curve.
+ * The LUT is regenerated and the whole scanout is re-encoded
+ * if the parameters differ from current ones.
+ */
+void led_set_gamma(const led_gamma_params_t & params)
+{
+	if(led_gamma_valid &&
+		params.exponent_100 == led_gamma_params.exponent_100 &&
+		params.black_offset == led_gamma_params.black_offset &&
+		params.ceiling == led_gamma_params.ceiling) return; // no change
+
+	// cancel pending switch; after this, led_gamma_lut is not changed
+	// by the scan interrupt
+	led_gamma_lut_next = nullptr;
+
+	// generate into the LUT not in use, then switch
+	led_gamma_lut_t * next =
+		led_gamma_lut == led_gamma_luts + 0 ? led_gamma_luts + 1 : led_gamma_luts + 0;
+	next->generate(params);
+	led_gamma_params = params;
+	led_gamma_valid = true;
+
+	if(led_scanning)
+	{
+		led_gamma_lut_next = next; // switched at vsync
+	}
+	else
+	{
+		led_gamma_lut = next;
+		led_update_scanout();
+	}
+}
+
+
+/**
+ * set one line brightness
+ */
+static void ICACHE_RAM_ATTR led_set_brightness_one_row(int group)
+{
+	const uint32_t *src = led_scanout[current_row][group];
+
+	volatile uint32_t * fifoPtr = led_spi_fifo();
+
+	led_spi_wait(); // wait for previous SPI transaction
+	led_spi_set_length(32*led_scanout_words);
+
+	// fill fifo with pre-encoded words
+	for(int i = 0; i < led_scanout_words; ++i)
+		*(fifoPtr++) = *(src++);
+
+	// begin SPI transaction
+	led_spi_start();
+}
 
 /**
 	Set LED1642 configuration register.
@@ -665,13 +912,13 @@ static constexpr uint32_t ICACHE_RAM_ATTR config_reg_pattern_from_num(int n)
  */
 static void ICACHE_RAM_ATTR led_set_led1642_reg(uint32_t latch_pattern, uint32_t register_pattern)
 {
-	while(SPI1CMD & SPIBUSY) /**/ ; // wait for previous SPI transaction
+	led_spi_wait(); // wait for previous SPI transaction
 
 
 	SPI1U |= SPIUFWDUAL;
 	SPI1C |= SPICFASTRD | SPICDOUT; // use DIO
 
-	volatile uint32_t * fifoPtr = &SPI1W0;
+	volatile uint32_t * fifoPtr = led_spi_fifo();
 
 	led_spi_set_length(32*(LED_MAX_COL / 16));
 
@@ -688,7 +935,7 @@ static void ICACHE_RAM_ATTR led_set_led1642_reg(uint32_t latch_pattern, uint32_t
 	}
 
 	// begin SPI transaction
-	SPI1CMD |= SPIBUSY;
+	led_spi_start();
 }
 
 /**
@@ -746,19 +993,19 @@ static void led_init_led1642()
 			config_reg_pattern_from_num(7), 
 			led1642_configration_reg
 			); // write to config reg
-		while(SPI1CMD & SPIBUSY) /**/ ; // wait for previous SPI transaction
+		led_spi_wait(); // wait for previous SPI transaction
 	}
 	led_set_led1642_reg(
 		config_reg_pattern_from_num(1),
 		byte_reverse(bit_interleave(0xffff)) // all led on
 		); // write to switch reg
-	while(SPI1CMD & SPIBUSY) /**/ ; // wait for previous SPI transaction
+	led_spi_wait(); // wait for previous SPI transaction
 }
 
 
 static void ICACHE_RAM_ATTR led_sel_led1642_all_blank()
 {
-	while(SPI1CMD & SPIBUSY) /**/ ; // wait for previous SPI transaction
+	led_spi_wait(); // wait for previous SPI transaction
 	led_set_led1642_reg(
 		config_reg_pattern_from_num(1),
 		byte_reverse(bit_interleave(0x0000)) // all led off
@@ -767,7 +1014,7 @@ static void ICACHE_RAM_ATTR led_sel_led1642_all_blank()
 
 static void ICACHE_RAM_ATTR led_sel_led1642_all_show()
 {
-	while(SPI1CMD & SPIBUSY) /**/ ; // wait for previous SPI transaction
+	led_spi_wait(); // wait for previous SPI transaction
 	led_set_led1642_reg(
 		config_reg_pattern_from_num(1),
 		byte_reverse(bit_interleave(0xffff)) // all led on
@@ -775,6 +1022,27 @@ static void ICACHE_RAM_ATTR led_sel_led1642_all_show()
 }
 
 
+/**
+ * Frames per second, 100 multiplied; updated by main context
+ */
+static uint32_t led_fps_100 = 0;
+
+static inline void ICACHE_RAM_ATTR led_telemetry_barrier() { __asm__ __volatile__("" ::: "memory"); }
+
+/**
+ * Record interrupt lateness of the phase into the histogram
+ */
+static void ICACHE_RAM_ATTR led_telemetry_record_lateness(int phase, int32_t lateness)
+{
+	int bin = 0;
+	if(lateness >= 64)
+	{
+		bin = 32 - __builtin_clz((uint32_t)lateness) - 6;
+		if(bin >= LED_TELEMETRY_NUM_BINS) bin = LED_TELEMETRY_NUM_BINS - 1;
+	}
+	++ led_telemetry.lateness_hist[phase][bin];
+}
+
 /**
 	Set LED1642 brightness timer handler
 
@@ -792,6 +1060,9 @@ static void ICACHE_RAM_ATTR led_set_brightness()
 				led1642_configration_reg);
 			led1642_configration_reg_changed = false;
 		}
+		// the current row is shown; the encoder may rewrite it
+		led_encode_safe_rows = current_row + 1;
+		if(current_row == 0) led_start_encode_pass();
 		break;
 
 	case 1:
@@ -799,7 +1070,15 @@ static void ICACHE_RAM_ATTR led_set_brightness()
 		button_read_gpio();
 		// step to next row
 		++ current_row;
-		if(current_row >= LED_MAX_ROW) current_row = 0;
+		if(current_row >= LED_MAX_ROW)
+		{
+			current_row = 0;
+			++ led_telemetry.frame_count;
+		}
+		led_encode_safe_rows = current_row;
+		if(led_telemetry.frame_count != led_encode_pass_frame &&
+			(led_encode_pass_rows & ((uint64_t)3 << (current_row*2))))
+			++ led_telemetry.late_rows; // the encoder did not keep up; shown old
 
 		led_set_brightness_one_row(0);
 		break;
@@ -838,7 +1117,7 @@ static void ICACHE_RAM_ATTR led_set_brightness()
 
 	case 10:
 		led_sel_row_blank();
-		led_set_brightness_one_row(7, true);
+		led_set_brightness_one_row(7);
 		break;
 
 	case 11:
@@ -887,6 +1166,37 @@ static constexpr uint32_t interrupt_delay = 200;
 static int last_overrun_phase = 0;
 
 
+/**
+ * Get a consistent snapshot of the scan engine telemetry
+ */
+void led_get_telemetry(led_telemetry_t & t)
+{
+	uint32_t seq;
+	do
+	{
+		seq = led_telemetry_seq;
+		led_telemetry_barrier();
+		t = led_telemetry;
+		led_telemetry_barrier();
+	} while((seq & 1) || seq != led_telemetry_seq);
+	t.fps_100 = led_fps_100;
+}
+
+/**
+ * Record the cost of the phase, during calibration.
+ * The cost includes the SPI transaction the phase started; its end is
+ * computed rather than waited for, so that calibration does not change
+ * the timing it measures.
+ */
+static void ICACHE_RAM_ATTR led_phase_calib_sample(int phase, uint32_t scheduled_tick)
+{
+	uint32_t end = ESP.getCycleCount();
+	if(led_spi_busy()) end = led_spi_end_tick();
+	uint32_t cost = end - scheduled_tick;
+	if(cost > led_phase_cost_max[phase]) led_phase_cost_max[phase] = cost;
+	if(phase == max_phase - 1) -- led_phase_calib_rows;
+}
+
 /**
  * Timer interrupt handler
  */
@@ -898,6 +1208,16 @@ static void ICACHE_RAM_ATTR timer_handler()
 
 	++interrupt_count;
 	uint32_t current_tick = ESP.getCycleCount();
+	uint32_t entry_tick = current_tick;
+	int handled_phase = -1; // phase handled by this interrupt; -1 if skipped
+
+	++ led_telemetry_seq; // begin telemetry update
+	led_telemetry_barrier();
+	++ led_telemetry.interrupt_count;
+	{
+		int32_t lateness = (int32_t)(current_tick - next_tick);
+		led_telemetry_record_lateness(current_phase, lateness < 0 ? 0 : lateness);
+	}
 
 	/*
 		           nt        nt+iad
@@ -909,7 +1229,7 @@ static void ICACHE_RAM_ATTR timer_handler()
 		                           ^ct not arrowable
 	*/
 
-	if((SPI1CMD & SPIBUSY) ||
+	if(led_spi_busy() ||
 		(int32_t)(next_tick + interrupt_arrowable_delay - current_tick) < 0)
 	{
 		// SPI transaction in progress or
@@ -917,6 +1237,10 @@ static void ICACHE_RAM_ATTR timer_handler()
 		// round up to next cycle
 		++ interrupt_overrun_count;
 		last_overrun_phase = current_phase;
+		if(led_spi_busy())
+			++ led_telemetry.busy_on_entry[current_phase];
+		else
+			++ led_telemetry.late_on_entry[current_phase];
 		uint32_t tick_add = timer_interval_values[current_interval_index].timer_interval;
 #if F_CPU == 160000000
 		tick_add *= 2;
@@ -930,8 +1254,10 @@ static void ICACHE_RAM_ATTR timer_handler()
 	else
 	{
 		int phase = current_phase;
+		handled_phase = phase;
+		uint32_t scheduled_tick = next_tick;
 		uint32_t phase_duration =
-			timer_interval_values[current_interval_index].timer_duration_phase[phase];
+			led_phase_schedule[current_interval_index][phase];
 
 #if F_CPU == 160000000
 		phase_duration *= 2;
@@ -940,6 +1266,8 @@ static void ICACHE_RAM_ATTR timer_handler()
 
 		// call LED SPI function
 		led_set_brightness();
+		if(led_phase_calib_rows > 0 && led_phase_calib_index == current_interval_index)
+			led_phase_calib_sample(phase, scheduled_tick);
 
 		// check next tick;
 		current_tick = ESP.getCycleCount();
@@ -957,10 +1285,186 @@ static void ICACHE_RAM_ATTR timer_handler()
 		timer0_write(next_tick);
 	}
 
+	uint32_t isr_cycles = ESP.getCycleCount() - entry_tick;
+	if(isr_cycles > led_telemetry.max_isr_cycles) led_telemetry.max_isr_cycles = isr_cycles;
+	if(handled_phase >= 0 && isr_cycles > led_telemetry.max_phase_cycles[handled_phase])
+		led_telemetry.max_phase_cycles[handled_phase] = isr_cycles;
+	led_telemetry_barrier();
+	++ led_telemetry_seq; // end telemetry update
 
 	in_handler = false;
 }
 
+/**
+ * Returns settings key of the phase schedule for the interval index
+ */
+static String led_phase_schedule_key(int index)
+{
+	return String(F("led_phase_schedule_")) + String(index);
+}
+
+/**
+ * Load phase schedule from the settings, or from the default table
+ * if the settings are missing or invalid
+ */
+static void led_load_phase_schedule()
+{
+	for(int index = 0; index < LED_NUM_INTERVAL_MODE; ++index)
+	{
+		for(int p = 0; p < max_phase; ++p)
+			led_phase_schedule[index][p] = timer_interval_values[index].timer_duration_phase[p];
+
+		string_vector vec;
+		if(!settings_read_vector(led_phase_schedule_key(index), vec)) continue;
+		if(vec.size() != max_phase) continue;
+		int32_t schedule[max_phase];
+		int32_t sum = 0;
+		bool valid = true;
+		for(int p = 0; p < max_phase; ++p)
+		{
+			schedule[p] = vec[p].toInt();
+			if(schedule[p] <= 0) valid = false;
+			sum += schedule[p];
+		}
+		if(!valid || sum != timer_interval_values[index].timer_interval) continue;
+
+		for(int p = 0; p < max_phase; ++p)
+			led_phase_schedule[index][p] = schedule[p];
+	}
+}
+
+/**
+ * Compute phase schedule from the measured cost.
+ * Each phase is given its worst-case cost plus interrupt_delay, and
+ * the remaining time is distributed in proportion to it, so that the
+ * total interval is kept and every phase has the same relative margin.
+ * Returns false if the cost does not fit in the interval.
+ */
+static bool led_compute_phase_schedule(int index, int32_t * schedule)
+{
+	int32_t total = timer_interval_values[index].timer_interval;
+	int32_t need[max_phase];
+	int32_t need_sum = 0;
+	for(int p = 0; p < max_phase; ++p)
+	{
+		uint32_t cost = led_phase_cost_max[p];
+#if F_CPU == 160000000
+		cost /= 2; // schedule is in 80MHz cycle
+#endif
+		need[p] = cost + interrupt_delay;
+		need_sum += need[p];
+	}
+	if(need_sum > total) return false;
+
+	int32_t slack = total - need_sum;
+	int32_t assigned = 0;
+	for(int p = 0; p < max_phase; ++p)
+	{
+		schedule[p] = need[p] + (int32_t)((int64_t)slack * need[p] / need_sum);
+		assigned += schedule[p];
+	}
+	schedule[max_phase - 1] += total - assigned; // rounding residue
+	return true;
+}
+
+/**
+ * Start phase schedule calibration on current interval mode.
+ * The result is applied and written to the settings by
+ * led_check_phase_calibration() after led_phase_calib_num_rows rows,
+ * which take 6.6 to 8.8 seconds depending on the interval mode.
+ * Calibration should be run in normal mode, so that the interrupt
+ * latency under WiFi and I2S load is measured.
+ */
+void led_start_phase_calibration()
+{
+	if(led_phase_calib_rows > 0) return; // already in progress
+	for(int p = 0; p < max_phase; ++p) led_phase_cost_max[p] = 0;
+	led_phase_calib_index = current_interval_index;
+	led_phase_calib_rows = led_phase_calib_num_rows;
+	Serial.printf_P(PSTR("Phase schedule calibration started for interval %d\r\n"),
+		led_phase_calib_index);
+}
+
+/**
+ * Reset phase schedule of all interval modes to the default
+ */
+void led_reset_phase_schedule()
+{
+	noInterrupts();
+	for(int index = 0; index < LED_NUM_INTERVAL_MODE; ++index)
+		for(int p = 0; p < max_phase; ++p)
+			led_phase_schedule[index][p] = timer_interval_values[index].timer_duration_phase[p];
+	interrupts();
+	for(int index = 0; index < LED_NUM_INTERVAL_MODE; ++index)
+		settings_write_vector(led_phase_schedule_key(index), string_vector());
+}
+
+/**
+ * Update frames per second, once a second
+ */
+static void led_update_fps()
+{
+	static uint32_t last_millis = millis();
+	static uint32_t last_frame_count = 0;
+	uint32_t now = millis();
+	uint32_t elapsed = now - last_millis;
+	if(elapsed < 1000) return;
+
+	led_telemetry_t t;
+	led_get_telemetry(t);
+	led_fps_100 = (t.frame_count - last_frame_count) * 100000 / elapsed;
+	last_frame_count = t.frame_count;
+	last_millis = now;
+}
+
+/**
+ * Finish phase schedule calibration if measurement is done
+ */
+static void led_check_phase_calibration()
+{
+	static bool calibrating = false;
+	if(led_phase_calib_rows > 0)
+	{
+		calibrating = true;
+		if(led_phase_calib_index != current_interval_index)
+		{
+			// interval mode changed during calibration
+			led_phase_calib_rows = 0;
+			calibrating = false;
+			Serial.printf_P(PSTR("Phase schedule calibration aborted\r\n"));
+		}
+		return;
+	}
+	if(!calibrating) return;
+	calibrating = false;
+
+	int index = led_phase_calib_index;
+	Serial.printf_P(PSTR("Phase cost:"));
+	for(int p = 0; p < max_phase; ++p) Serial.printf_P(PSTR(" %u"), led_phase_cost_max[p]);
+	Serial.printf_P(PSTR("\r\n"));
+
+	int32_t schedule[max_phase];
+	if(!led_compute_phase_schedule(index, schedule))
+	{
+		Serial.printf_P(PSTR("Phase cost exceeds the interval; schedule unchanged\r\n"));
+		return;
+	}
+
+	noInterrupts();
+	for(int p = 0; p < max_phase; ++p) led_phase_schedule[index][p] = schedule[p];
+	interrupts();
+
+	string_vector vec;
+	Serial.printf_P(PSTR("Phase schedule:"));
+	for(int p = 0; p < max_phase; ++p)
+	{
+		vec.push_back(String((long)schedule[p]));
+		Serial.printf_P(PSTR(" %d"), schedule[p]);
+	}
+	Serial.printf_P(PSTR("\r\n"));
+	settings_write_vector(led_phase_schedule_key(index), vec);
+}
+
 /**
  * Initialize timer
  */
@@ -971,6 +1475,7 @@ static void led_init_timer()
 	timer0_write(next_tick);
 	timer0_attachInterrupt(timer_handler);
 	timer0_write(next_tick);
+	led_scanning = true;
 }
 
 
@@ -982,9 +1487,7 @@ static led_interval_mode_t current_interval_mode = LIM_AUTO;
  */
 void led_pre_init()
 {
-	for(int i = 0; i < 48; i++)
-		for(int j = 0; j < 64; j++)
-		get_current_frame_buffer().array()[i][j] = 0;
+	get_current_frame_buffer().fill(0);
 
 	led_init_gpio();
 	led_post();
@@ -997,7 +1500,8 @@ void led_init()
 {
 	led_init_spi_and_ledclock();
 	led_init_led1642();
-	led_init_timer();
+	led_set_gamma(led_default_gamma_params); // this also encodes the scanout
+	led_load_phase_schedule();
 	led_start_pwm_clock();
 
 	// restore led interval mode
@@ -1006,6 +1510,10 @@ void led_init()
 	res = settings_read(F("led_interval_mode"), strval);
 	led_set_interval_mode( (led_interval_mode_t) strval.toInt());
 
+	// start scanning after the scanout is encoded for the mode above;
+	// there is no main loop yet to encode it behind the beam
+	led_init_timer();
+
 	// wait for a while to let the row driver scanning button
 	delay(500);
 
@@ -1235,6 +1743,9 @@ if(current_row == 0)
 }
 */
 
+	led_check_phase_calibration();
+	led_update_fps();
+
 	// check timer0 call is near the future
 	uint32_t tick = ESP.getCycleCount();
 	if(int32_t(next_tick - tick) < 0 ||
@@ -1271,6 +1782,14 @@ if(current_row == 0)
 			next =millis() + 1000;
 			int n = analogRead(0);
 			Serial.printf("ambient=%d phy_mode=%d\r\n", n, WiFi.getPhyMode());
+			const frame_buffer_stat_t & fbs = frame_buffer_get_stat();
+			Serial.printf("flips=%u changed_rows=%u last_changed_rows=%d damaged_pixels=%u last_damaged_pixels=%d\r\n",
+				fbs.flip_count, fbs.changed_rows, fbs.last_changed_rows,
+				fbs.damaged_pixels, fbs.last_damaged_pixels);
+			led_telemetry_t t;
+			led_get_telemetry(t);
+			Serial.printf("fps=%u.%02u max_isr=%u\r\n",
+				t.fps_100 / 100, t.fps_100 % 100, t.max_isr_cycles);
 		}
 	}
 
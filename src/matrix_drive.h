@@ -14,11 +14,48 @@ void led_pre_init();
 void led_init();
 void led_write_settings();
 void led_set_contrast(int val);
+//! gamma curve parameters
+struct led_gamma_params_t
+{
+	int exponent_100; //!< gamma exponent, 100 multiplied (eg. 350 = 3.5)
+	int black_offset; //!< black level offset, in unit of 8bit input level
+	int ceiling; //!< PWM value at the maximum input level (0 .. 4095)
+};
+//! valid ranges of led_gamma_params_t members
+#define LED_GAMMA_EXPONENT_MIN 10
+#define LED_GAMMA_EXPONENT_MAX 1000
+#define LED_GAMMA_BLACK_OFFSET_MAX 255
+#define LED_GAMMA_CEILING_MAX 4095
+void led_set_gamma(const led_gamma_params_t & params);
+void led_update_scanout(uint64_t changed_rows = ~(uint64_t)0);
+void led_encode_behind_beam();
+bool led_is_scanning();
 extern uint32_t button_read;
 void led_start_pwm_clock();
 void led_stop_pwm_clock();
 void led_set_interval_mode(led_interval_mode_t mode);
 led_interval_mode_t led_get_interval_mode();
 void led_set_interval_mode_from_channel(uint8_t ch);
+void led_start_phase_calibration();
+void led_reset_phase_schedule();
+
+#define LED_NUM_PHASES 12
+#define LED_TELEMETRY_NUM_BINS 10
+//! scan engine telemetry; counters are cumulative since boot
+struct led_telemetry_t
+{
+	uint32_t interrupt_count; //!< number of timer interrupts
+	uint32_t frame_count; //!< number of whole frame scans
+	uint32_t max_isr_cycles; //!< maximum timer interrupt duration, in CPU cycle
+	uint32_t max_phase_cycles[LED_NUM_PHASES]; //!< maximum timer interrupt duration by phase, in CPU cycle; skipped interrupts excluded
+	//! histogram of interrupt lateness (current_tick - next_tick) in CPU cycle, by phase;
+	//! bin 0 counts below 64, bin N below 64<<N, and the last bin counts the rest.
+	uint32_t lateness_hist[LED_NUM_PHASES][LED_TELEMETRY_NUM_BINS];
+	uint32_t busy_on_entry[LED_NUM_PHASES]; //!< number of interrupts entered while SPI is busy, by phase
+	uint32_t late_on_entry[LED_NUM_PHASES]; //!< number of interrupts entered too late, by phase
+	uint32_t late_rows; //!< number of rows shown before led_encode_behind_beam() re-encoded them
+	uint32_t fps_100; //!< frames per second measured over the last second, 100 multiplied
+};
+void led_get_telemetry(led_telemetry_t & t);
 #endif
 
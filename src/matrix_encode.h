@@ -0,0 +1,188 @@
+#ifndef MATRIX_ENCODE_H
+#define MATRIX_ENCODE_H
+
+/*
+	Bit-level encoding of the LED1642/HC595 serial chain.
+
+	Everything in this file is a pure function of its arguments and does
+	not touch any hardware register, so this header can also be included
+	from a native (non-ESP8266) build to reproduce or decode the bit stream
+	which matrix_drive.cpp pushes into the SPI FIFO.
+*/
+
+#include <stdint.h>
+#include <math.h>
+
+#ifndef ICACHE_RAM_ATTR
+#define ICACHE_RAM_ATTR
+#endif
+
+#define LED_MAX_ROW 24
+#define LED_MAX_COL 128
+
+
+static constexpr uint32_t bit_interleave8(uint32_t v)
+{
+	// 0b0000000000000000ABCDEFGHIJKLMNOP ->
+	// 0b00000000ABCDEFGH00000000IJKLMNOP
+	return (v  | v << 8) &
+	   0b00000000111111110000000011111111u;
+}
+
+static constexpr uint32_t bit_interleave4(uint32_t v)
+{
+	// 0b00000000ABCDEFGH00000000IJKLMNOP ->
+	// 0b0000ABCD0000EFGH0000IJKL0000MNOP
+	return (v  | v << 4) &
+	   0b00001111000011110000111100001111u;
+}
+
+static constexpr uint32_t bit_interleave2(uint32_t v)
+{
+	// 0b0000ABCD0000EFGH0000IJKL0000MNOP ->
+	// 0b00AB00CD00EF00GH00IJ00KL00MN00OP
+	return (v  | v << 2) &
+	   0b00110011001100110011001100110011u;
+}
+
+static constexpr uint32_t bit_interleave1(uint32_t v)
+{
+	// 0b00AB00CD00EF00GH00IJ00KL00MN00OP
+	// 0b0A0B0C0D0E0F0G0H0I0J0K0L0M0N0O0P
+	return (v  | v << 1) &
+	   0b01010101010101010101010101010101u;
+}
+
+
+/**
+ * bit interleave function
+ */
+static constexpr uint32_t bit_interleave(uint16_t v)
+{
+	// Every bit in v goes to even bit of the result.
+	// This is optimization for SPI DIO, which send every even bit
+	// to the MOSI line, and every odd bit to the MISO line.
+	return
+		bit_interleave1(
+		bit_interleave2(
+		bit_interleave4(
+		bit_interleave8(v))));
+}
+
+/**
+ * 8bit swap function
+ */
+ static constexpr uint32_t ICACHE_RAM_ATTR bit_8_swap(uint32_t v) {
+ 	return ((v >> 8) & 0x00ff00ff) | ((v & 0x00ff00ff) << 8); }
+/**
+ * 16bit swap function
+ */
+static constexpr uint32_t ICACHE_RAM_ATTR bit_16_swap(uint32_t v) {
+	return ((v >> 16) & 0x0000ffff) | ((v & 0x0000ffff) <<16); }
+
+/**
+ * byte reverse function
+ */
+static constexpr uint32_t ICACHE_RAM_ATTR byte_reverse(uint32_t v)
+{
+	return bit_16_swap(bit_8_swap(v));
+}
+
+#define GAMMA_L4(N) gamma_log2_entry((N)), gamma_log2_entry((N)+1), \
+	gamma_log2_entry((N)+2), gamma_log2_entry((N)+3),
+#define GAMMA_L16(N) GAMMA_L4(N) GAMMA_L4((N)+4) GAMMA_L4((N)+8) GAMMA_L4((N)+12)
+#define GAMMA_E4(N) gamma_exp2_entry((N)), gamma_exp2_entry((N)+1), \
+	gamma_exp2_entry((N)+2), gamma_exp2_entry((N)+3),
+#define GAMMA_E16(N) GAMMA_E4(N) GAMMA_E4((N)+4) GAMMA_E4((N)+8) GAMMA_E4((N)+12)
+
+//! log2(1 + k/64) in 16.16 fixed point
+static constexpr int32_t gamma_log2_entry(int k) { return (int32_t)(log2(1.0 + k / 64.0) * 65536 + 0.5); }
+//! 2^(-k/64) in 16.16 fixed point
+static constexpr int32_t gamma_exp2_entry(int k) { return (int32_t)(pow(2.0, -k / 64.0) * 65536 + 0.5); }
+
+static constexpr int32_t gamma_log2_table[65] = {
+	GAMMA_L16(0) GAMMA_L16(16) GAMMA_L16(32) GAMMA_L16(48) gamma_log2_entry(64) };
+static constexpr int32_t gamma_exp2_table[65] = {
+	GAMMA_E16(0) GAMMA_E16(16) GAMMA_E16(32) GAMMA_E16(48) gamma_exp2_entry(64) };
+
+/**
+ * Gamma curve function.
+ * Returns ceiling * ((in + offset) / (in_max + offset)) ^ (exponent_100 / 100.0),
+ * truncated to integer. log2 and exp2 are computed in 16.16 fixed point with
+ * linear interpolation of 65-entry tables; no floating point math is
+ * involved at runtime. Error is at most 1 for ceiling up to 4095.
+ * Intermediate values are 64bit, so that large exponent or offset
+ * does not wrap around.
+ */
+static inline uint32_t gamma_curve(uint32_t in, uint32_t in_max, uint32_t offset,
+	uint32_t exponent_100, uint32_t ceiling)
+{
+	// base in 16.16 fixed point (0 .. 1.0)
+	uint32_t x = (uint32_t)(((uint64_t)(in + offset) << 16) / (in_max + offset));
+	if(x == 0) return 0;
+	if(x > 65536) x = 65536;
+
+	// log2(x); x = 2^(p-16) * (mant / 65536)
+	int p = 31 - __builtin_clz(x);
+	uint32_t mant = (x << (16 - p)) - 65536; // 0 .. 65535
+	int idx = mant >> 10, frac = mant & 1023;
+	int32_t l = gamma_log2_table[idx] +
+		(((gamma_log2_table[idx + 1] - gamma_log2_table[idx]) * frac) >> 10);
+	int32_t log2x = (p - 16) * 65536 + l; // <= 0
+
+	// 2^(log2x * exponent)
+	uint64_t t = (uint64_t)(-log2x) * exponent_100 / 100;
+	if(t >= (uint64_t)17 << 16) return 0;
+	uint32_t n = (uint32_t)(t >> 16);
+	uint32_t f = (uint32_t)(t & 0xffff);
+	idx = f >> 10, frac = f & 1023;
+	uint32_t v = gamma_exp2_table[idx] -
+		(((gamma_exp2_table[idx] - gamma_exp2_table[idx + 1]) * frac) >> 10);
+	v >>= n;
+
+	return (v * ceiling) >> 16;
+}
+
+/**
+ * Returns 16bit-swapped bit interleave of a byte.
+ * byte_reverse(bit_interleave(v)) for 16bit v equals
+ * (bit_interleave_swapped8(v & 0xff) << 16) | bit_interleave_swapped8(v >> 8).
+ */
+static constexpr uint16_t bit_interleave_swapped8(uint8_t b)
+{
+	return (uint16_t)(((bit_interleave(b) >> 8) & 0xff) | ((bit_interleave(b) & 0xff) << 8));
+}
+
+/**
+ Returns configuration pattern from register number. this return value can be used
+ in led_set_led1642_reg().
+ */
+static constexpr uint32_t ICACHE_RAM_ATTR config_reg_pattern_from_num(int n)
+{
+	// n = 1 ->  0b0010
+	// n = 2 ->  0b1010 ...
+	// n = 3 ->  0b101010 ...
+	return byte_reverse(((1U << n*2) - 1) & 0xaaaaaaaau);
+}
+
+/**
+ * Latch pattern which is merged into the last word sent to
+ * the LED1642 chain; global latch (register 5) for the
+ * last brightness word of a row, data latch (register 3)
+ * for others.
+ */
+static constexpr uint32_t global_latch_pattern =
+	byte_reverse(0b00000000000000000000001010101010);
+static constexpr uint32_t data_latch_pattern   =
+	byte_reverse(0b00000000000000000000000000101010);
+
+/**
+ * HC595 row selection pattern for row N (0 .. LED_MAX_ROW-1).
+ * bit 31 = row0, 30 = row1 ... and so on. Selected row is active low.
+ */
+static constexpr uint32_t row_sel_pattern(int n)
+{
+	return n < 0 ? ~0U : ~byte_reverse(1U << (31-(n)));
+}
+
+#endif
@@ -0,0 +1,104 @@
+#include <Arduino.h>
+#include "scroll_strip.h"
+#include "fonts/font.h"
+
+bool scroll_strip_t::render(const String & s, const font_base_t & font)
+{
+	clear();
+
+	frame_buffer_t * scratch = new frame_buffer_t();
+	if(!scratch) return false;
+
+	int w = scratch->get_text_width(s, font);
+	int h = font.get_height();
+	if(h > LED_MAX_LOGICAL_ROW) h = LED_MAX_LOGICAL_ROW;
+	if(w <= 0 || w > max_width || h <= 0 || !(bitmap = new uint8_t[((w + 1) >> 1) * h]()))
+	{
+		delete scratch;
+		return false;
+	}
+	width = w;
+	height = h;
+
+	// render the string through the scratch frame buffer, by tiles of
+	// the frame width
+	for(int tx = 0; tx < width; tx += LED_MAX_LOGICAL_COL)
+	{
+		scratch->fill(0, 0, LED_MAX_LOGICAL_COL, height, 0);
+		scratch->draw_text(-tx, 0, 255, s, font);
+		int tw = width - tx;
+		if(tw > LED_MAX_LOGICAL_COL) tw = LED_MAX_LOGICAL_COL;
+		for(int y = 0; y < height; ++y)
+		{
+			uint8_t *row = bitmap + y * stride();
+			for(int x = tx; x < tx + tw; ++x)
+				row[x >> 1] |= ((scratch->get_point(x - tx, y) + 8) / 17) << ((x & 1) << 2);
+		}
+	}
+
+	delete scratch;
+	return true;
+}
+
+void scroll_strip_t::clear()
+{
+	delete [] bitmap;
+	bitmap = nullptr;
+	width = height = 0;
+}
+
+void scroll_strip_t::expand(const uint8_t *row, int offset, int w, uint8_t *line) const
+{
+	int o = offset;
+	for(int i = 0; i < w; ++i)
+	{
+		line[i] = ((row[o >> 1] >> ((o & 1) << 2)) & 0x0f) * 17;
+		if(++o == width) o = 0;
+	}
+}
+
+void scroll_strip_t::draw_subpixel(frame_buffer_t & fb, int x, int y, int32_t offset_64, int w,
+	blit_mode_t mode) const
+{
+	uint32_t frac = offset_64 & 63;
+	if(frac == 0)
+	{
+		draw(fb, x, y, offset_64 >> 6, w, mode);
+		return;
+	}
+	if(!bitmap) return;
+
+	int fx = 0, fy = 0, h = height;
+	if(!fb.clip(fx, fy, x, y, w, h)) return;
+
+	int offset = ((offset_64 >> 6) + fx) % width;
+	if(offset < 0) offset += width;
+
+	// each pixel is made of the column at o and the next, weighted by frac
+	uint8_t line[LED_MAX_LOGICAL_COL + 1];
+	for(int yy = 0; yy < h; ++yy)
+	{
+		expand(bitmap + (fy + yy) * stride(), offset, w + 1, line);
+		for(int i = 0; i < w; ++i)
+			line[i] = (line[i] * (64 - frac) + line[i + 1] * frac + 32) >> 6;
+		fb.blend_row(x, y + yy, w, line, 255, mode);
+	}
+}
+
+void scroll_strip_t::draw(frame_buffer_t & fb, int x, int y, int offset, int w, blit_mode_t mode) const
+{
+	if(!bitmap) return;
+
+	int fx = 0, fy = 0, h = height;
+	if(!fb.clip(fx, fy, x, y, w, h)) return;
+
+	offset = (offset + fx) % width;
+	if(offset < 0) offset += width;
+
+	uint8_t line[LED_MAX_LOGICAL_COL];
+	for(int yy = 0; yy < h; ++yy)
+	{
+		expand(bitmap + (fy + yy) * stride(), offset, w, line);
+		fb.blend_row(x, y + yy, w, line, 255, mode);
+	}
+}
@@ -0,0 +1,62 @@
+#ifndef SCROLL_STRIP_H_
+#define SCROLL_STRIP_H_
+
+#include "frame_buffer.h"
+
+/**
+ * Scroll strip.
+ * A string is rendered once into an off-screen strip of the font height,
+ * then a window of it is blitted at any offset, wrapping around the end
+ * of the strip. The cost of drawing does not depend on the length of the
+ * string, and no glyph is read while scrolling.
+ * The strip is kept at 4bpp, the even pixel of each pair in the lower
+ * nibble, as the glyph cache of BFF fonts; glyphs are not finer than that
+ * anyway, and the strip of max_width takes 6KB at the height of 12px.
+ */
+class scroll_strip_t
+{
+	uint8_t *bitmap = nullptr; //!< intensity levels (0 .. 15); stride() bytes per row
+	int width = 0; //!< strip width in px
+	int height = 0; //!< strip height in px
+
+	//! Returns number of bytes of a row
+	int stride() const { return (width + 1) >> 1; }
+
+	//! Expand w pixels from offset of the row into alpha values (0 .. 255),
+	//! wrapping around the end of the strip
+	void expand(const uint8_t *row, int offset, int w, uint8_t *line) const;
+
+public:
+	//! maximum width of the strip in px; wider strings are not rendered
+	static constexpr int max_width = 1024;
+
+	~scroll_strip_t() { clear(); }
+
+	//! Render the string into the strip.
+	//! Returns false if the string is too wide or memory is not available;
+	//! the strip is left empty then. A frame buffer is allocated while
+	//! rendering, since fonts draw into frame buffers only.
+	bool render(const String & s, const font_base_t & font);
+
+	//! Release the strip
+	void clear();
+
+	//! Returns whether the strip holds a rendered string
+	bool get_available() const { return bitmap != nullptr; }
+
+	//! Returns width of the strip in px
+	int get_width() const { return width; }
+
+	//! Draw a window of w px wide, from offset of the strip, at (x, y) of fb.
+	//! The window wraps around the end of the strip. Pixels are blended
+	//! as the alpha of the full intensity by the mode.
+	void draw(frame_buffer_t & fb, int x, int y, int offset, int w, blit_mode_t mode = BM_OVER) const;
+
+	//! Same as draw(), but offset is in 1/64 px. The fractional part is
+	//! rendered by resampling each pixel linearly from the two columns of
+	//! the strip it spans, so that the window can move by sub-pixel steps.
+	void draw_subpixel(frame_buffer_t & fb, int x, int y, int32_t offset_64, int w,
+		blit_mode_t mode = BM_OVER) const;
+};
+
+#endif
@@ -27,6 +27,9 @@ static uint8_t target_contrast_value = max_contrast; //!< targetting contrast va
 static uint8_t current_contrast_value = 0; //!< current contrast value
 static int last_triggered_brightness_index = -100; //!< brightness index as of last contrast changing
 
+static led_gamma_params_t gamma_dark   = { 280, 20, 3800 }; //!< gamma curve at the darkest environment
+static led_gamma_params_t gamma_bright = { 350, 20, 3800 }; //!< gamma curve at the brightest environment
+
 static void sensors_bme280_get()
 {
 	if(!bme280.available()) return;
@@ -58,6 +61,18 @@ static void sensors_change_contrast()
 	}
 }
 
+//! select gamma curve for the brightness index,
+//! interpolating between the dark curve and the bright curve
+static void sensors_change_gamma(int index)
+{
+	constexpr int n = num_contrast_steps - 1;
+	led_gamma_params_t params;
+	params.exponent_100 = (gamma_dark.exponent_100 * (n - index) + gamma_bright.exponent_100 * index) / n;
+	params.black_offset = (gamma_dark.black_offset * (n - index) + gamma_bright.black_offset * index) / n;
+	params.ceiling      = (gamma_dark.ceiling      * (n - index) + gamma_bright.ceiling      * index) / n;
+	led_set_gamma(params);
+}
+
 static void sensors_get_env_brightness()
 {
 	if(brightness_get_delay)
@@ -86,6 +101,7 @@ static void sensors_get_env_brightness()
 		}
 
 		target_contrast_value = contrast; // set target contrast
+		sensors_change_gamma(index);
 	}
 }
 
@@ -138,6 +154,31 @@ void sensors_change_current_contrast(int dir)
 }
 
 
+//! read gamma parameters from settings, or write default if invalid
+static void sensors_read_gamma_settings(const __FlashStringHelper *key, led_gamma_params_t & params)
+{
+	string_vector vec;
+	settings_read_vector(key, vec);
+
+	// is vector valid?
+	if(vec.size() != 3 ||
+		vec[0].toInt() < LED_GAMMA_EXPONENT_MIN || vec[0].toInt() > LED_GAMMA_EXPONENT_MAX ||
+		vec[1].toInt() < 0 || vec[1].toInt() > LED_GAMMA_BLACK_OFFSET_MAX ||
+		vec[2].toInt() <= 0 || vec[2].toInt() > LED_GAMMA_CEILING_MAX)
+	{
+		vec.clear();
+		vec.push_back(String(params.exponent_100));
+		vec.push_back(String(params.black_offset));
+		vec.push_back(String(params.ceiling));
+		settings_write_vector(key, vec, SETTINGS_OVERWRITE);
+		return;
+	}
+
+	params.exponent_100 = vec[0].toInt();
+	params.black_offset = vec[1].toInt();
+	params.ceiling = vec[2].toInt();
+}
+
 void sensors_init()
 {
 	bme280.begin();
@@ -155,6 +196,10 @@ void sensors_init()
 
 	// convert string vector to integer vector
 	for(int i = 0; i < num_contrast_steps; ++i) contrasts[i] = vec[i].toInt();
+
+	// read gamma curve parameters; exponent*100, black offset, ceiling
+	sensors_read_gamma_settings(F("sensors_gamma_dark"), gamma_dark);
+	sensors_read_gamma_settings(F("sensors_gamma_bright"), gamma_bright);
 }
 
 void sensors_raise_flag() { sensors_get_flag = true; }
@@ -0,0 +1,38 @@
+#include <Arduino.h>
+#include "text_run.h"
+
+void text_run_t::set(const char * s, const font_base_t & _font)
+{
+	clear();
+	font = &_font;
+
+	const uint8_t *p = reinterpret_cast<const uint8_t *>(s);
+	uint32_t c = 0;
+	while(*p && utf8tow(p, &c))
+	{
+		item_t item;
+		font_base_t::metrics_t met = font->find_glyph(c, item.glyph);
+		if(!met.exist) continue;
+		item.advance_64 = met.advance_64;
+		items.push_back(item);
+		width_64 += met.advance_64;
+	}
+}
+
+void text_run_t::clear()
+{
+	font = nullptr;
+	items.clear();
+	width_64 = 0;
+}
+
+void text_run_t::draw(frame_buffer_t & fb, int x, int y, int level,
+	blit_mode_t mode, int first) const
+{
+	int32_t pen_64 = 0; // pen position from x in 1/64 px
+	for(size_t i = first < 0 ? 0 : first; i < items.size(); ++i)
+	{
+		font->put_glyph(items[i].glyph, level, x + font_base_t::round_64(pen_64), y, fb, mode);
+		pen_64 += items[i].advance_64;
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef TEXT_RUN_H_
+#define TEXT_RUN_H_
+
+#include <vector>
+#include "frame_buffer.h"
+#include "fonts/font.h"
+
+/**
+ * Text run; a string converted into glyphs of a font, ready to be drawn.
+ * UTF-8 decoding and glyph lookup are done only once when the string is
+ * set, so that drawing the same string repeatedly costs only the glyph
+ * drawing itself.
+ */
+class text_run_t
+{
+	struct item_t
+	{
+		font_base_t::glyph_handle_t glyph; //!< glyph handle
+		int16_t advance_64; //!< advance in 1/64 px
+	};
+
+	const font_base_t * font = nullptr; //!< font of the glyphs
+	std::vector<item_t> items; //!< glyphs
+	int32_t width_64 = 0; //!< total advance in 1/64 px
+
+public:
+	text_run_t() {}
+	text_run_t(const String & s, const font_base_t & font) { set(s, font); }
+	text_run_t(const char * s, const font_base_t & font) { set(s, font); }
+
+	//! Convert the string. Non-existent glyphs are omitted, and the
+	//! conversion stops at invalid UTF-8 sequence like draw_text() does.
+	void set(const char * s, const font_base_t & font);
+	void set(const String & s, const font_base_t & font) { set(s.c_str(), font); }
+
+	//! Clear the run
+	void clear();
+
+	//! Returns width in px, which get_text_width() returns for the string
+	int get_width() const { return font_base_t::round_64(width_64); }
+
+	//! Returns number of glyphs
+	int get_count() const { return items.size(); }
+
+	//! Draw glyphs from the index first at (x, y); glyphs are placed at
+	//! the pen positions rounded to px, as draw_text() does
+	void draw(frame_buffer_t & fb, int x, int y, int level,
+		blit_mode_t mode = BM_OVER, int first = 0) const;
+};
+
+#endif
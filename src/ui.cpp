@@ -7,6 +7,9 @@
 #include "ir_control.h"
 #include "buttons.h"
 #include "frame_buffer.h"
+#include "layer.h"
+#include "scroll_strip.h"
+#include "text_run.h"
 #include "matrix_drive.h"
 #include "wifi.h"
 #include "pendulum.h"
@@ -30,6 +33,8 @@ enum transition_t { t_none };
 class screen_base_t
 {
 	bool erase_bg = true; //!< whether to erase background automatically before draw()
+	bool damage_tracking = false; //!< whether the screen reports damaged region to be redrawn
+	bool frame_sync = false; //!< whether the screen is drawn at every vsync
 
 public:
 	//! The constructor
@@ -42,6 +47,22 @@ public:
 	void set_erase_bg(bool b) { erase_bg = b; }
 	bool get_erase_bg() const { return erase_bg; }
 
+	//! With damage tracking, the screen reports region to be redrawn by
+	//! invalidate() in update(). The manager then carries the rest over
+	//! from the last frame, and draw() is called for each rectangle of the
+	//! region, with the frame buffer cleared and clipped in the rectangle.
+	//! erase_bg is not used for such screens.
+	void set_damage_tracking(bool b) { damage_tracking = b; }
+	bool get_damage_tracking() const { return damage_tracking; }
+
+	//! With frame sync, update() and draw() are called from the main loop
+	//! once every vsync, as soon as the last frame is shown, instead of 50ms
+	//! intervally; for screens with motion which should follow the refresh
+	//! rate. Only for screens with damage tracking, and only while the LEDs
+	//! are scanned.
+	void set_frame_sync(bool b) { frame_sync = b; }
+	bool get_frame_sync() const { return frame_sync && damage_tracking; }
+
 protected:
 
 	static constexpr int num_w_chars = 10; //!< maximum chars in a horizontal line
@@ -49,14 +70,22 @@ protected:
 	//! Called when a button is pushed
 	virtual void on_button(uint32_t button) {;}
 
+	//! Called when the screen becomes the top of the stack, before draw().
+	//! The background frame buffer holds content of other screens at this point.
+	virtual void on_activate() {;}
+
 	//! Repeatedly called 10ms intervally when the screen is active
 	virtual void on_idle_10() {;}
 
 	//! Repeatedly called 50ms intervally when the screen is active
 	virtual void on_idle_50() {;}
 
+	//! Called before draw() for screens with damage tracking,
+	//! to update the state and report the region to be redrawn
+	virtual void update() {;}
+
 	//! Draw content; this function is automatically called 50ms
-	//! intervally to refresh the content. Do not call
+	//! intervally (or every vsync with frame sync) to refresh the content. Do not call
 	//! blocking function (like network, filesystem, serial)
 	//! should not be written in this handler.
 	virtual bool draw() {;}
@@ -67,6 +96,12 @@ protected:
 	//! Call this when the screen needs to be closed
 	void close();
 
+	//! Report the region to be redrawn, for screens with damage tracking
+	static void invalidate(int x, int y, int w, int h) { frame_buffer_get_damage().add(x, y, w, h); }
+
+	//! Report the whole screen to be redrawn
+	static void invalidate() { frame_buffer_get_damage().add_all(); }
+
 	//! Short cut to background frame buffer
 	static frame_buffer_t & fb() { return get_bg_frame_buffer(); }
 
@@ -97,6 +132,9 @@ class screen_manager_t
 	uint32_t next_draw_millis; //!< next expected processing mills
 	uint32_t next_idle_millis; //!< next idle processing mills
 	bool processing = false; //!< whether processing is ongoing or not
+	screen_base_t * last_drawn = nullptr; //!< screen drawn last time
+	uint32_t last_flip_seq = 0; //!< flip sequence number of the last frame shown
+	uint32_t last_vsync_count = 0; //!< vsync count as of the last frame of a screen with frame sync
 
 public:
 	screen_manager_t() :
@@ -115,7 +153,7 @@ public:
 		if(transition == t_none)
 		{
 			// immediate show
-			frame_buffer_flip();
+			last_flip_seq = frame_buffer_flip();
 		}
 	}
 
@@ -179,16 +217,86 @@ protected:
 				stack_changed = false;
 				screen_base_t *top = stack[sz -1];
 
+				bool activated = top != last_drawn;
+				if(activated)
+				{
+					last_drawn = top;
+					frame_buffer_get_damage().add_all();
+					top->on_activate();
+				}
+
 				// dispatch draw event
-				// erase background
-				if(top->get_erase_bg())
-					get_bg_frame_buffer().fill(0, 0, LED_MAX_LOGICAL_COL, LED_MAX_LOGICAL_ROW, 0);
-				if(top->draw()) show(t_none);
+				if(frame_synced(top))
+				{
+					// drawn by process_frame(), but at activation
+					if(activated) _process_partial_draw(top);
+				}
+				else if(top->get_damage_tracking())
+				{
+					_process_partial_draw(top);
+				}
+				else
+				{
+					// erase background
+					if(top->get_erase_bg())
+						get_bg_frame_buffer().fill(0, 0, LED_MAX_LOGICAL_COL, LED_MAX_LOGICAL_ROW, 0);
+					if(top->draw()) show(t_none);
+				}
 			}
 		}
 		blink_intensity += 21;
 	}
 
+	//! Redraw only the damage region of the screen
+	void _process_partial_draw(screen_base_t * top)
+	{
+		top->update();
+		frame_buffer_damage_t & damage = frame_buffer_get_damage();
+		if(damage.empty()) return; // nothing changed
+
+		frame_buffer_t & bg = get_bg_frame_buffer();
+		if(!damage.is_all()) frame_buffer_copy_forward();
+
+		bool drawn = false;
+		for(int i = 0; i < damage.get_count(); ++i)
+		{
+			const frame_buffer_damage_t::rect_t & r = damage.get(i);
+			bg.set_clip(r.x, r.y, r.w, r.h);
+			bg.fill(0);
+			if(top->draw()) drawn = true;
+		}
+		bg.reset_clip();
+		if(drawn) show(t_none);
+	}
+
+	//! Returns whether the screen is drawn by process_frame(); there is no
+	//! vsync to wait for while the LEDs are not scanned
+	static bool frame_synced(const screen_base_t * screen)
+	{
+		return screen->get_frame_sync() && led_is_scanning();
+	}
+
+	//! Draw the next frame of a screen with frame sync, once every vsync
+	//! and after the last frame is shown, so that no frame is dropped and
+	//! the main loop does not wait for a buffer
+	void process_frame()
+	{
+		if(processing) return; // prevent reentrance
+		size_t sz = stack.size();
+		if(!sz || in_transition) return;
+		screen_base_t *top = stack[sz -1];
+		if(!frame_synced(top) || top != last_drawn) return; // activated by process_draw()
+
+		uint32_t vsync_count = frame_buffer_get_vsync_count();
+		if(vsync_count == last_vsync_count) return; // not yet the next frame
+		if(frame_buffer_get_flip_seq() != last_flip_seq) return; // the last frame is not shown yet
+
+		processing = true;
+		last_vsync_count = vsync_count;
+		_process_partial_draw(top);
+		processing = false;
+	}
+
 	void process_idle()
 	{
 		if(processing) return; // prevent reentrance
@@ -296,13 +404,14 @@ class screen_message_box_t : public screen_base_t
 {
 	static constexpr int char_list_start_y = 7+6; // character list start position y in pixel
 
-	String title;
-	string_vector lines;
+	text_run_t title;
+	std::vector<text_run_t> lines;
 
 public:
 	screen_message_box_t(const String & _title, const string_vector & _lines) :
-		title(_title), lines(_lines)
+		title(_title, font_5x5)
 	{
+		for(auto && line : _lines) lines.emplace_back(line, font_5x5);
 	}
 
 	// TODO: scroll and text formatting
@@ -311,17 +420,14 @@ protected:
 	bool draw() override
 	{
 		// draw title
-		fb().draw_text(0, 0, 255, title.c_str(), font_5x5);
+		title.draw(fb(), 0, 0, 255);
 
 		// draw line
 		fb().fill(0, 7, LED_MAX_LOGICAL_COL, 1, 128);
 
 		// draw char_list
 		for(size_t i = 0; i < lines.size(); ++i)
-		{
-			fb().draw_text(0, i*6+char_list_start_y,
-					255, lines[i].c_str(), font_5x5);
-		}
+			lines[i].draw(fb(), 0, i*6+char_list_start_y, 255);
 
 		return true;
 	}
@@ -365,12 +471,14 @@ protected:
 		{
 		case BUTTON_OK:
 			// ok button; return
-			get_current_frame_buffer().fill(0x00);
+			fb().fill(0x00);
+			show();
 			return;
 
 		case BUTTON_CANCEL:
 			// fill framebuffer with 0xff
-			get_current_frame_buffer().fill(0xff);
+			fb().fill(0xff);
+			show();
 			return;
 
 		case BUTTON_LEFT:
@@ -380,8 +488,9 @@ protected:
 			if(button == BUTTON_RIGHT) ++x;
 			if(x < 0) x = 0;
 			if(x >= LED_MAX_LOGICAL_COL) x = LED_MAX_LOGICAL_COL - 1;
-			get_current_frame_buffer().fill(0);
-			get_current_frame_buffer().fill(x, 0, 1, LED_MAX_LOGICAL_ROW, 0xff);
+			fb().fill(0);
+			fb().fill(x, 0, 1, LED_MAX_LOGICAL_ROW, 0xff);
+			show();
 			return;
 
 		case BUTTON_UP:
@@ -391,8 +500,9 @@ protected:
 			if(button == BUTTON_DOWN) ++y;
 			if(y < 0) y = 0;
 			if(y >= LED_MAX_LOGICAL_ROW) y = LED_MAX_LOGICAL_ROW - 1;
-			get_current_frame_buffer().fill(0);
-			get_current_frame_buffer().fill(0, y, LED_MAX_LOGICAL_COL, 1, 0xff);
+			fb().fill(0);
+			fb().fill(0, y, LED_MAX_LOGICAL_COL, 1, 0xff);
+			show();
 			return;
 		}
 
@@ -411,6 +521,8 @@ protected:
 	int max_chars; //!< maximum bytes arrowed
 
 	string_vector char_list;
+	text_run_t title_run; //!< title, ready to draw
+	std::vector<text_run_t> char_list_runs; //!< char_list, ready to draw
 
 	int line_start = 0; //!< line display start character index
 	int char_list_start = 0; //!< char_list display start line index
@@ -441,6 +553,8 @@ public:
 					F("`{|}~")
 				}
 	{
+		title_run.set(title, font_5x5);
+		for(auto && chars : char_list) char_list_runs.emplace_back(chars, font_5x5);
 	}
 
 protected:
@@ -449,7 +563,7 @@ protected:
 	bool draw() override
 	{
 		// draw title
-		fb().draw_text(0, 0, 255, title.c_str(), font_5x5);
+		title_run.draw(fb(), 0, 0, 255);
 
 		// draw line
 		fb().fill(0, 6, LED_MAX_LOGICAL_COL, 1, 128);
@@ -479,11 +593,8 @@ protected:
 		// draw char_list
 		for(int i = 0; i < num_char_list_display_lines; ++i)
 		{
-			if(i+char_list_start < char_list.size())
-			{
-				fb().draw_text(0, i*6+char_list_start_y,
-					255, char_list[i+char_list_start].c_str(), font_5x5);
-			}
+			if(i+char_list_start < char_list_runs.size())
+				char_list_runs[i+char_list_start].draw(fb(), 0, i*6+char_list_start_y, 255);
 		}
 
 		// show the drawn content
@@ -690,6 +801,10 @@ protected:
 	int title_line_y = 7; //!< title underline position in y axis
 	int list_start_y = 8; //!< menu item start position in y axis
 
+	text_run_t title_run; //!< title, ready to draw
+	std::vector<text_run_t> item_runs; //!< items, ready to draw
+	int num_item_runs = -1; //!< number of items as of item_runs are made
+
 public:
 	screen_menu_t(const String &_title, const string_vector & _items) :
 		 title(_title), items(_items)
@@ -715,10 +830,23 @@ protected:
 		}
 	}
 
+	//! Make text runs of the title and items;
+	//! derived classes may add items after construction
+	void update_runs()
+	{
+		if(num_item_runs == (int)items.size()) return;
+		num_item_runs = items.size();
+		title_run.set(title, font_5x5);
+		item_runs.clear();
+		for(auto && item : items) item_runs.emplace_back(item, font_5x5);
+	}
+
 	bool draw() override
 	{
+		update_runs();
+
 		// draw the title
-		fb().draw_text(0, 0, 255, title.c_str(), font_5x5);
+		title_run.draw(fb(), 0, 0, 255);
 
 		// draw line
 		fb().fill(0, title_line_y, LED_MAX_LOGICAL_COL, 1, 128);
@@ -729,10 +857,11 @@ protected:
 		// draw items
 		for(int i = 0; i < max_lines; ++ i)
 		{
-			if(i + y_top < items.size())
+			if(i + y_top < item_runs.size())
 			{
-				if(x < items[i + y_top].length() - 1)
-					fb().draw_text(1, i * 6 + list_start_y, 255, items[i + y_top].c_str() + x, font_5x5);
+				const text_run_t & run = item_runs[i + y_top];
+				if(x < run.get_count() - 1)
+					run.draw(fb(), 1, i * 6 + list_start_y, 255, BM_OVER, x);
 			}
 		}
 
@@ -780,7 +909,7 @@ protected:
 //! Menu list UI with scrolling marquee under title
 class screen_menu_with_marquee_t : public screen_menu_t
 {
-	String marquee;
+	text_run_t marquee; //!< marquee, ready to draw
 	int marquee_len; //!< length of marquee
 	int marquee_x; //!< marquee displaying x
 	int count = 0; //!< tick count
@@ -800,7 +929,7 @@ public:
 
 	void set_marquee(const String & m)
 	{
-		marquee = m + F(" ") + m + F(" ");
+		marquee.set(m + F(" ") + m + F(" "), font_5x5);
 		marquee_len = m.length() + 1;
 		if(marquee_len < num_w_chars)
 			marquee_x = 0;
@@ -809,7 +938,7 @@ public:
 	bool draw() override
 	{
 		screen_menu_t::draw(); // call inherited class' draw()
-		fb().draw_text(-marquee_x, 6, 255, marquee.c_str(), font_5x5);
+		marquee.draw(fb(), -marquee_x, 6, 255);
 		return true;
 	}
 
@@ -1111,10 +1240,10 @@ protected:
 
 class screen_wifi_scanning_t : public screen_base_t
 {
-	String line[2];
+	text_run_t line[2];
 
 public:
-	screen_wifi_scanning_t() : line { F("Scanning"), F("Networks") }
+	screen_wifi_scanning_t() : line { { F("Scanning"), font_5x5 }, { F("Networks"), font_5x5 } }
 	{
 		WiFi.scanNetworks(/*async=*/true, /*show_hidden=*/false);
 	}
@@ -1122,8 +1251,8 @@ public:
 	bool draw() override
 	{
 		// draw the text
-		fb().draw_text(0, 12, get_blink_intensity(), line[0].c_str(), font_5x5);
-		fb().draw_text(0, 18, get_blink_intensity(), line[1].c_str(), font_5x5);
+		line[0].draw(fb(), 0, 12, get_blink_intensity());
+		line[1].draw(fb(), 0, 18, get_blink_intensity());
 
 		// show the drawn content
 		return true;
@@ -1151,12 +1280,12 @@ protected:
 
 class screen_wps_processing_t : public screen_base_t
 {
-	String line[2];
+	text_run_t line[2];
 	bool done = false;
 	bool first = false;
 
 public:
-	screen_wps_processing_t() : line { F("Waiting"), F("WPS") }
+	screen_wps_processing_t() : line { { F("Waiting"), font_5x5 }, { F("WPS"), font_5x5 } }
 	{
 
 	}
@@ -1164,8 +1293,8 @@ public:
 	bool draw() override
 	{
 		// draw the text
-		fb().draw_text(0, 12, get_blink_intensity(), line[0].c_str(), font_5x5);
-		fb().draw_text(0, 18, get_blink_intensity(), line[1].c_str(), font_5x5);
+		line[0].draw(fb(), 0, 12, get_blink_intensity());
+		line[1].draw(fb(), 0, 18, get_blink_intensity());
 		first = true; // indicate first screen is drawn
 		return true;
 	}
@@ -1279,13 +1408,40 @@ class screen_clock_t : public screen_base_t
 {
 	String marquee; //!< marquee string
 	int marquee_len = 0; //!< marquee width
-	int marquee_x = 0; //!< marquee displaying x
-	int count = 0;
+	int32_t marquee_x_64 = 0; //!< marquee displaying x, in 1/64 px
+	int marquee_speed = 33; //!< marquee scroll speed in px per second
+	uint32_t marquee_millis = 0; //!< time when marquee_x_64 was advanced last
+	uint32_t marquee_rem = 0; //!< remainder of the advance, in 1/64000 px
+	scroll_strip_t marquee_strip; //!< pre-rendered marquee
+
+	calendar_tm tm = calendar_tm(); //!< time to draw
+	String face_key; //!< content of the face layer as of last drawing
+
+	compositor_t compositor;
+	layer_t face_layer; //!< hours, minutes, date and sensors; redrawn only when changed
+	layer_t seconds_layer; //!< seconds
+	layer_t marquee_layer; //!< marquee
 
 public:
-	screen_clock_t() 
-	{
+	screen_clock_t() :
+		face_layer(std::bind(&screen_clock_t::draw_face, this, std::placeholders::_1),
+			0, 0, LED_MAX_LOGICAL_COL, 36, true),
+		seconds_layer(std::bind(&screen_clock_t::draw_seconds, this, std::placeholders::_1),
+			57, 13, 7, 5, false),
+		marquee_layer(std::bind(&screen_clock_t::draw_marquee, this, std::placeholders::_1),
+			0, 36, LED_MAX_LOGICAL_COL, LED_MAX_LOGICAL_ROW - 36, false)
+	{
+		set_damage_tracking(true); // only changed layers are composited again
+		set_frame_sync(true); // the marquee moves at every refresh
+		compositor.add(&face_layer);
+		compositor.add(&seconds_layer);
+		compositor.add(&marquee_layer);
+
 		String r;
+		settings_write(F("ui_screen_clock_marquee_speed"), String(marquee_speed), SETTINGS_NO_OVERWRITE);
+		settings_read(F("ui_screen_clock_marquee_speed"), r);
+		marquee_speed = clamp_marquee_speed(r.toInt());
+
 		settings_write(F("ui_screen_clock_marquee"), F(""), SETTINGS_NO_OVERWRITE);
 		settings_read(F("ui_screen_clock_marquee"), r);
 
@@ -1301,52 +1457,67 @@ public:
 
 	String get_marquee() const { return marquee; }
 
+	//! Set marquee scroll speed in px per second
+	void set_marquee_speed(int speed)
+	{
+		speed = clamp_marquee_speed(speed);
+		settings_write(F("ui_screen_clock_marquee_speed"), String(speed));
+		marquee_speed = speed;
+	}
+
+	int get_marquee_speed() const { return marquee_speed; }
+
+	static constexpr int max_marquee_speed = 1000; //!< maximum marquee speed in px per second
+
 private:
+	//! Returns speed limited to 0 ~ max_marquee_speed, so that a bad
+	//! setting cannot overflow marquee_rem in update_marquee()
+	static int clamp_marquee_speed(long speed)
+	{
+		if(speed < 0) return 0;
+		if(speed > max_marquee_speed) return max_marquee_speed;
+		return speed;
+	}
+
 	void _set_marquee(const String &s)
 	{
 		if(!font_bff.get_available()) return;
 		marquee = s;
 		marquee_len = fb().get_text_width(s, font_bff);
-		if(marquee_x >= marquee_len) marquee_x = 0;
+		if(marquee_x_64 >= marquee_len * 64) marquee_x_64 = 0;
+		marquee_strip.render(marquee, font_bff); // draw_text is used if this fails
+		marquee_layer.invalidate();
 	}
 
-protected:
-	bool draw() override
+	void draw_face(frame_buffer_t & fb)
 	{
-		calendar_tm tm;
-		calendar_get_time(tm);
-
 		// hours and minutes
 		char buf[20];
 		buf[0] = tm.tm_hour / 10 + '0';
 		buf[1] = 0;
-		fb().draw_text( 0, 0, 255, buf, font_large_digits);
+		fb.draw_text( 0, 0, 255, buf, font_large_digits);
 
 		buf[0] = tm.tm_hour % 10 + '0';
 		buf[1] = 0;
-		fb().draw_text(13, 0, 255, buf, font_large_digits);
+		fb.draw_text(13, 0, 255, buf, font_large_digits);
 
 		buf[0] = tm.tm_min / 10 + '0';
 		buf[1] = 0;
-		fb().draw_text(29, 0, 255, buf, font_large_digits);
+		fb.draw_text(29, 0, 255, buf, font_large_digits);
 
 		buf[0] = tm.tm_min % 10 + '0';
 		buf[1] = 0;
-		fb().draw_text(42, 0, 255, buf, font_large_digits);
+		fb.draw_text(42, 0, 255, buf, font_large_digits);
 
-		buf[0] = 0xE2; buf[1] = 0x82; buf[2] = tm.tm_sec / 10 + 0x80;
-		buf[3] = 0xE2; buf[4] = 0x82; buf[5] = tm.tm_sec % 10 + 0x80;
-		buf[6] = 0;
-		fb().draw_text(57, 13, 255, buf, font_5x5);
-		fb().fill(27,  5, 2, 2, 255);
-		fb().fill(27, 12, 2, 2, 255);
+		fb.fill(27,  5, 2, 2, 255);
+		fb.fill(27, 12, 2, 2, 255);
 
 		buf[0] = tm.tm_wday + '0';
 		buf[1] = 0;
-		fb().draw_text(0, 19, 255, buf, font_week_names);
+		fb.draw_text(0, 19, 255, buf, font_week_names);
 
 		sprintf_P(buf, PSTR("%2d/%2d"), tm.tm_mon + 1, tm.tm_mday);
-		fb().draw_text(26, 19, 255, buf, font_bold_digits);
+		fb.draw_text(26, 19, 255, buf, font_bold_digits);
 
 		int temp = bme280_result.temp_10; // TODO: Fahrenheit degree
 		if(temp <= -100)
@@ -1366,16 +1537,66 @@ protected:
 		}
 		sprintf_P(buf + strlen(buf),
 			PSTR("℃ %4dh %2d%%"), bme280_result.pressure, bme280_result.humidity);
-		fb().draw_text(0, 28, 255, buf, font_4x5);
+		fb.draw_text(0, 28, 255, buf, font_4x5);
+	}
 
+	void draw_seconds(frame_buffer_t & fb)
+	{
+		char buf[7];
+		buf[0] = 0xE2; buf[1] = 0x82; buf[2] = tm.tm_sec / 10 + 0x80;
+		buf[3] = 0xE2; buf[4] = 0x82; buf[5] = tm.tm_sec % 10 + 0x80;
+		buf[6] = 0;
+		fb.draw_text(57, 13, 255, buf, font_5x5);
+	}
 
-		// draw marquee
-		if(font_bff.get_available())
+	void draw_marquee(frame_buffer_t & fb)
+	{
+		if(marquee_strip.get_available())
 		{
-			fb().draw_text(-marquee_x              , 36, 255, marquee, font_bff);
+			int w = marquee_len > LED_MAX_LOGICAL_COL ? LED_MAX_LOGICAL_COL : marquee_len;
+			marquee_strip.draw_subpixel(fb, 0, 36, marquee_x_64, w);
+		}
+		else if(font_bff.get_available())
+		{
+			int marquee_x = font_base_t::round_64(marquee_x_64);
+			fb.draw_text(-marquee_x              , 36, 255, marquee, font_bff);
 			if(marquee_len > LED_MAX_LOGICAL_COL)
-				fb().draw_text(-marquee_x + marquee_len, 36, 255, marquee, font_bff);
+				fb.draw_text(-marquee_x + marquee_len, 36, 255, marquee, font_bff);
+		}
+	}
+
+protected:
+	void on_activate() override
+	{
+		compositor.invalidate();
+		marquee_millis = millis(); // the marquee stays still while other screens are shown
+	}
+
+	void update() override
+	{
+		int last_sec = tm.tm_sec;
+		calendar_get_time(tm);
+		if(tm.tm_sec != last_sec) seconds_layer.invalidate();
+
+		update_marquee();
+
+		// redraw the face only when its content changes
+		char key[100];
+		sprintf_P(key, PSTR("%d %d %d %d %d %d %d %d"),
+			tm.tm_hour, tm.tm_min, tm.tm_wday, tm.tm_mon, tm.tm_mday,
+			bme280_result.temp_10, bme280_result.pressure, bme280_result.humidity);
+		if(face_key != key)
+		{
+			face_key = key;
+			face_layer.invalidate();
 		}
+
+		compositor.report_damage(frame_buffer_get_damage());
+	}
+
+	bool draw() override
+	{
+		compositor.compose(fb());
 		return true;
 	}
 
@@ -1400,23 +1621,27 @@ protected:
 		}
 	}
 
-	void on_idle_10() override
+	//! Advance the marquee by the time elapsed since the last frame, so
+	//! that it moves at the same speed however often frames are drawn
+	void update_marquee()
 	{
-		++ count;
-		if(count >= 3)
+		uint32_t now = millis();
+		uint32_t elapsed = now - marquee_millis;
+		marquee_millis = now;
+		if(marquee_len <= LED_MAX_LOGICAL_COL)
 		{
-			count = 0;
-
-			if(marquee_len > LED_MAX_LOGICAL_COL)
-			{
-				++ marquee_x;
-				if(marquee_x >= marquee_len) marquee_x = 0;
-			}
-			else
-			{
-				marquee_x = 0;
-			}
+			marquee_x_64 = 0;
+			return;
 		}
+		if(elapsed > 1000) elapsed = 1000;
+
+		// the remainder is carried over, so that no time is lost by rounding
+		marquee_rem += marquee_speed * 64 * elapsed;
+		int32_t step_64 = marquee_rem / 1000;
+		marquee_rem %= 1000;
+		if(step_64 == 0) return;
+		marquee_x_64 = (marquee_x_64 + step_64) % (marquee_len * 64);
+		marquee_layer.invalidate();
 	}
 
 };
@@ -1435,9 +1660,12 @@ void ui_setup()
 void ui_process()
 {
 	screen_manager.process_idle();
+	screen_manager.process_frame();
 }
 
 
 String ui_get_marquee() { return screen_clock->get_marquee(); }
 void ui_set_marquee(const String &s) { screen_clock->set_marquee(s); }
+int ui_get_marquee_speed() { return screen_clock->get_marquee_speed(); }
+void ui_set_marquee_speed(int speed) { screen_clock->set_marquee_speed(speed); }
 
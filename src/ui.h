@@ -6,4 +6,6 @@ void ui_process();
 
 String ui_get_marquee();
 void ui_set_marquee(const String &s);
+int ui_get_marquee_speed(); //!< marquee scroll speed in px per second
+void ui_set_marquee_speed(int speed);
 #endif
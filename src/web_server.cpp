@@ -310,6 +310,10 @@ static void web_server_export_json_for_ui(bool js)
 	st.print(F("\"ui_marquee\":"));
 	string_json(ui_get_marquee(), st);
 
+	st.print(F(",\n"));
+	st.print(F("\"ui_marquee_speed\":"));
+	st.printf_P(PSTR("%d"), ui_get_marquee_speed());
+
 	st.print(F(",\n"));
 	st.print(F("\"version_info\":{"));
 
@@ -340,6 +344,69 @@ static void web_server_export_json_for_ui(bool js)
 		server.send(200, F("application/json"), st);
 }
 
+static void web_server_export_scan_telemetry()
+{
+	led_telemetry_t t;
+	led_get_telemetry(t);
+
+	StreamString st;
+	st.print(F("{\"result\":\"ok\",\"values\":{\n"));
+	st.printf_P(PSTR("\"interrupt_count\":%u,\n"), t.interrupt_count);
+	st.printf_P(PSTR("\"frame_count\":%u,\n"), t.frame_count);
+	st.printf_P(PSTR("\"fps\":%u.%02u,\n"), t.fps_100 / 100, t.fps_100 % 100);
+	st.printf_P(PSTR("\"max_isr_cycles\":%u,\n"), t.max_isr_cycles);
+	st.printf_P(PSTR("\"late_rows\":%u,\n"), t.late_rows);
+	st.printf_P(PSTR("\"rssi\":%d,\n"), WiFi.RSSI());
+	st.printf_P(PSTR("\"channel\":%d,\n"), WiFi.channel());
+
+	// upper bound of each lateness histogram bin, in CPU cycle
+	st.print(F("\"lateness_bins\":["));
+	for(int b = 0; b < LED_TELEMETRY_NUM_BINS - 1; ++b)
+		st.printf_P(PSTR("%u,"), 64U << b);
+	st.print(F("null],\n"));
+
+	st.print(F("\"phases\":["));
+	for(int p = 0; p < LED_NUM_PHASES; ++p)
+	{
+		if(p) st.print(F(",\n"));
+		st.print(F("{\"lateness\":["));
+		for(int b = 0; b < LED_TELEMETRY_NUM_BINS; ++b)
+		{
+			if(b) st.print((char)',');
+			st.printf_P(PSTR("%u"), t.lateness_hist[p][b]);
+		}
+		st.printf_P(PSTR("],\"busy_on_entry\":%u,\"late_on_entry\":%u,\"max_cycles\":%u}"),
+			t.busy_on_entry[p], t.late_on_entry[p], t.max_phase_cycles[p]);
+	}
+	st.print(F("]\n"));
+
+	st.print(F("}}\n"));
+	server.send(200, F("application/json"), st);
+}
+
+static void web_server_export_font_stats()
+{
+	const bff_glyph_cache_t::stats_t & g = font_bff.get_glyph_cache_stats();
+	uint32_t lookups = g.hits + g.misses;
+
+	StreamString st;
+	st.print(F("{\"result\":\"ok\",\"values\":{\n"));
+	st.printf_P(PSTR("\"glyph_cache_hits\":%u,\n"), g.hits);
+	st.printf_P(PSTR("\"glyph_cache_misses\":%u,\n"), g.misses);
+	st.printf_P(PSTR("\"glyph_cache_hit_rate\":%u,\n"),
+		lookups ? (uint32_t)((uint64_t)g.hits * 100 / lookups) : 0); // in percent
+	st.printf_P(PSTR("\"glyph_cache_evictions\":%u,\n"), g.evictions);
+	st.printf_P(PSTR("\"glyph_cache_compactions\":%u,\n"), g.compactions);
+	st.printf_P(PSTR("\"glyph_cache_arena_used\":%u,\n"), g.arena_used);
+	st.printf_P(PSTR("\"glyph_cache_arena_size\":%u,\n"), bff_glyph_cache_t::arena_size);
+	st.printf_P(PSTR("\"glyph_cache_entries_used\":%u,\n"), g.entries_used);
+	st.printf_P(PSTR("\"glyph_cache_num_entries\":%u,\n"), bff_glyph_cache_t::num_entries);
+	st.printf_P(PSTR("\"flash_cache_hits\":%u,\n"), font_bff.get_flash_cache_hits());
+	st.printf_P(PSTR("\"flash_cache_misses\":%u\n"), font_bff.get_flash_cache_misses());
+	st.print(F("}}\n"));
+	server.send(200, F("application/json"), st);
+}
+
 static void web_server_handle_admin_pass()
 {
 	if(!send_common_header()) return;
@@ -368,6 +435,19 @@ static void web_server_handle_ui_marquee()
 	if(!send_common_header()) return;
 	String m = server.arg(F("ui_marquee"));
 	ui_set_marquee(m);
+	if(server.hasArg(F("ui_marquee_speed")))
+		ui_set_marquee_speed(server.arg(F("ui_marquee_speed")).toInt());
+
+	send_json_ok();
+}
+
+static void web_server_handle_phasecal()
+{
+	if(!send_common_header()) return;
+	if(server.hasArg(F("reset")))
+		led_reset_phase_schedule();
+	else
+		led_start_phase_calibration();
 
 	send_json_ok();
 }
@@ -431,6 +511,16 @@ void web_server_setup()
 			web_server_export_json_for_ui(true);
 		});
 
+	server.on(F("/status/scan.json"), HTTP_GET, []() {
+			if(!send_common_header()) return;
+			web_server_export_scan_telemetry();
+		});
+
+	server.on(F("/status/font.json"), HTTP_GET, []() {
+			if(!send_common_header()) return;
+			web_server_export_font_stats();
+		});
+
 	server.on(F("/settings/admin_pass"), HTTP_POST,
 		&web_server_handle_admin_pass);
 
@@ -440,6 +530,9 @@ void web_server_setup()
 	server.on(F("/settings/ui_marquee"), HTTP_POST,
 		&web_server_handle_ui_marquee);
 
+	server.on(F("/settings/phasecal"), HTTP_POST,
+		&web_server_handle_phasecal);
+
 	server.on(F("/settings/export"), HTTP_GET, [](){
 			String filename(F("export.tar"));
 			if(!send_common_header()) return;
@@ -0,0 +1,712 @@
+/*
+	bffc: BFF font compiler.
+
+	Builds a BFF font file, which fonts/font_bff.cpp reads from the flash,
+	from BDF fonts, 8bit grayscale PNG glyph sheets and existing BFF files.
+	This runs on the build host, not on the ESP8266.
+
+	usage: bffc [options] -o OUTPUT.bff INPUT...
+
+	Inputs are read in order; a glyph in an earlier input takes precedence
+	over the same code point in later ones. The nominal height of the font
+	is taken from the first input. The type of each input is determined
+	by its extension (.bdf, .png or .bff).
+
+	options:
+	  -o FILE        output file
+	  -r FIRST-LAST  keep only code points in the range, in hex
+	                 (e.g. 20-7e or U+3040-U+30FF); may be given more
+	                 than once. All glyphs are kept if not given.
+	  -m METHOD      compression method:
+	                   xor4     4bpp row-XOR with varint runs (default)
+	                   rle      zero run-length
+	                   rle-diff zero run-length of differentiated pixels
+	                   rle-auto smaller one of rle and rle-diff per glyph
+	                 xor4 stores 16 levels, which is what the firmware
+	                 shows; the others keep the full 7bit and can also be
+	                 read by older firmware.
+	  -v             decode the output again and compare with the input
+	  -s             print statistics
+
+	PNG options; apply to PNG inputs which follow:
+	  --png-cell WxH     size of a glyph cell; cells are laid out left to
+	                     right, then top to bottom
+	  --png-first HEX    code point of the first cell (default 20)
+	  --png-count N      number of cells (default: all cells)
+	  --png-advance N    advance in px (default: cell width)
+	  --png-invert       dark glyphs on light background
+
+	Blank PNG cells are skipped, except for U+0020.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <png.h>
+
+static constexpr uint16_t FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH_DIFF = 0x00;
+static constexpr uint16_t FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH = 0x01;
+static constexpr uint16_t FLAGS_COMPRESSION_METHOD_XOR4 = 0x02;
+static constexpr uint16_t FLAGS_COMPRESSION_METHOD_MASK = 0x07;
+
+//! glyph record in CHRM; same as bff_font_t::glyph_info_t
+#pragma pack(push, 1)
+struct glyph_info_t
+{
+	int32_t code_point;
+	int32_t ascend_x;
+	int32_t ascend_y;
+	uint32_t bitmap_offset;
+	uint32_t compressed_size;
+	uint16_t flags;
+	uint16_t reserved0;
+	int16_t bb_x;
+	int16_t bb_y;
+	uint16_t bb_w;
+	uint16_t bb_h;
+};
+
+struct dir_t
+{
+	char name[4];
+	uint32_t size;
+	uint32_t offset;
+	uint32_t reserved;
+};
+#pragma pack(pop)
+
+//! glyph in memory
+struct glyph_t
+{
+	int32_t code_point = 0;
+	int32_t advance = 0; //!< advance in 1/64 px
+	int bb_x = 0, bb_y = 0; //!< bounding box position from the left top of the line
+	int bb_w = 0, bb_h = 0; //!< bounding box size
+	std::vector<uint8_t> pixels; //!< 7bit grayscale, bb_w * bb_h
+};
+
+struct font_t
+{
+	int nominal_height = 0; //!< nominal height in px
+	std::map<int32_t, glyph_t> glyphs; //!< glyphs by code point
+};
+
+struct range_t
+{
+	int32_t first, last;
+};
+
+struct png_options_t
+{
+	int cell_w = 0, cell_h = 0;
+	int32_t first = 0x20;
+	int count = -1;
+	int advance = -1;
+	bool invert = false;
+};
+
+static void fail(const char * fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	fputs("bffc: ", stderr);
+	vfprintf(stderr, fmt, ap);
+	fputs("\n", stderr);
+	va_end(ap);
+	exit(1);
+}
+
+//! 7bit grayscale to 4bit, the same as the firmware does
+static uint8_t level_4bit(int v)
+{
+	return (((v << 1) + (v >> 6)) + 8) / 17;
+}
+
+//! 4bit to 7bit grayscale, of which level_4bit() gives the original
+static uint8_t level_7bit(int n)
+{
+	return (n * 17) >> 1;
+}
+
+
+//! Trim blank borders of the bounding box
+static void trim(glyph_t & g)
+{
+	int x0 = g.bb_w, y0 = g.bb_h, x1 = -1, y1 = -1;
+	for(int y = 0; y < g.bb_h; ++y)
+		for(int x = 0; x < g.bb_w; ++x)
+			if(g.pixels[y * g.bb_w + x])
+			{
+				x0 = std::min(x0, x), x1 = std::max(x1, x);
+				y0 = std::min(y0, y), y1 = std::max(y1, y);
+			}
+
+	if(x1 < 0)
+	{
+		// blank
+		g.bb_x = g.bb_y = g.bb_w = g.bb_h = 0;
+		g.pixels.clear();
+		return;
+	}
+
+	std::vector<uint8_t> p;
+	for(int y = y0; y <= y1; ++y)
+		p.insert(p.end(), g.pixels.begin() + y * g.bb_w + x0, g.pixels.begin() + y * g.bb_w + x1 + 1);
+	g.bb_x += x0, g.bb_y += y0;
+	g.bb_w = x1 - x0 + 1, g.bb_h = y1 - y0 + 1;
+	g.pixels.swap(p);
+}
+
+static void add_glyph(font_t & font, glyph_t & g)
+{
+	// earlier inputs take precedence
+	if(!font.glyphs.count(g.code_point)) font.glyphs[g.code_point] = std::move(g);
+}
+
+
+//! Load a BDF font; pixels are either 0 or 127
+static void load_bdf(const char * fn, font_t & font)
+{
+	FILE * fp = fopen(fn, "r");
+	if(!fp) fail("can not open %s", fn);
+
+	char line[1024];
+	int ascent = -1, descent = -1;
+	int fbb_h = 0, fbb_y = 0; // FONTBOUNDINGBOX
+	glyph_t g;
+	int bbx_w = 0, bbx_h = 0, bbx_x = 0, bbx_y = 0;
+	bool in_char = false, in_bitmap = false;
+	int row = 0;
+
+	auto baseline = [&]() { return ascent >= 0 ? ascent : fbb_h + fbb_y; };
+
+	while(fgets(line, sizeof(line), fp))
+	{
+		char key[64] = "";
+		sscanf(line, "%63s", key);
+
+		if(in_bitmap)
+		{
+			if(!strcmp(key, "ENDCHAR"))
+			{
+				in_bitmap = in_char = false;
+				if(g.code_point >= 0)
+				{
+					trim(g);
+					add_glyph(font, g);
+				}
+				continue;
+			}
+			if(row >= bbx_h) continue;
+			// a row in hex, MSB first
+			for(int x = 0; x < bbx_w; ++x)
+			{
+				char h[2] = { line[x >> 2], 0 };
+				int nibble = (int)strtol(h, nullptr, 16);
+				if(nibble & (8 >> (x & 3))) g.pixels[row * bbx_w + x] = 127;
+			}
+			++ row;
+			continue;
+		}
+
+		if(!strcmp(key, "FONT_ASCENT")) sscanf(line, "%*s %d", &ascent);
+		else if(!strcmp(key, "FONT_DESCENT")) sscanf(line, "%*s %d", &descent);
+		else if(!strcmp(key, "FONTBOUNDINGBOX")) sscanf(line, "%*s %*d %d %*d %d", &fbb_h, &fbb_y);
+		else if(!strcmp(key, "STARTCHAR"))
+		{
+			g = glyph_t();
+			in_char = true;
+		}
+		else if(in_char && !strcmp(key, "ENCODING")) sscanf(line, "%*s %d", &g.code_point);
+		else if(in_char && !strcmp(key, "DWIDTH"))
+		{
+			int dx = 0;
+			sscanf(line, "%*s %d", &dx);
+			g.advance = dx * 64;
+		}
+		else if(in_char && !strcmp(key, "BBX"))
+			sscanf(line, "%*s %d %d %d %d", &bbx_w, &bbx_h, &bbx_x, &bbx_y);
+		else if(in_char && !strcmp(key, "BITMAP"))
+		{
+			g.bb_x = bbx_x;
+			g.bb_y = baseline() - (bbx_y + bbx_h);
+			g.bb_w = bbx_w, g.bb_h = bbx_h;
+			g.pixels.assign(bbx_w * bbx_h, 0);
+			row = 0;
+			in_bitmap = true;
+		}
+	}
+	fclose(fp);
+
+	if(!font.nominal_height)
+		font.nominal_height = ascent >= 0 && descent >= 0 ? ascent + descent : fbb_h;
+}
+
+
+//! Load glyphs from a PNG sheet of cells
+static void load_png(const char * fn, const png_options_t & opt, font_t & font)
+{
+	if(opt.cell_w <= 0 || opt.cell_h <= 0) fail("--png-cell is needed for %s", fn);
+
+	png_image image;
+	memset(&image, 0, sizeof(image));
+	image.version = PNG_IMAGE_VERSION;
+	if(!png_image_begin_read_from_file(&image, fn)) fail("can not read %s: %s", fn, image.message);
+	image.format = PNG_FORMAT_GRAY;
+	std::vector<uint8_t> buf(PNG_IMAGE_SIZE(image));
+	if(!png_image_finish_read(&image, nullptr, buf.data(), 0, nullptr))
+		fail("can not read %s: %s", fn, image.message);
+
+	int cols = image.width / opt.cell_w;
+	int rows = image.height / opt.cell_h;
+	int count = opt.count >= 0 ? std::min(opt.count, cols * rows) : cols * rows;
+	for(int i = 0; i < count; ++i)
+	{
+		glyph_t g;
+		g.code_point = opt.first + i;
+		g.advance = (opt.advance >= 0 ? opt.advance : opt.cell_w) * 64;
+		g.bb_w = opt.cell_w, g.bb_h = opt.cell_h;
+		g.pixels.resize(g.bb_w * g.bb_h);
+		int cx = (i % cols) * opt.cell_w, cy = (i / cols) * opt.cell_h;
+		for(int y = 0; y < g.bb_h; ++y)
+			for(int x = 0; x < g.bb_w; ++x)
+			{
+				int v = buf[(cy + y) * image.width + cx + x];
+				if(opt.invert) v = 255 - v;
+				g.pixels[y * g.bb_w + x] = v >> 1;
+			}
+		trim(g);
+		if(g.bb_w == 0 && g.code_point != 0x20) continue;
+		add_glyph(font, g);
+	}
+
+	if(!font.nominal_height) font.nominal_height = opt.cell_h;
+}
+
+
+//! Decode a compressed bitmap into 7bit grayscale pixels
+static bool decode(const uint8_t * data, uint32_t size, uint16_t flags, glyph_t & g)
+{
+	const uint32_t n = g.bb_w * g.bb_h;
+	const uint8_t * end = data + size;
+	g.pixels.assign(n, 0);
+	uint32_t method = flags & FLAGS_COMPRESSION_METHOD_MASK;
+
+	if(method == FLAGS_COMPRESSION_METHOD_XOR4)
+	{
+		std::vector<uint8_t> px(n, 0); // 4bit
+		uint32_t pos = 0;
+		while(pos < n)
+		{
+			uint32_t t = 0;
+			for(uint32_t shift = 0; ; shift += 7)
+			{
+				if(data >= end) return false;
+				uint8_t c = *(data++);
+				t |= (c & 0x7f) << shift;
+				if(!(c & 0x80)) break;
+			}
+			uint32_t count = (t >> 1) + 1;
+			if(count > n - pos) return false;
+			for(uint32_t i = 0; i < count; ++i, ++pos)
+			{
+				uint8_t v = 0;
+				if(t & 1)
+				{
+					if(data >= end) return false;
+					v = (i & 1) ? (*(data++) >> 4) : (*data & 0x0f);
+				}
+				px[pos] = v ^ (pos >= (uint32_t)g.bb_w ? px[pos - g.bb_w] : 0);
+			}
+			if((t & 1) && (count & 1)) ++ data; // the last byte is half used
+		}
+		for(uint32_t i = 0; i < n; ++i) g.pixels[i] = level_7bit(px[i]);
+		return true;
+	}
+
+	if(method != FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH_DIFF &&
+		method != FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH) return false;
+
+	// process run-length
+	std::vector<uint8_t> raw(n, 0);
+	uint32_t pos = 0;
+	while(pos < n && data < end)
+	{
+		uint8_t c = *(data++);
+		if(c & 0x80)
+		{
+			raw[pos++] = c; // literal
+			continue;
+		}
+		uint8_t v = 0;
+		if(c & 0x40)
+		{
+			if(data >= end) return false;
+			v = *(data++);
+		}
+		for(int count = c & 0x3f; count && pos < n; --count) raw[pos++] = v;
+	}
+
+	if(method == FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH_DIFF)
+	{
+		for(uint32_t i = g.bb_w; i < n; ++i) raw[i] += raw[i - g.bb_w];
+		uint8_t prev = 0;
+		for(uint32_t i = 0; i < n; ++i)
+			g.pixels[i] = prev = (raw[i] + prev) & 0x7f;
+	}
+	else
+	{
+		for(uint32_t i = 0; i < n; ++i) g.pixels[i] = raw[i] & 0x7f;
+	}
+	return true;
+}
+
+static void read_at(FILE * fp, const char * fn, uint32_t offset, void * buf, size_t size)
+{
+	if(fseek(fp, offset, SEEK_SET) || fread(buf, 1, size, fp) != size)
+		fail("%s: unexpected end of file", fn);
+}
+
+//! Load a BFF font
+static void load_bff(const char * fn, font_t & font)
+{
+	FILE * fp = fopen(fn, "rb");
+	if(!fp) fail("can not open %s", fn);
+
+	uint8_t sig[8];
+	uint32_t height, num_files;
+	read_at(fp, fn, 0, sig, 8);
+	if(memcmp(sig, "BFF\0\x02\0\0\0", 8)) fail("%s: not a BFF file", fn);
+	read_at(fp, fn, 8, &height, 4);
+	read_at(fp, fn, 12, &num_files, 4);
+
+	dir_t chrm = dir_t(), btmp = dir_t();
+	for(uint32_t i = 0; i < num_files; ++i)
+	{
+		dir_t d;
+		read_at(fp, fn, 16 + i * sizeof(d), &d, sizeof(d));
+		if(!memcmp(d.name, "CHRM", 4)) chrm = d;
+		if(!memcmp(d.name, "BTMP", 4)) btmp = d;
+	}
+	if(!chrm.size || !btmp.size) fail("%s: CHRM or BTMP is missing", fn);
+
+	std::vector<glyph_info_t> infos(chrm.size / sizeof(glyph_info_t));
+	std::vector<uint8_t> bitmaps(btmp.size);
+	read_at(fp, fn, chrm.offset, infos.data(), infos.size() * sizeof(glyph_info_t));
+	read_at(fp, fn, btmp.offset, bitmaps.data(), bitmaps.size());
+	fclose(fp);
+
+	for(auto && info : infos)
+	{
+		glyph_t g;
+		g.code_point = info.code_point;
+		g.advance = info.ascend_x;
+		g.bb_x = info.bb_x, g.bb_y = info.bb_y;
+		g.bb_w = info.bb_w, g.bb_h = info.bb_h;
+		if(g.bb_w && g.bb_h && info.compressed_size && info.bitmap_offset)
+		{
+			if((uint64_t)info.bitmap_offset + info.compressed_size > bitmaps.size() ||
+				!decode(bitmaps.data() + info.bitmap_offset, info.compressed_size, info.flags, g))
+				fail("%s: broken glyph U+%04X", fn, info.code_point);
+		}
+		else
+		{
+			g.bb_w = g.bb_h = 0;
+		}
+		add_glyph(font, g);
+	}
+
+	if(!font.nominal_height) font.nominal_height = height;
+}
+
+
+//! Zero run-length encoder; each byte of raw is significant in its lower 7 bits
+static void encode_rle(const std::vector<uint8_t> & raw, std::vector<uint8_t> & out)
+{
+	for(size_t i = 0; i < raw.size(); )
+	{
+		uint8_t v = raw[i] & 0x7f;
+		size_t run = 1;
+		while(i + run < raw.size() && run < 63 && (raw[i + run] & 0x7f) == v) ++ run;
+
+		if(v == 0)
+		{
+			out.push_back(run); // zero running
+		}
+		else if(run >= 3)
+		{
+			out.push_back(0x40 | run); // non-zero running
+			out.push_back(v);
+		}
+		else
+		{
+			run = 1;
+			out.push_back(0x80 | v); // literal
+		}
+		i += run;
+	}
+}
+
+static std::vector<uint8_t> encode_zero_runlength(const glyph_t & g, bool diff)
+{
+	std::vector<uint8_t> raw(g.pixels);
+	if(diff)
+	{
+		// inverse of the horizontal, then of the vertical sum
+		for(size_t i = raw.size(); i-- > 1; ) raw[i] = (raw[i] - raw[i - 1]) & 0x7f;
+		for(size_t i = raw.size(); i-- > (size_t)g.bb_w; ) raw[i] = (raw[i] - raw[i - g.bb_w]) & 0x7f;
+	}
+	std::vector<uint8_t> out;
+	encode_rle(raw, out);
+	return out;
+}
+
+static void put_varint(std::vector<uint8_t> & out, uint32_t v)
+{
+	while(v >= 0x80)
+	{
+		out.push_back(0x80 | (v & 0x7f));
+		v >>= 7;
+	}
+	out.push_back(v);
+}
+
+static std::vector<uint8_t> encode_xor4(const glyph_t & g)
+{
+	const size_t n = g.pixels.size();
+	std::vector<uint8_t> x(n);
+	for(size_t i = 0; i < n; ++i)
+		x[i] = level_4bit(g.pixels[i]) ^ (i >= (size_t)g.bb_w ? level_4bit(g.pixels[i - g.bb_w]) : 0);
+
+	std::vector<uint8_t> out;
+	for(size_t i = 0; i < n; )
+	{
+		size_t run = 0;
+		while(i + run < n && x[i + run] == 0) ++ run;
+		if(run)
+		{
+			put_varint(out, (run - 1) << 1);
+			i += run;
+			continue;
+		}
+
+		// literals; short zero runs are cheaper to be included
+		size_t end = i;
+		while(end < n)
+		{
+			if(x[end]) { ++ end; continue; }
+			size_t z = 0;
+			while(end + z < n && x[end + z] == 0) ++ z;
+			if(z >= 3 || end + z == n) break;
+			end += z;
+		}
+		size_t count = end - i;
+		put_varint(out, ((count - 1) << 1) | 1);
+		for(size_t j = 0; j < count; j += 2)
+			out.push_back(x[i + j] | (j + 1 < count ? x[i + j + 1] << 4 : 0));
+		i = end;
+	}
+	return out;
+}
+
+
+static void save_bff(const char * fn, const font_t & font, const std::string & method,
+	bool verify, bool stats)
+{
+	std::vector<glyph_info_t> infos;
+	std::vector<uint8_t> bitmaps(4, 0); // bitmap offset 0 means no bitmap
+	uint32_t method_count[8] = {0};
+
+	for(auto && i : font.glyphs)
+	{
+		const glyph_t & g = i.second;
+		glyph_info_t info = glyph_info_t();
+		info.code_point = g.code_point;
+		info.ascend_x = g.advance;
+		info.bb_x = g.bb_x, info.bb_y = g.bb_y;
+		info.bb_w = g.bb_w, info.bb_h = g.bb_h;
+
+		if(g.bb_w && g.bb_h)
+		{
+			std::vector<uint8_t> data;
+			if(method == "xor4")
+			{
+				data = encode_xor4(g);
+				info.flags = FLAGS_COMPRESSION_METHOD_XOR4;
+			}
+			else if(method == "rle")
+			{
+				data = encode_zero_runlength(g, false);
+				info.flags = FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH;
+			}
+			else
+			{
+				data = encode_zero_runlength(g, true);
+				info.flags = FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH_DIFF;
+				if(method == "rle-auto")
+				{
+					std::vector<uint8_t> plain = encode_zero_runlength(g, false);
+					if(plain.size() < data.size())
+					{
+						data.swap(plain);
+						info.flags = FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH;
+					}
+				}
+			}
+
+			if(verify)
+			{
+				glyph_t d = g;
+				if(!decode(data.data(), data.size(), info.flags, d))
+					fail("verify: can not decode U+%04X", g.code_point);
+				for(size_t p = 0; p < g.pixels.size(); ++p)
+				{
+					uint8_t expected = info.flags == FLAGS_COMPRESSION_METHOD_XOR4 ?
+						level_7bit(level_4bit(g.pixels[p])) : g.pixels[p];
+					if(d.pixels[p] != expected) fail("verify: mismatch in U+%04X", g.code_point);
+				}
+			}
+
+			info.bitmap_offset = bitmaps.size();
+			info.compressed_size = data.size();
+			bitmaps.insert(bitmaps.end(), data.begin(), data.end());
+			++ method_count[info.flags & FLAGS_COMPRESSION_METHOD_MASK];
+		}
+		infos.push_back(info);
+	}
+
+	// header, directory, BTMP and then CHRM aligned to 16 bytes
+	const uint32_t num_files = 2;
+	uint32_t btmp_offs = 16 + num_files * sizeof(dir_t);
+	uint32_t chrm_offs = (btmp_offs + bitmaps.size() + 15) & ~15U;
+	uint32_t chrm_size = infos.size() * sizeof(glyph_info_t);
+	dir_t dirs[num_files] = {
+		{ {'C','H','R','M'}, chrm_size, chrm_offs, 0 },
+		{ {'B','T','M','P'}, (uint32_t)bitmaps.size(), btmp_offs, 0 } };
+
+	FILE * fp = fopen(fn, "wb");
+	if(!fp) fail("can not open %s", fn);
+	uint32_t height = font.nominal_height;
+	fwrite("BFF\0\x02\0\0\0", 1, 8, fp);
+	fwrite(&height, 4, 1, fp);
+	fwrite(&num_files, 4, 1, fp);
+	fwrite(dirs, sizeof(dirs), 1, fp);
+	fwrite(bitmaps.data(), 1, bitmaps.size(), fp);
+	for(uint32_t p = btmp_offs + bitmaps.size(); p < chrm_offs; ++p) fputc(0, fp);
+	fwrite(infos.data(), sizeof(glyph_info_t), infos.size(), fp);
+	if(fclose(fp)) fail("can not write %s", fn);
+
+	if(stats)
+	{
+		printf("glyphs        : %zu\n", infos.size());
+		printf("nominal height: %d\n", font.nominal_height);
+		printf("BTMP size     : %zu\n", bitmaps.size());
+		printf("CHRM size     : %u\n", chrm_size);
+		printf("file size     : %u\n", chrm_offs + chrm_size);
+		printf("methods       : rle-diff %u, rle %u, xor4 %u\n",
+			method_count[FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH_DIFF],
+			method_count[FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH],
+			method_count[FLAGS_COMPRESSION_METHOD_XOR4]);
+	}
+}
+
+
+static int32_t parse_code_point(const char * s, char ** end)
+{
+	if(!strncasecmp(s, "U+", 2)) s += 2;
+	return strtol(s, end, 16);
+}
+
+static bool ends_with(const std::string & s, const char * suffix)
+{
+	size_t n = strlen(suffix);
+	return s.size() >= n && !strcasecmp(s.c_str() + s.size() - n, suffix);
+}
+
+static void usage()
+{
+	fputs(
+		"usage: bffc [options] -o OUTPUT.bff INPUT...\n"
+		"  -o FILE        output file\n"
+		"  -r FIRST-LAST  keep only code points in the range, in hex\n"
+		"  -m METHOD      xor4 (default), rle, rle-diff or rle-auto\n"
+		"  -v             verify the output\n"
+		"  -s             print statistics\n"
+		"  --png-cell WxH, --png-first HEX, --png-count N, --png-advance N,\n"
+		"  --png-invert   options for following PNG inputs\n", stderr);
+	exit(1);
+}
+
+int main(int argc, char ** argv)
+{
+	const char * output = nullptr;
+	std::string method = "xor4";
+	std::vector<range_t> ranges;
+	bool verify = false, stats = false;
+	png_options_t png;
+	font_t font;
+	int num_inputs = 0;
+
+	for(int i = 1; i < argc; ++i)
+	{
+		std::string a = argv[i];
+		bool has_value = i + 1 < argc;
+		if(a == "-o" && has_value) output = argv[++i];
+		else if(a == "-m" && has_value)
+		{
+			method = argv[++i];
+			if(method != "xor4" && method != "rle" && method != "rle-diff" && method != "rle-auto")
+				fail("unknown method %s", method.c_str());
+		}
+		else if(a == "-r" && has_value)
+		{
+			char * end;
+			range_t r;
+			r.first = parse_code_point(argv[++i], &end);
+			if(*end != '-') fail("bad range %s", argv[i]);
+			r.last = parse_code_point(end + 1, &end);
+			ranges.push_back(r);
+		}
+		else if(a == "-v") verify = true;
+		else if(a == "-s") stats = true;
+		else if(a == "--png-cell" && has_value)
+		{
+			if(2 != sscanf(argv[++i], "%dx%d", &png.cell_w, &png.cell_h)) fail("bad cell size %s", argv[i]);
+		}
+		else if(a == "--png-first" && has_value) png.first = parse_code_point(argv[++i], nullptr);
+		else if(a == "--png-count" && has_value) png.count = atoi(argv[++i]);
+		else if(a == "--png-advance" && has_value) png.advance = atoi(argv[++i]);
+		else if(a == "--png-invert") png.invert = true;
+		else if(a.size() > 1 && a[0] == '-') usage();
+		else
+		{
+			if(ends_with(a, ".bdf")) load_bdf(a.c_str(), font);
+			else if(ends_with(a, ".png")) load_png(a.c_str(), png, font);
+			else if(ends_with(a, ".bff")) load_bff(a.c_str(), font);
+			else fail("unknown input type %s", a.c_str());
+			++ num_inputs;
+		}
+	}
+	if(!output || !num_inputs) usage();
+
+	// subsetting
+	if(ranges.size())
+	{
+		for(auto it = font.glyphs.begin(); it != font.glyphs.end(); )
+		{
+			bool keep = false;
+			for(auto && r : ranges) keep = keep || (it->first >= r.first && it->first <= r.last);
+			it = keep ? std::next(it) : font.glyphs.erase(it);
+		}
+	}
+	if(font.glyphs.empty()) fail("no glyphs");
+
+	save_bff(output, font, method, verify, stats);
+	return 0;
+}
@@ -0,0 +1,32 @@
+# Stand-in for the GD gem, over libgd through Fiddle.
+#
+# Provides only what src/fonts/make_digits.rb uses, for hosts where the
+# gem cannot be installed; libgd itself is needed (libgd3 on Debian). To
+# regenerate the digit font tables with it:
+#
+#	make -C src/fonts -B RUBY="ruby -I../../tools/gd"
+require 'fiddle'
+
+module GD
+	LIB = Fiddle.dlopen('libgd.so.3')
+	CREATE = Fiddle::Function.new(LIB['gdImageCreateFromPngPtr'],
+		[Fiddle::TYPE_INT, Fiddle::TYPE_VOIDP], Fiddle::TYPE_VOIDP)
+	GETPIXEL = Fiddle::Function.new(LIB['gdImageGetTrueColorPixel'],
+		[Fiddle::TYPE_VOIDP, Fiddle::TYPE_INT, Fiddle::TYPE_INT], Fiddle::TYPE_INT)
+
+	class Image
+		def self.new_from_png(fn)
+			data = File.binread(fn)
+			im = CREATE.call(data.bytesize, data)
+			raise "cannot load #{fn}" if im.null?
+			new(im)
+		end
+
+		def initialize(im) @im = im end
+
+		# returns the pixel as true color, for palette images as well
+		def getPixel(x, y) GETPIXEL.call(@im, x, y) end
+
+		def red(c) (c >> 16) & 0xff end
+	end
+end
@@ -0,0 +1,70 @@
+#ifndef SIM_BENCH_H
+#define SIM_BENCH_H
+
+/*
+	Helpers for host benchmarks.
+
+	Cost is counted by the host time stamp counter where available, and
+	the best of several runs is taken to filter out preemption. These are
+	host numbers; they compare one approach against another, and do not
+	tell the cost on the ESP8266.
+*/
+
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_UNIT "TSC cycles"
+static inline uint64_t bench_clock() { return __rdtsc(); }
+#else
+#include <time.h>
+#define BENCH_UNIT "ns"
+static inline uint64_t bench_clock()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+#endif
+
+//! Run f() reps times and return the best cost of one run
+template <typename F>
+static uint64_t bench_best(int reps, F f)
+{
+	uint64_t best = ~(uint64_t)0;
+	for(int i = 0; i < reps; ++i)
+	{
+		uint64_t start = bench_clock();
+		f();
+		uint64_t t = bench_clock() - start;
+		if(t < best) best = t;
+	}
+	return best;
+}
+
+//! Run f() and g() alternately reps times, so that both see the same host
+//! load, and store the best cost of one run of each
+template <typename F, typename G>
+static void bench_best_pair(int reps, F f, G g, uint64_t & best_f, uint64_t & best_g)
+{
+	best_f = best_g = ~(uint64_t)0;
+	for(int i = 0; i < reps; ++i)
+	{
+		uint64_t start = bench_clock();
+		f();
+		uint64_t t = bench_clock() - start;
+		if(t < best_f) best_f = t;
+		start = bench_clock();
+		g();
+		t = bench_clock() - start;
+		if(t < best_g) best_g = t;
+	}
+}
+
+//! Keep the compiler from optimizing away a computed value
+template <typename T>
+static inline void bench_keep(const T & v)
+{
+	__asm__ __volatile__("" :: "g"(&v) : "memory");
+}
+
+#endif
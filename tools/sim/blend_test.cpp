@@ -0,0 +1,125 @@
+/*
+	Blend kernel test.
+
+	Checks div255() against (x + 127) / 255 over every value it is used
+	for, and blend_row() of every mode against per-pixel loops: one which
+	evaluates the blend formula with a plain division on the pixel values
+	of the format, and the former kind of loop, which went through
+	get_point() and set_point() at 8bit levels. The latter matches exactly
+	for the 8bit format; the others blend at their own precision, and are
+	allowed to differ by their rounding of the level.
+*/
+#include <Arduino.h>
+#include "frame_buffer.h"
+
+#define STRINGIFY(x) STRINGIFY2(x)
+#define STRINGIFY2(x) #x
+
+typedef frame_buffer_t::format_t format_t;
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if(!(cond)) { \
+	if(failures < 20) { fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+	fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); } ++ failures; } } while(0)
+
+static uint32_t rnd_state = 1;
+static uint32_t rnd() { rnd_state = rnd_state * 1103515245 + 12345; return rnd_state >> 8; }
+
+static frame_buffer_t fb, exact, former;
+
+//! Blend formula on pixel values, divided plainly
+static uint32_t blend_pixel(uint32_t d, uint32_t l, uint32_t a, blit_mode_t mode, uint32_t max)
+{
+	uint32_t s = (l * a + 127) / 255;
+	switch(mode)
+	{
+	case BM_COPY: return s;
+	case BM_OVER: return a == 0 ? d : (l * a + d * (255 - a) + 127) / 255;
+	case BM_ADD:  return d + s > max ? max : d + s;
+	case BM_MAX:  return s > d ? s : d;
+	}
+	return d;
+}
+
+//! Per-pixel blend on the pixel values of the format
+static void exact_blend_row(frame_buffer_t & b, int x, int y, int w, const uint8_t *alpha,
+	int level, blit_mode_t mode)
+{
+	const uint32_t l = format_t::from_level(level), max = format_t::from_level(255);
+	for(int i = 0; i < w; ++i)
+		format_t::put(b.array()[y], x + i,
+			blend_pixel(format_t::get(b.array()[y], x + i), l, alpha[i], mode, max));
+}
+
+//! Former kind of per-pixel loop, at 8bit levels through get_point() and set_point()
+static void former_blend_row(frame_buffer_t & b, int x, int y, int w, const uint8_t *alpha,
+	int level, blit_mode_t mode)
+{
+	for(int i = 0; i < w; ++i)
+		b.set_point(x + i, y, blend_pixel(b.get_point(x + i, y), level, alpha[i], mode, 255));
+}
+
+static void test_div255()
+{
+	for(uint32_t x = 0; x <= 4095 * 255; ++x)
+		CHECK(div255(x) == (x + 127) / 255, "div255(%u) = %u, expected %u", x, div255(x), (x + 127) / 255);
+}
+
+static void test_blend_row()
+{
+	static const char * const names[] = { "copy", "add", "max", "over" };
+	int max_level_diff = 0;
+	for(int mode = BM_COPY; mode <= BM_OVER; ++mode)
+		for(int k = 0; k < 2000; ++k)
+		{
+			int y = rnd() % LED_MAX_LOGICAL_ROW;
+			for(int x = 0; x < LED_MAX_LOGICAL_COL; ++x)
+				fb.set_point_deep(x, y, rnd() & 4095);
+			exact = fb;
+			former = fb;
+
+			// alpha of a glyph row: mostly clear or opaque, with edges
+			uint8_t alpha[LED_MAX_LOGICAL_COL];
+			int w = 1 + rnd() % LED_MAX_LOGICAL_COL;
+			int x = rnd() % (LED_MAX_LOGICAL_COL - w + 1);
+			for(int i = 0; i < w; ++i)
+			{
+				uint32_t r = rnd() % 4;
+				alpha[i] = r == 0 ? 0 : r == 1 ? 255 : rnd() & 255;
+			}
+			int level = k < 256 ? k : rnd() & 255;
+
+			fb.blend_row(x, y, w, alpha, level, (blit_mode_t)mode);
+			exact_blend_row(exact, x, y, w, alpha, level, (blit_mode_t)mode);
+			former_blend_row(former, x, y, w, alpha, level, (blit_mode_t)mode);
+
+			CHECK(!memcmp(fb.array(), exact.array(), sizeof(fb.array())),
+				"%s: blend_row(%d, %d, %d, level %d) differs from the formula", names[mode], x, y, w, level);
+			for(int i = 0; i < LED_MAX_LOGICAL_COL; ++i)
+			{
+				int diff = abs(fb.get_point(i, y) - former.get_point(i, y));
+				if(diff > max_level_diff) max_level_diff = diff;
+			}
+		}
+
+	// the 8bit format blends exactly as the former loop did. the 4bit one
+	// may round to the other of the two nearest of its 16 levels. the 12bit
+	// one may differ by 2 levels, as the former loop truncated the
+	// destination to 8bit levels, and get_point() truncates the result.
+	int allowed = sizeof(format_t::pixel_t) == 2 ? 2 : format_t::pixels_per_unit == 2 ? 17 : 0;
+	CHECK(max_level_diff <= allowed, "blend_row differs from the former loop by %d levels, %d allowed",
+		max_level_diff, allowed);
+	printf("%s: blend_row differs from the former per-pixel loop by up to %d levels\n",
+		STRINGIFY(FRAME_BUFFER_FORMAT), max_level_diff);
+}
+
+int main()
+{
+	test_div255();
+	test_blend_row();
+
+	if(failures) { printf("FAILED: %d checks\n", failures); return 1; }
+	printf("OK\n");
+	return 0;
+}
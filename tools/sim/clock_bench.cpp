@@ -0,0 +1,455 @@
+/*
+	Clock screen benchmark.
+
+	Runs the frames of screen_clock_t as the screen manager does for a
+	screen with damage tracking: update() reports the changed layers, and
+	draw() composites them into each rectangle of the damage region, which
+	is cleared beforehand. The face and seconds layers are drawn with the
+	bodies of draw_face() and draw_seconds() in ui.cpp, which cannot be
+	built on the host; the marquee layer is left out, as it draws with
+	font_bff only.
+
+	The fonts are compared with the former lookup: a PROGMEM binary search
+	over the glyphs of font_aa_t, a switch in font_4x5_t, and draw_text()
+	looking every character up twice, by get_metrics() and then put().
+	Two cases are measured, each over 1000 consecutive seconds: the frames
+	drawn once a second, which draw the face again when the minute changes,
+	and full redraws, which draw the face every frame. The number of
+	pgm_read_*() calls, each a flash access on the ESP8266, is reported
+	along with the time. The frames drawn with either font are compared.
+*/
+#include <Arduino.h>
+#include <vector>
+#include "frame_buffer.h"
+#include "layer.h"
+#include "fonts/font.h"
+#include "fonts/font_aa.h"
+#include "fonts/font_4x5.h"
+#include "fonts/font_5x5.h"
+#include "bench.h"
+
+#define STRINGIFY(x) STRINGIFY2(x)
+#define STRINGIFY2(x) #x
+
+// own copies of the glyph tables of font_aa.cpp
+#include "fonts/large_digits.inc"
+#include "fonts/bold_digits.inc"
+#include "fonts/week_names.inc"
+
+static constexpr int reps = 20;
+static constexpr int num_frames = 1000;
+static frame_buffer_t fb, ref, scratch;
+
+/**
+ * The former font_aa_t, which looked glyphs up by a binary search over
+ * the glyph array in PROGMEM
+ */
+class former_font_aa_t : public font_base_t
+{
+	const glyph_header_t & glyph_header;
+
+	const glyph_t * get_glyph(int32_t chr) const
+	{
+		int count = pgm_read_dword(&glyph_header.num_glyphs);
+
+		uint32_t s = 0;
+		uint32_t e = count;
+		const glyph_t * g = nullptr;
+
+		do
+		{
+			uint32_t m = (s+e)/2;
+			switch(e - s)
+			{
+			case 0:
+				// nothing found
+				return nullptr;
+
+			case 1:
+				// last one found
+				g = glyph_header.array + m;
+				if((int32_t)pgm_read_dword(&g->code_point) == chr)
+					return g; // found
+				return nullptr; // not found
+
+			default:
+				// do binary search
+				g = glyph_header.array + m;
+				int cp = pgm_read_dword(&g->code_point);
+				if(cp == chr)
+					return g; // found
+				if(cp < chr)
+					s = m;
+				else
+					e = m;
+			}
+		} while(1);
+	}
+
+public:
+	former_font_aa_t(const glyph_header_t & _glyph_header) : glyph_header(_glyph_header) {}
+
+	virtual int get_height() const { return pgm_read_dword(&glyph_header.nominal_height); }
+
+	virtual metrics_t get_metrics(int32_t chr) const
+	{
+		const glyph_t * g = get_glyph(chr);
+		metrics_t r;
+		if(g)
+		{
+			r.w = pgm_read_byte(&g->ascend_x);
+			r.h = pgm_read_byte(&g->h);
+			r.exist = true;
+			r.advance_64 = r.w * 64;
+		}
+		else
+		{
+			r.exist = false;
+		}
+		return r;
+	}
+
+	virtual void put(int32_t chr, int level, int x, int y, frame_buffer_t & fb, blit_mode_t mode) const
+	{
+		const glyph_t * g = get_glyph(chr);
+		if(!g) return;
+
+		int fx = 0, fy = 0;
+		int w = pgm_read_byte(&g->w), h = pgm_read_byte(&g->h);
+		int stride = w;
+
+		// clip font bounding box
+		if(!fb.clip(fx, fy, x, y, w, h)) return;
+
+		// draw the pattern
+		const unsigned char *p = g->bitmap;
+
+		for(int yy = y; yy < h+y; ++yy, ++fy)
+		{
+			const unsigned char * line = p + fy * stride;
+			uint8_t alpha[LED_MAX_LOGICAL_COL];
+			memcpy_P(alpha, line + fx, w);
+			fb.blend_row(x, yy, w, alpha, level, mode);
+		}
+	}
+};
+
+/**
+ * The former font_4x5_t, which mapped code points to glyphs by a switch.
+ * The glyphs are taken from font_4x5 itself by prepare(), by drawing them
+ * into a scratch buffer.
+ */
+class former_font_4x5_t : public font_base_t
+{
+	static constexpr int num_glyphs = 18;
+	uint8_t widths[num_glyphs]; //!< read by pgm_read_byte(), as the former PROGMEM table
+	uint8_t rows[num_glyphs][5]; //!< the leftmost pixel in bit 0; likewise
+
+	static int chr_to_index(int32_t chr)
+	{
+		switch(chr)
+		{
+		case '0' ... '9': return chr - '0';
+		case ' ': return 10;
+		case '.': return 11;
+		case ':': return 12;
+		case L'℃': return 13;
+		case 'h': return 14;
+		case '%': return 15;
+		case '-': return 16;
+		case '\'': return 17;
+		default:;
+		}
+		return -1;
+	}
+
+public:
+	void prepare()
+	{
+		static const int32_t chrs[num_glyphs] =
+			{ '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', ' ', '.', ':', L'℃', 'h', '%', '-', '\'' };
+		for(int i = 0; i < num_glyphs; ++i)
+		{
+			widths[i] = font_4x5.get_metrics(chrs[i]).w - 1;
+			scratch.reset_clip();
+			scratch.fill(0, 0, 8, 8, 0);
+			font_4x5.put(chrs[i], 255, 0, 0, scratch, BM_COPY);
+			for(int y = 0; y < 5; ++y)
+			{
+				rows[i][y] = 0;
+				for(int x = 0; x < 8; ++x)
+					if(scratch.get_point(x, y)) rows[i][y] |= 1 << x;
+			}
+		}
+	}
+
+	virtual int get_height() const { return font_4x5.get_height(); }
+
+	virtual metrics_t get_metrics(int32_t chr) const
+	{
+		int idx = chr_to_index(chr);
+		if(idx == -1) return metrics_t{0, 0, false, 0}; // not found
+		int w = pgm_read_byte(&widths[idx]) + 1;
+		return metrics_t{w, 6, true, w * 64};
+	}
+
+	virtual void put(int32_t chr, int level, int x, int y, frame_buffer_t & fb, blit_mode_t mode) const
+	{
+		int idx = chr_to_index(chr);
+		if(idx == -1) return; // not found
+
+		uint32_t r[5];
+		for(int i = 0; i < 5; ++i) r[i] = pgm_read_byte(&rows[idx][i]);
+		fb.draw_mask(x, y, pgm_read_byte(&widths[idx]), 5, r, level, mode);
+	}
+};
+
+static former_font_aa_t former_large_digits(LARGE_DIGITS);
+static former_font_aa_t former_bold_digits(BOLD_DIGITS);
+static former_font_aa_t former_week_names(WEEK_NAMES);
+static former_font_4x5_t former_4x5;
+
+//! Fonts the clock draws with
+struct clock_fonts_t
+{
+	const font_base_t & large_digits;
+	const font_base_t & bold_digits;
+	const font_base_t & week_names;
+	const font_base_t & small;
+};
+
+/**
+ * The face and seconds layers of screen_clock_t, with its update() and
+ * draw(), over the simulated time
+ */
+class clock_screen_t
+{
+	const clock_fonts_t & fonts;
+	int hour = 0, min = 0, sec = 0, wday = 0, mon = 0, mday = 1;
+	int temp_10 = 0, pressure = 1013, humidity = 40;
+	char face_key[100] = "";
+
+	compositor_t compositor;
+	layer_t face_layer;
+	layer_t seconds_layer;
+
+public:
+	clock_screen_t(const clock_fonts_t & _fonts) :
+		fonts(_fonts),
+		face_layer(std::bind(&clock_screen_t::draw_face, this, std::placeholders::_1),
+			0, 0, LED_MAX_LOGICAL_COL, 36, true),
+		seconds_layer(std::bind(&clock_screen_t::draw_seconds, this, std::placeholders::_1),
+			57, 13, 7, 5, false)
+	{
+		compositor.add(&face_layer);
+		compositor.add(&seconds_layer);
+	}
+
+	//! Set the time to the given second; the date and the sensors change every minute
+	void set_time(int t)
+	{
+		sec = t % 60;
+		min = t / 60 % 60;
+		hour = t / 3600 % 24;
+		wday = t / 86400 % 7;
+		mon = t / 60 % 12;
+		mday = t / 60 % 31 + 1;
+		temp_10 = t / 60 % 500 - 150;
+		pressure = 980 + t / 60 % 60;
+		humidity = 20 + t / 60 % 70;
+	}
+
+	//! Request to draw the face again, and to redraw the whole screen
+	void invalidate()
+	{
+		face_layer.invalidate();
+		compositor.invalidate();
+	}
+
+	void update(frame_buffer_damage_t & damage)
+	{
+		seconds_layer.invalidate();
+
+		// redraw the face only when its content changes
+		char key[100];
+		sprintf_P(key, PSTR("%d %d %d %d %d %d %d %d"),
+			hour, min, wday, mon, mday, temp_10, pressure, humidity);
+		if(strcmp(face_key, key))
+		{
+			strcpy(face_key, key);
+			face_layer.invalidate();
+		}
+
+		compositor.report_damage(damage);
+	}
+
+	void draw(frame_buffer_t & fb) { compositor.compose(fb); }
+
+private:
+	void draw_face(frame_buffer_t & fb)
+	{
+		// hours and minutes
+		char buf[20];
+		buf[0] = hour / 10 + '0';
+		buf[1] = 0;
+		fb.draw_text( 0, 0, 255, buf, fonts.large_digits);
+
+		buf[0] = hour % 10 + '0';
+		buf[1] = 0;
+		fb.draw_text(13, 0, 255, buf, fonts.large_digits);
+
+		buf[0] = min / 10 + '0';
+		buf[1] = 0;
+		fb.draw_text(29, 0, 255, buf, fonts.large_digits);
+
+		buf[0] = min % 10 + '0';
+		buf[1] = 0;
+		fb.draw_text(42, 0, 255, buf, fonts.large_digits);
+
+		fb.fill(27,  5, 2, 2, 255);
+		fb.fill(27, 12, 2, 2, 255);
+
+		buf[0] = wday + '0';
+		buf[1] = 0;
+		fb.draw_text(0, 19, 255, buf, fonts.week_names);
+
+		sprintf_P(buf, PSTR("%2d/%2d"), mon + 1, mday);
+		fb.draw_text(26, 19, 255, buf, fonts.bold_digits);
+
+		int temp = temp_10;
+		if(temp <= -100)
+		{
+			// under -10.0 deg C; ommit dot
+			sprintf_P(buf, PSTR("-%d"), (-temp + 5) / 10);
+		}
+		else if(temp < 0)
+		{
+			// -10.0 < temp < 0.0
+			sprintf_P(buf, PSTR("-%d.%d"), -temp / 10, -temp % 10);
+		}
+		else
+		{
+			// include dot
+			sprintf_P(buf, PSTR("%2d.%d"), temp/10, temp %10);
+		}
+		sprintf_P(buf + strlen(buf),
+			PSTR("℃ %4dh %2d%%"), pressure, humidity);
+		fb.draw_text(0, 28, 255, buf, fonts.small);
+	}
+
+	void draw_seconds(frame_buffer_t & fb)
+	{
+		char buf[7];
+		buf[0] = 0xE2; buf[1] = 0x82; buf[2] = sec / 10 + 0x80;
+		buf[3] = 0xE2; buf[4] = 0x82; buf[5] = sec % 10 + 0x80;
+		buf[6] = 0;
+		fb.draw_text(57, 13, 255, buf, font_5x5);
+	}
+};
+
+/**
+ * Draw a frame at time t as the screen manager does; returns the cost.
+ * The whole screen is redrawn if full.
+ */
+static uint64_t draw_frame(clock_screen_t & clock, frame_buffer_t & target, int t, bool full)
+{
+	frame_buffer_damage_t damage;
+	uint64_t start = bench_clock();
+	clock.set_time(t);
+	if(full) clock.invalidate();
+	clock.update(damage);
+	for(int i = 0; i < damage.get_count(); ++i)
+	{
+		const frame_buffer_damage_t::rect_t & r = damage.get(i);
+		target.set_clip(r.x, r.y, r.w, r.h);
+		target.fill(0);
+		clock.draw(target);
+	}
+	target.reset_clip();
+	return bench_clock() - start;
+}
+
+static const clock_fonts_t current_fonts = { font_large_digits, font_bold_digits, font_week_names, font_4x5 };
+static const clock_fonts_t former_fonts = { former_large_digits, former_bold_digits, former_week_names, former_4x5 };
+
+struct result_t
+{
+	uint64_t cycles; //!< sum of the best cost of each frame
+	uint32_t reads; //!< PROGMEM reads of all the frames
+};
+
+/**
+ * Run the frames with the former and the current fonts alternately, so
+ * that both see the same host load; the best cost of each frame is taken
+ */
+static void run(bool full, result_t & before, result_t & after)
+{
+	std::vector<uint64_t> best_before(num_frames, ~(uint64_t)0), best_after(num_frames, ~(uint64_t)0);
+	auto frames = [&](const clock_fonts_t & fonts, std::vector<uint64_t> & best, result_t & r) {
+		clock_screen_t clock(fonts);
+		fb.fill(0);
+		uint32_t reads = sim_progmem_reads;
+		for(int i = 0; i < num_frames; ++i)
+		{
+			uint64_t t = draw_frame(clock, fb, 43200 + i, full);
+			if(t < best[i]) best[i] = t;
+		}
+		r.reads = sim_progmem_reads - reads;
+	};
+	for(int rep = 0; rep < reps; ++rep)
+	{
+		frames(former_fonts, best_before, before);
+		frames(current_fonts, best_after, after);
+	}
+	before.cycles = after.cycles = 0;
+	for(int i = 0; i < num_frames; ++i)
+	{
+		before.cycles += best_before[i];
+		after.cycles += best_after[i];
+	}
+}
+
+int main()
+{
+	former_4x5.prepare();
+	printf("%s: %d frames from 12:00:00, each the best of %d runs\n",
+		STRINGIFY(FRAME_BUFFER_FORMAT), num_frames, reps);
+
+	int failures = 0;
+	for(int full = 0; full < 2; ++full)
+	{
+		result_t before, after;
+		run(full, before, after);
+		printf("  %s:\n", full ? "full redraw" : "once a second");
+		printf("    former lookup: %6.0f " BENCH_UNIT ", %6.1f PROGMEM reads per frame\n",
+			(double)before.cycles / num_frames, (double)before.reads / num_frames);
+		printf("    dense tables : %6.0f " BENCH_UNIT ", %6.1f PROGMEM reads per frame\n",
+			(double)after.cycles / num_frames, (double)after.reads / num_frames);
+
+		// compare the frames
+		clock_screen_t clock_before(former_fonts), clock_after(current_fonts);
+		fb.fill(0);
+		ref.fill(0);
+		for(int i = 0; i < num_frames; ++i)
+		{
+			draw_frame(clock_before, ref, 43200 + i, full);
+			draw_frame(clock_after, fb, 43200 + i, full);
+			for(int y = 0; y < LED_MAX_LOGICAL_ROW; ++y)
+				for(int x = 0; x < LED_MAX_LOGICAL_COL; ++x)
+					if(fb.get_point(x, y) != ref.get_point(x, y))
+					{
+						if(failures++ < 10)
+							fprintf(stderr, "FAIL: frame %d differs at (%d, %d)\n", i, x, y);
+						y = LED_MAX_LOGICAL_ROW;
+						break;
+					}
+		}
+	}
+	if(failures)
+	{
+		printf("FAILED: %d frames\n", failures);
+		return 1;
+	}
+	printf("  every frame matches the former lookup\n");
+	return 0;
+}
@@ -0,0 +1,244 @@
+/*
+	Glyph decoding benchmark of BFF fonts.
+
+	Decodes every glyph of a BFF font and reports the cost per pixel, of
+	the decoder alone and of loading the glyphs into the glyph cache. For
+	the run-length compression methods, the former three-pass decoder is
+	run over the same glyphs as a reference, alternately with the decoder
+	so that both see the same host load. It run-length decodes into
+	an 8bit buffer, then adds the previous row, then takes the running sum
+	and expands 7bit to 8bit. The reference reads the compressed data from
+	a copy of the file in RAM, which is cheaper than the flash cache the
+	decoder goes through. Every glyph in the cache is checked against the
+	reference, quantized to 4bpp as the glyph cache keeps it.
+
+	usage: decode_bench [FILE.bff]
+
+	The font is src/fonts/takaop.bff if not given. It is compressed by
+	XOR4, which the reference cannot decode; for a run-length compressed
+	copy, see tools/bffc:
+
+		bffc -m rle-auto -o /tmp/takaop-rle.bff src/fonts/takaop.bff
+*/
+#include <Arduino.h>
+#include <vector>
+#include "frame_buffer.h"
+#include "fonts/font_bff.h"
+#include "sim_hw.h"
+#include "bench.h"
+
+#define STRINGIFY(x) STRINGIFY2(x)
+#define STRINGIFY2(x) #x
+
+typedef bff_font_t::glyph_info_t glyph_info_t;
+
+static constexpr int reps = 40;
+static std::vector<uint8_t> file; //!< the font file
+static uint32_t btmp_offs; //!< offset of BTMP in the file
+static frame_buffer_t fb;
+
+static bool load_file(const char *name)
+{
+	FILE *f = fopen(name, "rb");
+	if(!f) return false;
+	fseek(f, 0, SEEK_END);
+	file.resize(ftell(f));
+	fseek(f, 0, SEEK_SET);
+	bool ok = fread(file.data(), 1, file.size(), f) == file.size();
+	fclose(f);
+	if(!ok || file.size() < 16) return false;
+
+	// find BTMP in the directory
+	uint32_t num_files;
+	memcpy(&num_files, file.data() + 12, 4);
+	for(uint32_t i = 0; i < num_files && 16 + (i + 1) * 16 <= file.size(); ++i)
+	{
+		const uint8_t *dir = file.data() + 16 + i * 16;
+		if(!memcmp(dir, "BTMP", 4)) { memcpy(&btmp_offs, dir + 8, 4); return true; }
+	}
+	return false;
+}
+
+static bool is_run_length(const glyph_info_t & info)
+{
+	uint32_t method = info.flags & bff_font_t::FLAGS_COMPRESSION_METHOD_MASK;
+	return method == bff_font_t::FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH_DIFF ||
+		method == bff_font_t::FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH;
+}
+
+/**
+ * The former decoder, with the heap buffers it used; returns the 8bit
+ * bitmap, to be deleted by the caller
+ */
+static uint8_t * reference_decode(const glyph_info_t & info)
+{
+	unsigned int bitmap_size = info.bb_w * info.bb_h;
+	uint8_t * bitmap = new uint8_t[bitmap_size]();
+	uint8_t * compressed_data = new uint8_t [info.compressed_size];
+	memcpy(compressed_data, file.data() + btmp_offs + info.bitmap_offset, info.compressed_size);
+
+	// process run-length
+	uint8_t * cd = compressed_data;
+	uint8_t * cd_limit = compressed_data + info.compressed_size;
+	uint8_t * ucd = bitmap;
+	uint8_t * ucd_limit = ucd + bitmap_size;
+	while(ucd < ucd_limit && cd < cd_limit)
+	{
+		uint8_t ccd = *(cd++);
+		if(ccd & 0x80)
+		{
+			*(ucd++) = ccd; // literal
+		}
+		else
+		{
+			uint8_t count = ccd & 0x3f;
+			uint8_t v = 0;
+			if(ccd & 0x40)
+			{
+				// non-zero running
+				if(cd >= cd_limit) break;
+				v = *(cd ++);
+			}
+			// fill
+			while(ucd < ucd_limit && count --)
+				*(ucd++) = v;
+		}
+	}
+
+	ucd = bitmap;
+	if((info.flags & bff_font_t::FLAGS_COMPRESSION_METHOD_MASK) ==
+		bff_font_t::FLAGS_COMPRESSION_METHOD_ZERO_RUNLENGTH_DIFF)
+	{
+		// process differentiation
+		for(unsigned int i = info.bb_w; i < bitmap_size; ++i)
+			ucd[i] += ucd[i - info.bb_w];
+
+		uint8_t prev = 0;
+		for(unsigned int i = 0; i < bitmap_size; ++i)
+		{
+			uint8_t v = (ucd[i] + prev) & 0x7f;
+			prev = v;
+			v = (v << 1) + (v >> 6); // 7bit grayscale to 8bit grayscale
+			ucd[i] = v;
+		}
+	}
+	else
+	{
+		for(unsigned int i = 0; i < bitmap_size; ++i)
+		{
+			uint8_t v = ucd[i] & 0x7f;
+			v = (v << 1) + (v >> 6); // 7bit grayscale to 8bit grayscale
+			ucd[i] = v;
+		}
+	}
+
+	delete [] compressed_data;
+	return bitmap;
+}
+
+//! Returns the level as stored in the frame buffer
+static int stored(int level)
+{
+	typedef frame_buffer_t::format_t format_t;
+	return format_t::to_level(format_t::from_level(level));
+}
+
+int main(int argc, char **argv)
+{
+	const char *name = argc > 1 ? argv[1] : SIM_FONT_FILE;
+	if(!load_file(name) || !sim_flash_load(name, BFF_FONT_FILE_START_ADDRESS))
+	{
+		printf("cannot load %s\n", name);
+		return 1;
+	}
+	font_bff.begin(BFF_FONT_FILE_START_ADDRESS);
+	if(!font_bff.get_available()) return 1;
+
+	// glyphs with bitmaps
+	std::vector<glyph_info_t> glyphs;
+	uint64_t pixels = 0, rle_pixels = 0;
+	for(uint32_t i = 0; ; ++i)
+	{
+		glyph_info_t info = font_bff.get_glyph_info_by_index(i);
+		if(info.code_point <= 0) break;
+		if(!info.bb_w || !info.bb_h || !info.compressed_size || !info.bitmap_offset ||
+			info.bb_w > bff_font_t::MAX_GLYPH_WIDTH) continue;
+		glyphs.push_back(info);
+		pixels += info.bb_w * info.bb_h;
+		if(is_run_length(info)) rle_pixels += info.bb_w * info.bb_h;
+	}
+	printf("%s: %s, %zu glyphs, %llu pixels, %llu pixels run-length compressed\n",
+		STRINGIFY(FRAME_BUFFER_FORMAT), name, glyphs.size(),
+		(unsigned long long)pixels, (unsigned long long)rle_pixels);
+
+	std::vector<uint8_t> bitmap(bff_font_t::MAX_GLYPH_WIDTH * 256);
+	auto decode = [&]() {
+		for(auto && info : glyphs)
+		{
+			font_bff.decode_bitmap(info, bitmap.data());
+			bench_keep(bitmap[0]);
+		}
+	};
+	uint64_t best, best_ref = 0;
+	if(rle_pixels)
+	{
+		// timed alternately with the reference, for a fair comparison on a noisy host
+		bench_best_pair(reps, decode, [&]() {
+			for(auto && info : glyphs)
+				if(is_run_length(info)) delete [] reference_decode(info);
+		}, best, best_ref);
+	}
+	else
+	{
+		best = bench_best(reps, decode);
+	}
+	printf("  decoder: %.2f " BENCH_UNIT " per pixel\n", (double)best / pixels);
+	if(rle_pixels)
+		printf("  former three-pass decoder: %.2f " BENCH_UNIT " per pixel\n", (double)best_ref / rle_pixels);
+
+	// load every glyph into the cache; begin() empties it
+	best = ~(uint64_t)0;
+	for(int rep = 0; rep < reps; ++rep)
+	{
+		font_bff.begin(BFF_FONT_FILE_START_ADDRESS);
+		uint64_t start = bench_clock();
+		for(auto && info : glyphs)
+		{
+			font_base_t::glyph_handle_t handle;
+			bench_keep(font_bff.find_glyph(info.code_point, handle));
+		}
+		uint64_t t = bench_clock() - start;
+		if(t < best) best = t;
+	}
+	printf("  glyph cache load, with the lookup and insertion: %.2f " BENCH_UNIT " per pixel\n",
+		(double)best / pixels);
+
+	if(!rle_pixels) return 0;
+
+	// check the glyphs
+	int failures = 0;
+	for(auto && info : glyphs)
+	{
+		if(!is_run_length(info) || info.bb_w > LED_MAX_LOGICAL_COL || info.bb_h > LED_MAX_LOGICAL_ROW)
+			continue;
+		font_base_t::glyph_handle_t handle;
+		font_bff.find_glyph(info.code_point, handle);
+		fb.fill(0);
+		font_bff.put_glyph(handle, 255, -info.bb_x, -info.bb_y, fb, BM_MAX);
+		uint8_t *ref = reference_decode(info);
+		int diff = 0;
+		for(int y = 0; y < info.bb_h; ++y)
+			for(int x = 0; x < info.bb_w; ++x)
+				if(fb.get_point(x, y) != stored((ref[y * info.bb_w + x] + 8) / 17 * 17)) ++ diff;
+		delete [] ref;
+		if(diff && failures++ < 10)
+			fprintf(stderr, "FAIL: U+%04X: %d pixels differ from the reference\n", info.code_point, diff);
+	}
+	if(failures)
+	{
+		printf("FAILED: %d glyphs\n", failures);
+		return 1;
+	}
+	printf("  every glyph matches the reference\n");
+	return 0;
+}
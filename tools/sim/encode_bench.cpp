@@ -0,0 +1,106 @@
+/*
+	Scanout encoder benchmark.
+
+	Compares the cost of filling the SPI FIFO for one frame, between the
+	former in-interrupt path, which looked up the gamma table and added
+	latch patterns for every word of every transaction, and the scanout
+	encoder, which encodes each row once (led_update_scanout()) so that
+	the interrupt only copies 16 words per transaction.
+
+	The former path is replicated here as it was in matrix_drive.cpp,
+	reading pixels through FORMAT::to_level() so that it runs on every
+	frame buffer format; it was 8bpp only.
+*/
+#include <Arduino.h>
+#include "frame_buffer.h"
+#include "matrix_drive.h"
+#include "matrix_encode.h"
+#include "bench.h"
+#include "sim_hw.h"
+
+#define STRINGIFY(x) STRINGIFY2(x)
+#define STRINGIFY2(x) #x
+
+static constexpr int rows = LED_MAX_ROW; //!< scan rows
+static constexpr int groups = 8; //!< SPI transactions per scan row
+static constexpr int words = 16; //!< FIFO words per transaction
+static constexpr int reps = 2000;
+
+static volatile uint32_t fifo[words]; //!< stands for SPI1W0..SPI1W15
+static uint32_t gamma_table[256];
+static uint32_t scanout[rows][groups][words]; //!< stands for led_scanout
+
+/**
+ * Former led_set_brightness_one_row(): 16 gamma lookups and latch adds
+ */
+static void former_one_row(int row, int start_led, bool do_global_latch)
+{
+	typedef frame_buffer_t::format_t format_t;
+	const frame_buffer_t::unit_t *buf = get_current_frame_buffer().array()[row*2];
+	const frame_buffer_t::unit_t *buf2 = get_current_frame_buffer().array()[row*2+1];
+	volatile uint32_t *fifoPtr = fifo;
+
+#define PL(I, B, L) do { \
+	uint32_t w = gamma_table[format_t::to_level(format_t::get(B, (I) + start_led))]; \
+	w += (L); *(fifoPtr++) = w; } while(0)
+	PL(0*8, buf, 0); PL(1*8, buf, 0); PL(2*8, buf, 0); PL(3*8, buf, 0);
+	PL(4*8, buf, 0); PL(5*8, buf, 0); PL(6*8, buf, 0); PL(7*8, buf, data_latch_pattern);
+	PL(0*8, buf2, 0); PL(1*8, buf2, 0); PL(2*8, buf2, 0); PL(3*8, buf2, 0);
+	PL(4*8, buf2, 0); PL(5*8, buf2, 0); PL(6*8, buf2, 0);
+	PL(7*8, buf2, do_global_latch ? global_latch_pattern : data_latch_pattern);
+#undef PL
+}
+
+static void former_frame()
+{
+	for(int row = 0; row < rows; ++row)
+		for(int g = 0; g < groups; ++g)
+			former_one_row(row, g, g == groups - 1);
+}
+
+/**
+ * Interrupt side of the scanout encoder: copy of pre-encoded words
+ */
+static void copy_frame()
+{
+	for(int row = 0; row < rows; ++row)
+		for(int g = 0; g < groups; ++g)
+		{
+			const uint32_t *src = scanout[row][g];
+			volatile uint32_t *fifoPtr = fifo;
+			for(int i = 0; i < words; ++i) *(fifoPtr++) = *(src++);
+		}
+}
+
+int main()
+{
+	static const led_gamma_params_t params = { 350, 20, 3800 };
+	for(int i = 0; i < 256; ++i)
+		gamma_table[i] = byte_reverse(bit_interleave(
+			gamma_curve(i, 255, params.black_offset, params.exponent_100, params.ceiling)));
+
+	frame_buffer_t & fb = get_current_frame_buffer();
+	uint32_t r = 1;
+	for(int y = 0; y < LED_MAX_LOGICAL_ROW; ++y)
+		for(int x = 0; x < LED_MAX_LOGICAL_COL; ++x)
+			r = r * 1103515245 + 12345, fb.set_point_deep(x, y, (r >> 8) & 4095);
+
+	// the scan interrupt is not started; led_update_scanout() encodes at once
+	led_set_gamma(params);
+	led_start_pwm_clock();
+
+	uint64_t former = bench_best(reps, former_frame);
+	uint64_t encode = bench_best(reps, [] { led_update_scanout(); });
+	uint64_t copy = bench_best(reps, copy_frame);
+
+	int calls = rows * groups;
+	printf("%s: %s per frame (per transaction), best of %d\n",
+		STRINGIFY(FRAME_BUFFER_FORMAT), BENCH_UNIT, reps);
+	printf("  former in-interrupt lookup:  %7llu (%5.1f)\n",
+		(unsigned long long)former, (double)former / calls);
+	printf("  scanout encode:              %7llu (%5.1f)\n",
+		(unsigned long long)encode, (double)encode / calls);
+	printf("  scanout copy in interrupt:   %7llu (%5.1f)\n",
+		(unsigned long long)copy, (double)copy / calls);
+	return 0;
+}
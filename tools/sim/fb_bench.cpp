@@ -0,0 +1,143 @@
+/*
+	Frame buffer kernel benchmark.
+
+	Compares fill(), the whole-buffer clear, blit() and blend_row() against
+	per-pixel loops like the former ones, which wrote one pixel at a time,
+	and checks that both give the same pixels. The former blend went
+	through get_point() and set_point() at 8bit levels, so its pixels are
+	only compared for the 8bit format; see blend_test for the others.
+*/
+#include <Arduino.h>
+#include "frame_buffer.h"
+#include "bench.h"
+
+#define STRINGIFY(x) STRINGIFY2(x)
+#define STRINGIFY2(x) #x
+
+typedef frame_buffer_t::format_t format_t;
+
+static constexpr int reps = 20000;
+static frame_buffer_t src, dst, ref;
+static int failures = 0;
+
+//! Former fill(): one pixel at a time in nested loops
+static void naive_fill(frame_buffer_t & fb, int x, int y, int w, int h, int level)
+{
+	frame_buffer_t::pixel_t v = format_t::from_level(level);
+	for(int yy = y; yy < y + h; ++yy)
+		for(int xx = x; xx < x + w; ++xx)
+			format_t::put(fb.array()[yy], xx, v);
+}
+
+//! Per-pixel copy or saturating add of a region, already clipped
+static void naive_blit(frame_buffer_t & d, const frame_buffer_t & s, int sx, int sy, int w, int h,
+	int dx, int dy, blit_mode_t mode)
+{
+	const uint32_t max = format_t::from_level(255);
+	for(int yy = 0; yy < h; ++yy)
+		for(int xx = 0; xx < w; ++xx)
+		{
+			uint32_t v = format_t::get(s.array()[sy + yy], sx + xx);
+			if(mode == BM_ADD)
+			{
+				v += format_t::get(d.array()[dy + yy], dx + xx);
+				if(v > max) v = max;
+			}
+			format_t::put(d.array()[dy + yy], dx + xx, v);
+		}
+}
+
+//! Former kind of blend: one pixel at a time through get_point() and set_point()
+static void naive_blend_row(frame_buffer_t & fb, int x, int y, int w, const uint8_t *alpha, int level)
+{
+	for(int i = 0; i < w; ++i)
+	{
+		uint32_t a = alpha[i];
+		fb.set_point(x + i, y, (level * a + fb.get_point(x + i, y) * (255 - a) + 127) / 255);
+	}
+}
+
+//! Alpha of a row of antialiased glyphs: clear, opaque and edge pixels
+static uint8_t glyph_alpha[LED_MAX_LOGICAL_COL];
+
+static void compare(const char *what)
+{
+	if(memcmp(dst.array(), ref.array(), sizeof(dst.array())))
+	{
+		fprintf(stderr, "FAIL: %s: result differs from per-pixel loop\n", what);
+		++ failures;
+	}
+}
+
+static void report(const char *what, uint64_t naive, uint64_t kernel)
+{
+	printf("  %-28s %7llu %7llu  x%.1f\n", what, (unsigned long long)naive,
+		(unsigned long long)kernel, (double)naive / kernel);
+}
+
+int main()
+{
+	uint32_t r = 1;
+	for(int y = 0; y < LED_MAX_LOGICAL_ROW; ++y)
+		for(int x = 0; x < LED_MAX_LOGICAL_COL; ++x)
+			r = r * 1103515245 + 12345, src.set_point(x, y, (r >> 8) & 255);
+
+	printf("%s: %s per call, best of %d\n", STRINGIFY(FRAME_BUFFER_FORMAT), BENCH_UNIT, reps);
+	printf("  %-28s %7s %7s\n", "", "naive", "kernel");
+
+	// whole-buffer clear, as done before every redraw
+	uint64_t n = bench_best(reps, [] { naive_fill(ref, 0, 0, LED_MAX_LOGICAL_COL, LED_MAX_LOGICAL_ROW, 0); bench_keep(ref); });
+	uint64_t k = bench_best(reps, [] { dst.fill(0); bench_keep(dst); });
+	compare("clear");
+	report("clear 64x48", n, k);
+
+	// unaligned rectangle
+	n = bench_best(reps, [] { naive_fill(ref, 3, 5, 37, 20, 200); bench_keep(ref); });
+	k = bench_best(reps, [] { dst.fill(3, 5, 37, 20, 200); bench_keep(dst); });
+	compare("fill");
+	report("fill 37x20 at (3,5)", n, k);
+
+	// full-width band, such as the marquee area
+	n = bench_best(reps, [] { naive_fill(ref, 0, 36, 64, 12, 0); bench_keep(ref); });
+	k = bench_best(reps, [] { dst.fill(0, 36, 64, 12, 0); bench_keep(dst); });
+	compare("fill band");
+	report("fill 64x12 band", n, k);
+
+	// copy at the same alignment, and at different alignment
+	n = bench_best(reps, [] { naive_blit(ref, src, 4, 2, 48, 30, 8, 10, BM_COPY); bench_keep(ref); });
+	k = bench_best(reps, [] { dst.blit(src, 4, 2, 48, 30, 8, 10); bench_keep(dst); });
+	compare("blit aligned");
+	report("blit copy 48x30 aligned", n, k);
+
+	n = bench_best(reps, [] { naive_blit(ref, src, 1, 2, 48, 30, 6, 10, BM_COPY); bench_keep(ref); });
+	k = bench_best(reps, [] { dst.blit(src, 1, 2, 48, 30, 6, 10); bench_keep(dst); });
+	compare("blit unaligned");
+	report("blit copy 48x30 unaligned", n, k);
+
+	// saturating add; reset both first, since the result accumulates
+	naive_fill(ref, 0, 0, 64, 48, 100);
+	dst.fill(100);
+	naive_blit(ref, src, 0, 0, 64, 48, 0, 0, BM_ADD);
+	dst.blit(src, 0, 0, 64, 48, 0, 0, BM_ADD);
+	compare("blit add");
+	n = bench_best(reps, [] { naive_blit(ref, src, 0, 0, 64, 48, 0, 0, BM_ADD); bench_keep(ref); });
+	k = bench_best(reps, [] { dst.blit(src, 0, 0, 64, 48, 0, 0, BM_ADD); bench_keep(dst); });
+	report("blit add 64x48", n, k);
+
+	// a row of glyphs over the background, every row of the buffer
+	for(int i = 0; i < LED_MAX_LOGICAL_COL; ++i)
+		glyph_alpha[i] = (i % 7 < 2) ? 0 : (i % 7 == 2 || i % 7 == 6) ? i * 37 & 255 : 255;
+	ref = src;
+	dst = src;
+	n = bench_best(reps / 10, [] {
+		for(int y = 0; y < LED_MAX_LOGICAL_ROW; ++y) naive_blend_row(ref, 0, y, 64, glyph_alpha, 200);
+		bench_keep(ref); });
+	k = bench_best(reps / 10, [] {
+		for(int y = 0; y < LED_MAX_LOGICAL_ROW; ++y) dst.blend_row(0, y, 64, glyph_alpha, 200, BM_OVER);
+		bench_keep(dst); });
+	if(sizeof(format_t::pixel_t) == 1 && format_t::pixels_per_unit == 1) compare("blend over");
+	report("blend over 64x48", n, k);
+
+	if(failures) { printf("FAILED: %d checks\n", failures); return 1; }
+	return 0;
+}
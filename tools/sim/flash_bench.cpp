@@ -0,0 +1,99 @@
+/*
+	Flash read benchmark of BFF fonts.
+
+	Draws marquee strings with takaop.bff loaded as the flash image, and
+	counts ESP.flashRead() calls, bytes and calls violating its alignment
+	requirement, with the in-RAM code point index and with the search on
+	flash the font falls back to when the index does not fit in the heap;
+	the font is also begun without room for the glyph cache, when it has to
+	stay unavailable.
+	The strings are drawn twice; the first pass starts with empty caches,
+	and the glyph cache then holds all of the glyphs. Then every code point
+	of the BMP, U+0000 to U+FFFF, is looked up by get_glyph_info(), and the
+	time and flash reads per lookup are reported along with the heap taken
+	by the index. The flash cache geometry is given by
+	BFF_FLASH_CACHE_BLOCKS and BFF_FLASH_CACHE_BLOCK_SIZE; build with, for
+	example, make clean bench CXX="g++ -DBFF_FLASH_CACHE_BLOCKS=16".
+*/
+#include <Arduino.h>
+#include "frame_buffer.h"
+#include "fonts/font_bff.h"
+#include "sim_hw.h"
+#include "bench.h"
+
+static const char * const strings[] = {
+	"2026年10月16日(金) 東京 晴れ 最高気温 22℃ 最低気温 14℃ 降水確率 10%",
+	"Temperature 23.4C  Humidity 45%  Pressure 1013hPa",
+	"本日は晴天なり。明日は曇りのち雨、所により雷を伴うでしょう。",
+	"WiFi: 接続しました IP 192.168.0.10",
+	"ドットマトリクス時計 ファームウェア更新のお知らせ",
+	"東京都千代田区 天気予報 週間 月火水木金土日",
+};
+
+static frame_buffer_t fb;
+
+static void run(const char *name)
+{
+	sim_stat = sim_stat_t();
+	font_bff.begin(BFF_FONT_FILE_START_ADDRESS);
+	printf("%s: begin: %u flash reads, %u unaligned\n", name,
+		sim_stat.flash_reads, sim_stat.flash_unaligned);
+
+	static const char * const passes[] = { "empty glyph cache", "glyphs cached" };
+	for(auto pass : passes)
+	{
+		sim_stat = sim_stat_t();
+		uint32_t hits = font_bff.get_flash_cache_hits();
+		uint32_t misses = font_bff.get_flash_cache_misses();
+		for(auto s : strings)
+		{
+			fb.get_text_width(s, font_bff);
+			fb.draw_text(0, 36, 255, s, font_bff);
+		}
+		printf("%s: %s: %u flash reads, %llu bytes, %u unaligned; "
+			"flash cache %u hits, %u misses\n", name, pass,
+			sim_stat.flash_reads, (unsigned long long)sim_stat.flash_bytes, sim_stat.flash_unaligned,
+			font_bff.get_flash_cache_hits() - hits, font_bff.get_flash_cache_misses() - misses);
+	}
+
+	// look every code point up
+	static constexpr uint32_t num_code_points = 0x10000;
+	uint32_t found = 0;
+	sim_stat = sim_stat_t();
+	uint64_t best = bench_best(5, [&]() {
+		found = 0;
+		for(uint32_t cp = 0; cp < num_code_points; ++cp)
+			if(font_bff.get_glyph_info(cp).code_point) ++ found;
+	});
+	printf("%s: lookup of U+0000 to U+FFFF (%u found): %.0f " BENCH_UNIT ", %.2f flash reads per code point; "
+		"index takes %u bytes of heap\n", name, found, (double)best / num_code_points,
+		(double)sim_stat.flash_reads / 5 / num_code_points, font_bff.get_index_memory_size());
+	font_bff.disable();
+}
+
+int main()
+{
+	if(!sim_flash_load(SIM_FONT_FILE, BFF_FONT_FILE_START_ADDRESS))
+	{
+		printf("cannot load %s\n", SIM_FONT_FILE);
+		return 1;
+	}
+	printf("%u x %u byte flash cache blocks\n",
+		flash_linear_file_t::num_blocks, flash_linear_file_t::block_size);
+
+	// leave no room for the glyph cache; the font is to be unavailable
+	uint32_t heap_size = sim_heap_size;
+	sim_heap_size -= ESP.getFreeHeap() - 1024;
+	font_bff.begin(BFF_FONT_FILE_START_ADDRESS);
+	printf("no glyph cache: font %s\n", font_bff.get_available() ? "available" : "unavailable");
+	if(font_bff.get_available()) return 1;
+	fb.draw_text(0, 36, 255, strings[0], font_bff);
+
+	// leave room for the glyph cache but not for the index
+	sim_heap_size += bff_glyph_cache_t::memory_size;
+	run("search on flash");
+	sim_heap_size = heap_size;
+
+	run("index");
+	return 0;
+}
@@ -0,0 +1,103 @@
+/*
+	Frame buffer flip test.
+
+	Checks that frame_buffer_flip() and frame_buffer_vsync() only pass
+	ownership of the buffers around: the buffer drawn on is shown at its
+	own address, and no buffer content changes across a flip, so that no
+	byte is copied. Runs both before the scan interrupt is started, when
+	the flip is done at once, and while it is running, when the flip
+	waits for vsync.
+*/
+#include <Arduino.h>
+#include <vector>
+#include "frame_buffer.h"
+#include "matrix_drive.h"
+#include "sim_hw.h"
+
+#define STRINGIFY(x) STRINGIFY2(x)
+#define STRINGIFY2(x) #x
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if(!(cond)) { \
+	fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+	fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); ++ failures; } } while(0)
+
+typedef std::vector<uint8_t> snapshot_t;
+
+//! Returns the content of all buffers
+static snapshot_t snapshot()
+{
+	snapshot_t s;
+	for(int i = 0; i < FRAME_BUFFER_COUNT; ++i)
+	{
+		const uint8_t *p = reinterpret_cast<const uint8_t *>(buffers[i].array());
+		s.insert(s.end(), p, p + sizeof(buffers[i].array()));
+	}
+	return s;
+}
+
+//! Wait until the last flip is shown
+static void wait_shown(uint32_t seq)
+{
+	while(frame_buffer_get_flip_seq() != seq)
+	{
+		led_encode_behind_beam(); // the main loop
+		sim_run_interrupt();
+	}
+}
+
+/**
+ * Draw a distinct image into the background buffer, flip it, and check
+ * that it is shown as is; n flips are queued before waiting, so that
+ * with three buffers the ready one is replaced.
+ */
+static void flip_and_check(int level, int n, const char *what)
+{
+	const frame_buffer_t *bg = nullptr;
+	uint32_t seq = 0;
+	for(int i = 0; i < n; ++i)
+	{
+		frame_buffer_t & fb = get_bg_frame_buffer();
+		bg = &fb;
+		fb.fill(level + i);
+		fb.set_point(level & 63, i, 255 - level); // rows differ from a plain fill
+
+		snapshot_t before = snapshot();
+		seq = frame_buffer_flip();
+		CHECK(snapshot() == before, "%s: buffer content changed by flip", what);
+	}
+
+	snapshot_t before = snapshot();
+	wait_shown(seq);
+	CHECK(snapshot() == before, "%s: buffer content changed by vsync", what);
+	CHECK(&get_current_frame_buffer() == bg, "%s: shown buffer is not the one drawn on", what);
+
+	// the buffer now drawn on is another one, left as it was
+	frame_buffer_t & next = get_bg_frame_buffer();
+	CHECK(&next != bg, "%s: background buffer is the shown one", what);
+	CHECK(snapshot() == before, "%s: buffer content changed by getting background", what);
+}
+
+int main()
+{
+	// before the scan interrupt starts; the flip is done at once
+	for(int i = 0; i < 8; ++i)
+		flip_and_check(i * 16, 1, "flip without scan");
+
+	led_init();
+	for(int i = 0; i < 16; ++i)
+		flip_and_check(i * 8, 1, "flip");
+	for(int i = 0; i < 16; ++i)
+		flip_and_check(i * 8, FRAME_BUFFER_COUNT == 3 ? 3 : 1, "flip queued");
+
+	CHECK(sim_errors == 0, "%u hardware protocol violations", sim_errors);
+
+	const frame_buffer_stat_t & stat = frame_buffer_get_stat();
+	printf("%s, %d buffers: %u flips, %u dropped\n",
+		STRINGIFY(FRAME_BUFFER_FORMAT), FRAME_BUFFER_COUNT, stat.flip_count, stat.dropped_count);
+
+	if(failures) { printf("FAILED: %d checks\n", failures); return 1; }
+	printf("OK\n");
+	return 0;
+}
@@ -0,0 +1,87 @@
+/*
+	Glyph cache benchmark of BFF fonts.
+
+	With takaop.bff loaded as the flash image, reports how many kanji fit
+	in the glyph cache before the first eviction, then scrolls a Japanese
+	date, weather and news marquee through the screen as a text run, as
+	the clock does, and reports the glyph cache statistics, the flash
+	reads and the cost per frame. The cache size is given by
+	BFF_GLYPH_CACHE_BYTES and BFF_GLYPH_CACHE_ENTRIES; build with, for
+	example, make clean bench CXX="g++ -DBFF_GLYPH_CACHE_BYTES=16384".
+*/
+#include <Arduino.h>
+#include "frame_buffer.h"
+#include "text_run.h"
+#include "fonts/font_bff.h"
+#include "sim_hw.h"
+#include "bench.h"
+
+#define STRINGIFY(x) STRINGIFY2(x)
+#define STRINGIFY2(x) #x
+
+static const char marquee[] =
+	"2026年10月16日(金) 東京都 晴れのち曇り 最高気温22℃ 最低気温14℃ 降水確率 午前10% 午後30% "
+	"北東の風 やや強く 海上では波が高いでしょう。 明日は低気圧の接近に伴い、広い範囲で雨となる見込みです。 "
+	"交通情報：首都高速道路 都心環状線 内回り 渋滞3km。 本日も一日お疲れさまでした。";
+
+static frame_buffer_t fb;
+
+static void print_stats(const char *what)
+{
+	const bff_glyph_cache_t::stats_t & s = font_bff.get_glyph_cache_stats();
+	printf("  %s: %u hits, %u misses, %u evictions, %u compactions; "
+		"arena %u/%u bytes, %u/%u entries\n", what,
+		s.hits, s.misses, s.evictions, s.compactions,
+		s.arena_used, bff_glyph_cache_t::arena_size, s.entries_used, bff_glyph_cache_t::num_entries);
+}
+
+int main()
+{
+	if(!sim_flash_load(SIM_FONT_FILE, BFF_FONT_FILE_START_ADDRESS))
+	{
+		printf("cannot load %s\n", SIM_FONT_FILE);
+		return 1;
+	}
+	font_bff.begin(BFF_FONT_FILE_START_ADDRESS);
+	printf("%s, glyph cache of %u bytes and %u entries (entry table %u bytes)\n",
+		STRINGIFY(FRAME_BUFFER_FORMAT), bff_glyph_cache_t::arena_size, bff_glyph_cache_t::num_entries,
+		(unsigned)(sizeof(bff_glyph_cache_t::entry_t) * bff_glyph_cache_t::num_entries));
+
+	// capacity: load kanji in code point order until the first eviction
+	int kanji = 0;
+	for(uint32_t i = 0; ; ++i)
+	{
+		int32_t c = font_bff.get_glyph_info_by_index(i).code_point;
+		if(c < 0x4e00) continue;
+		font_base_t::glyph_handle_t handle;
+		font_bff.find_glyph(c, handle);
+		if(font_bff.get_glyph_cache_stats().evictions) break;
+		++ kanji;
+	}
+	printf("  kanji resident: %d\n", kanji);
+	print_stats("after loading kanji");
+
+	// scroll the marquee through the screen, one px per frame
+	font_bff.begin(BFF_FONT_FILE_START_ADDRESS);
+	sim_stat = sim_stat_t();
+	text_run_t run(marquee, font_bff);
+	int frames = 0;
+	auto scroll = [&]() {
+		for(int x = LED_MAX_LOGICAL_COL; x > -run.get_width(); --x, ++frames)
+		{
+			fb.fill(0, 36, LED_MAX_LOGICAL_COL, 12, 0);
+			run.draw(fb, x, 36, 255);
+		}
+	};
+	scroll();
+	printf("  marquee of %d glyphs, %d px: %d frames\n", run.get_count(), run.get_width(), frames);
+	printf("  text run and first scroll: %u flash reads\n", sim_stat.flash_reads);
+
+	sim_stat = sim_stat_t();
+	frames = 0;
+	uint64_t best = bench_best(20, scroll);
+	printf("  next 20 scrolls: %.1f flash reads per scroll; best %.0f " BENCH_UNIT " per frame\n",
+		sim_stat.flash_reads / 20.0, (double)best * 20 / frames);
+	print_stats("after scrolling");
+	return 0;
+}
@@ -0,0 +1,174 @@
+/*
+	Layer compositor test.
+
+	Checks that retained layers, whose surface is only the layer size,
+	composite the same as drawing their content into a whole frame buffer
+	and blitting it, that direct layers are clipped to their rectangle,
+	and that pixels outside the clip rectangle are left as they were.
+	Retained layers are also made with no heap for the surface, when they
+	have to be drawn as direct layers.
+*/
+#include <Arduino.h>
+#include "frame_buffer.h"
+#include "layer.h"
+#include "sim_hw.h"
+
+#define STRINGIFY(x) STRINGIFY2(x)
+#define STRINGIFY2(x) #x
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if(!(cond)) { \
+	fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+	fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); ++ failures; } } while(0)
+
+static uint32_t rnd_state = 1;
+static uint32_t rnd() { rnd_state = rnd_state * 1103515245 + 12345; return rnd_state >> 8; }
+
+static int count_diff(const frame_buffer_t & a, const frame_buffer_t & b)
+{
+	int n = 0;
+	for(int y = 0; y < LED_MAX_LOGICAL_ROW; ++y)
+		for(int x = 0; x < LED_MAX_LOGICAL_COL; ++x)
+			if(a.get_point_deep(x, y) != b.get_point_deep(x, y)) ++ n;
+	return n;
+}
+
+//! Content drawn over the whole frame with the clipped primitives, to see
+//! clipping; depends on seed only
+static void draw_pattern(frame_buffer_t & fb, uint32_t seed)
+{
+	for(int ty = -4; ty < LED_MAX_LOGICAL_ROW; ty += 9)
+		for(int tx = -5; tx < LED_MAX_LOGICAL_COL; tx += 19)
+		{
+			uint32_t rows[9];
+			for(int r = 0; r < 9; ++r)
+				rows[r] = (tx * 7 + ty * 13 + r * 0x9e3779b9u + seed * 0x85ebca6bu) * 0xc2b2ae35u;
+			fb.draw_mask(tx, ty, 19, 9, rows, (tx * 31 + ty * 17 + seed * 41) & 255, BM_MAX);
+		}
+	fb.fill(-7, 20 + (int)seed, 80, 3, 60 + seed * 20);
+}
+
+static frame_buffer_t fb, ref, tmp;
+
+/**
+ * Reference composition: each layer drawn into a whole frame buffer
+ * clipped to the layer rectangle, then blitted onto the target
+ */
+static void reference_layer(uint32_t seed, int x, int y, int w, int h, blit_mode_t mode, int opacity,
+	bool retained, int cx, int cy, int cw, int ch)
+{
+	if(!retained)
+	{
+		// drawn straight, within the layer rectangle and the clip rectangle
+		ref.set_clip(cx, cy, cw, ch);
+		int fx = 0, fy = 0;
+		if(ref.clip(fx, fy, x, y, w, h) && w > 0 && h > 0)
+		{
+			ref.set_clip(x, y, w, h);
+			draw_pattern(ref, seed);
+		}
+		ref.reset_clip();
+		return;
+	}
+	tmp.reset_clip();
+	tmp.fill(0);
+	tmp.set_clip(x, y, w, h);
+	draw_pattern(tmp, seed);
+	tmp.reset_clip();
+	ref.set_clip(cx, cy, cw, ch);
+	ref.blit(tmp, x, y, w, h, x, y, mode, opacity);
+	ref.reset_clip();
+}
+
+struct layer_spec_t
+{
+	int x, y, w, h;
+	bool retained;
+	blit_mode_t mode;
+	int opacity;
+	uint32_t seed;
+};
+
+static void test_compose(const layer_spec_t *specs, int n, int cx, int cy, int cw, int ch,
+	bool heap = true)
+{
+	// background outside the clip must be left as is
+	for(int y = 0; y < LED_MAX_LOGICAL_ROW; ++y)
+		for(int x = 0; x < LED_MAX_LOGICAL_COL; ++x)
+			fb.set_point(x, y, rnd() & 255);
+	fb.set_clip(cx, cy, cw, ch);
+	fb.fill(0);
+	fb.reset_clip();
+	ref.blit(fb, 0, 0, LED_MAX_LOGICAL_COL, LED_MAX_LOGICAL_ROW, 0, 0);
+
+	compositor_t compositor;
+	layer_t *layers[8];
+	for(int i = 0; i < n; ++i)
+	{
+		const layer_spec_t & s = specs[i];
+		uint32_t seed = s.seed;
+		uint32_t heap_size = sim_heap_size;
+		if(!heap) sim_heap_size -= ESP.getFreeHeap() - sizeof(layer_t); // room for the layer only
+		layers[i] = new layer_t([seed](frame_buffer_t & f) { draw_pattern(f, seed); },
+			s.x, s.y, s.w, s.h, s.retained);
+		sim_heap_size = heap_size;
+		bool retained = s.retained && heap;
+		CHECK(layers[i]->get_retained() == retained, "layer %d is %s", i,
+			retained ? "not retained" : "retained");
+		layers[i]->set_mode(s.mode);
+		layers[i]->set_opacity(s.opacity);
+		compositor.add(layers[i]);
+		reference_layer(s.seed, s.x, s.y, s.w, s.h, s.mode, s.opacity, retained, cx, cy, cw, ch);
+	}
+
+	fb.set_clip(cx, cy, cw, ch);
+	compositor.compose(fb);
+	int fx, fy, fw, fh;
+	fb.get_clip(fx, fy, fw, fh);
+	fb.reset_clip();
+	CHECK(fx == cx && fy == cy && fw == cw && fh == ch, "clip rectangle is not restored");
+	CHECK(count_diff(fb, ref) == 0, "clip (%d,%d,%d,%d): %d pixels differ from reference",
+		cx, cy, cw, ch, count_diff(fb, ref));
+
+	for(int i = 0; i < n; ++i) delete layers[i];
+}
+
+int main()
+{
+	// the clock screen: retained face, direct seconds and marquee
+	static const layer_spec_t clock[] = {
+		{ 0, 0, 64, 36, true, BM_MAX, 255, 1 },
+		{ 57, 13, 7, 5, false, BM_MAX, 255, 2 },
+		{ 0, 36, 64, 12, false, BM_MAX, 255, 3 },
+	};
+	test_compose(clock, 3, 0, 0, 64, 48);
+	test_compose(clock, 3, 50, 10, 14, 10); // damage around the seconds
+	test_compose(clock, 3, 0, 30, 64, 18); // damage over the face and the marquee
+
+	// retained layers at odd positions, partly outside the frame, blended
+	static const layer_spec_t odd[] = {
+		{ -3, -2, 21, 17, true, BM_COPY, 255, 4 },
+		{ 13, 9, 33, 21, true, BM_ADD, 160, 5 },
+		{ 51, 40, 20, 15, true, BM_OVER, 90, 6 },
+		{ 5, 5, 9, 50, false, BM_MAX, 255, 7 },
+		{ 27, 3, 11, 7, true, BM_MAX, 255, 8 },
+	};
+	test_compose(odd, 5, 0, 0, 64, 48);
+	test_compose(odd, 5, 7, 3, 31, 29);
+	test_compose(odd, 5, 1, 1, 1, 1);
+
+	// no heap for the surfaces; drawn directly
+	test_compose(clock, 3, 0, 0, 64, 48, false);
+	test_compose(odd, 5, 7, 3, 31, 29, false);
+
+	printf("%s: layer surface of 64x36 takes %zu bytes, a frame buffer %zu\n",
+		STRINGIFY(FRAME_BUFFER_FORMAT),
+		sizeof(frame_buffer_t::unit_t) * ((64 + frame_buffer_t::format_t::pixels_per_unit - 1) /
+			frame_buffer_t::format_t::pixels_per_unit) * 36,
+		sizeof(frame_buffer_t::array_t));
+
+	if(failures) { printf("FAILED: %d checks\n", failures); return 1; }
+	printf("OK\n");
+	return 0;
+}
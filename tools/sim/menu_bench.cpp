@@ -0,0 +1,170 @@
+/*
+	Menu page benchmark of the 1bpp fonts.
+
+	Draws a page of screen_menu_t, as its draw() does: the title and six
+	items of font_5x5 text through text runs, the title line and the
+	cursor. The fonts are compared with the former way of drawing their
+	glyphs, which tested one bit per pixel and blended each row through
+	an alpha array. Every glyph of font_4x5 and font_5x5 is also drawn
+	both ways in all the modes, at random positions and clip rectangles
+	over random content, and the frame buffers are compared.
+*/
+#include <Arduino.h>
+#include <vector>
+#include "frame_buffer.h"
+#include "text_run.h"
+#include "fonts/font_4x5.h"
+#include "fonts/font_5x5.h"
+#include "bench.h"
+
+#define STRINGIFY(x) STRINGIFY2(x)
+#define STRINGIFY2(x) #x
+
+static constexpr int reps = 1000;
+static frame_buffer_t fb, ref, scratch;
+
+static uint32_t rnd_state = 12345;
+static uint32_t rnd() { rnd_state = rnd_state * 1103515245 + 12345; return rnd_state >> 8; }
+
+/**
+ * The former glyph drawing of a 1bpp font, which tested one bit per pixel
+ * and blended each row through an alpha array. The rows of the glyphs are
+ * taken from the font itself by prepare(), by drawing them into a scratch
+ * buffer.
+ */
+class former_font_t : public font_base_t
+{
+	const font_base_t & font;
+	int width_adjust; //!< glyph width less the advance; 0 for the fixed width of 5
+	int32_t blank; //!< code point the former font had no pattern for, and so did not draw
+	static constexpr int32_t last = 0x2200; //!< code points below this are taken
+	std::vector<uint8_t> rows; //!< 5 rows per code point; the leftmost pixel in bit 0
+
+public:
+	former_font_t(const font_base_t & _font, int _width_adjust, int32_t _blank) :
+		font(_font), width_adjust(_width_adjust), blank(_blank) {}
+
+	void prepare()
+	{
+		rows.assign(last * 5, 0);
+		for(int32_t chr = 0; chr < last; ++chr)
+		{
+			if(!font.get_metrics(chr).exist) continue;
+			scratch.reset_clip();
+			scratch.fill(0, 0, 8, 8, 0);
+			font.put(chr, 255, 0, 0, scratch, BM_COPY);
+			for(int y = 0; y < 5; ++y)
+				for(int x = 0; x < 8; ++x)
+					if(scratch.get_point(x, y)) rows[chr * 5 + y] |= 1 << x;
+		}
+	}
+
+	virtual int get_height() const { return font.get_height(); }
+	virtual metrics_t get_metrics(int32_t chr) const { return font.get_metrics(chr); }
+
+	virtual void put(int32_t chr, int level, int x, int y, frame_buffer_t & fb, blit_mode_t mode) const
+	{
+		metrics_t m = font.get_metrics(chr);
+		if(!m.exist || chr >= last || chr == blank) return;
+		int fx = 0, fy = 0;
+		int w = width_adjust ? m.w + width_adjust : 5, h = 5;
+
+		// clip font bounding box
+		if(!fb.clip(fx, fy, x, y, w, h)) return;
+
+		const uint8_t *p = rows.data() + chr * 5;
+		for(int yy = y; yy < h+y; ++yy, ++fy)
+		{
+			unsigned char line = p[fy];
+			uint8_t alpha[8];
+			for(int i = 0; i < w; ++i)
+				alpha[i] = (line & (1 << (fx + i))) ? 255 : 0;
+			fb.blend_row(x, yy, w, alpha, level, mode);
+		}
+	}
+};
+
+static former_font_t former_4x5(font_4x5, -1, -1), former_5x5(font_5x5, 0, 0x20);
+
+//! Code points of the glyphs of the fonts
+static std::vector<int32_t> code_points(const font_base_t & font)
+{
+	std::vector<int32_t> r;
+	for(int32_t c = 0x20; c < 0x2200; ++c)
+		if(font.get_metrics(c).exist) r.push_back(c);
+	return r;
+}
+
+static int check(const font_base_t & font, const font_base_t & former)
+{
+	int failures = 0;
+	for(int32_t c : code_points(font))
+		for(int mode = BM_COPY; mode <= BM_OVER; ++mode)
+			for(int k = 0; k < 20; ++k)
+			{
+				fb.reset_clip();
+				for(int y = 0; y < LED_MAX_LOGICAL_ROW; ++y)
+					for(int x = 0; x < LED_MAX_LOGICAL_COL; ++x)
+						fb.set_point(x, y, rnd() & 255);
+				if(k & 1) fb.set_clip(rnd() % 64 - 8, rnd() % 48 - 8, rnd() % 64, rnd() % 48);
+				ref = fb;
+				int x = (int)(rnd() % 76) - 6, y = (int)(rnd() % 58) - 6, level = rnd() & 255;
+				fb.draw_char(x, y, level, c, font, (blit_mode_t)mode);
+				ref.draw_char(x, y, level, c, former, (blit_mode_t)mode);
+				if(memcmp(fb.array(), ref.array(), sizeof(fb.array())) && failures++ < 10)
+					fprintf(stderr, "FAIL: U+%04X, mode %d: differs from the former drawing\n", c, mode);
+			}
+	return failures;
+}
+
+//! Returns best cost of a menu page, and of its text only
+static void bench_page(const font_base_t & font, uint64_t & page, uint64_t & text, int & glyphs)
+{
+	static const char * const items[] = { "Wi-Fi settings", "Time zone", "NTP server",
+		"Brightness", "Marquee text", "Firmware update" };
+	text_run_t title_run("Settings", font);
+	std::vector<text_run_t> item_runs;
+	for(auto s : items) item_runs.emplace_back(s, font);
+	glyphs = title_run.get_count();
+	for(auto && r : item_runs) glyphs += r.get_count();
+
+	// see screen_menu_t::draw() in ui.cpp
+	fb.reset_clip();
+	int n = 0;
+	page = bench_best(reps, [&]() {
+		fb.fill(0);
+		title_run.draw(fb, 0, 0, 255);
+		fb.fill(0, 7, LED_MAX_LOGICAL_COL, 1, 128);
+		fb.fill(1, (n++ % 6) * 6 + 8, LED_MAX_LOGICAL_COL - 1, 5, 128);
+		for(int i = 0; i < 6; ++i) item_runs[i].draw(fb, 1, i * 6 + 8, 255, BM_OVER, 0);
+	});
+	text = bench_best(reps, [&]() {
+		title_run.draw(fb, 0, 0, 255);
+		for(int i = 0; i < 6; ++i) item_runs[i].draw(fb, 1, i * 6 + 8, 255, BM_OVER, 0);
+	});
+}
+
+int main()
+{
+	former_4x5.prepare();
+	former_5x5.prepare();
+	int failures = check(font_4x5, former_4x5) + check(font_5x5, former_5x5);
+
+	uint64_t page, text, former_page, former_text;
+	int glyphs;
+	bench_page(former_5x5, former_page, former_text, glyphs);
+	bench_page(font_5x5, page, text, glyphs);
+	printf("%s: menu page of %d glyphs, in " BENCH_UNIT "\n", STRINGIFY(FRAME_BUFFER_FORMAT), glyphs);
+	printf("                      former     now\n");
+	printf("  glyphs, per glyph  %7.1f %7.1f\n", (double)former_text / glyphs, (double)text / glyphs);
+	printf("  whole page         %7llu %7llu\n",
+		(unsigned long long)former_page, (unsigned long long)page);
+
+	if(failures)
+	{
+		printf("FAILED: %d glyph draws\n", failures);
+		return 1;
+	}
+	printf("  every glyph draws the same as before\n");
+	return 0;
+}
@@ -0,0 +1,382 @@
+/*
+	Scan chain test.
+
+	Runs the LED matrix driver (src/matrix_drive.cpp) against the register
+	model of sim_hw.cpp, decodes every row the LED1642s show back into 12bit
+	PWM values per pixel, and checks each frame against the frame buffer.
+
+	usage: scan_test [-t]
+	  -t  count host CPU time of the interrupt handler in the per-phase cost
+*/
+#include <Arduino.h>
+#include <vector>
+#include <algorithm>
+#include "frame_buffer.h"
+#include "matrix_drive.h"
+#include "matrix_encode.h"
+#include "settings.h"
+#include "sim_hw.h"
+
+#define STRINGIFY(x) STRINGIFY2(x)
+#define STRINGIFY2(x) #x
+
+static constexpr int W = LED_MAX_LOGICAL_COL;
+static constexpr int H = LED_MAX_LOGICAL_ROW;
+
+typedef std::vector<uint16_t> image_t; //!< PWM value of each pixel, W * H
+
+static led_gamma_params_t gamma_params = { 350, 20, 3800 }; // led_default_gamma_params in matrix_drive.cpp
+static bool pwm_running = true;
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if(!(cond)) { \
+	fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+	fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); ++ failures; } } while(0)
+
+static uint32_t rnd_state = 1;
+static uint32_t rnd() { rnd_state = rnd_state * 1103515245 + 12345; return rnd_state >> 8; }
+
+/**
+ * Reference PWM value of a pixel, computed from the gamma curve directly
+ */
+static inline uint32_t reference_pwm(frame_buffer_format_12bpp_t, uint16_t p)
+{
+	// linear interpolation between 257 knots of the curve
+	int k = p >> 4, f = p & 15;
+	uint32_t a = gamma_curve(k * 16, 4095, gamma_params.black_offset * 4095 / 255,
+		gamma_params.exponent_100, gamma_params.ceiling);
+	uint32_t b = gamma_curve((k + 1) * 16, 4095, gamma_params.black_offset * 4095 / 255,
+		gamma_params.exponent_100, gamma_params.ceiling);
+	return a + (((b - a) * f) >> 4);
+}
+
+template <typename FORMAT>
+static uint32_t reference_pwm(FORMAT, uint8_t p)
+{
+	return gamma_curve(FORMAT::to_level(p), 255, gamma_params.black_offset,
+		gamma_params.exponent_100, gamma_params.ceiling);
+}
+
+/**
+ * Returns the image the frame buffer should be shown as
+ */
+static image_t expected_image(const frame_buffer_t & fb)
+{
+	typedef frame_buffer_t::format_t format_t;
+	image_t img(W * H);
+	for(int y = 0; y < H; ++y)
+		for(int x = 0; x < W; ++x)
+		{
+			frame_buffer_t::pixel_t p = format_t::get(fb.array()[y], x);
+			img[y * W + x] = pwm_running ? reference_pwm(format_t(), p) :
+				(format_t::to_level(p) >= 0x80 ? 0xffff : 0);
+		}
+	return img;
+}
+
+/*
+	Frames as shown by the LED1642s.
+	Brightness latch L of chip C holds pixel ((7-C)*8 + L/2, row*2 + L%2),
+	which is the wiring led_encode_row() encodes for.
+*/
+static image_t showing(W * H); //!< frame being shown
+static int showing_next_row = -1; //!< row expected to be shown next; -1 until row 0 is shown
+static std::vector<image_t> frames; //!< frames shown completely
+
+static void on_show(int row)
+{
+	if(row == 0) showing_next_row = 0;
+	if(row != showing_next_row)
+	{
+		CHECK(showing_next_row < 0, "row %d shown after row %d", row, showing_next_row - 1);
+		showing_next_row = -1; // resynchronize at the next frame
+		return;
+	}
+	for(int c = 0; c < SIM_NUM_LED1642; ++c)
+		for(int l = 0; l < 16; ++l)
+			showing[(row * 2 + (l & 1)) * W + (7 - c) * 8 + (l >> 1)] =
+				sim_led1642[c].pwm[l];
+	if(++ showing_next_row == SIM_NUM_ROWS)
+	{
+		frames.push_back(showing);
+		showing_next_row = 0;
+	}
+}
+
+//! Run one pass of the main loop, which encodes the scanout behind the
+//! beam, and one timer interrupt
+static void run_main_loop()
+{
+	led_encode_behind_beam();
+	sim_run_interrupt();
+}
+
+//! Run until n more frames are shown completely
+static void run_frames(int n)
+{
+	size_t target = frames.size() + n;
+	while(frames.size() < target) run_main_loop();
+}
+
+static int count_diff(const image_t & a, const image_t & b)
+{
+	int n = 0;
+	for(int i = 0; i < W * H; ++i) if(a[i] != b[i]) ++ n;
+	return n;
+}
+
+/**
+ * Check that frames from first show the old image, then the new one,
+ * each entirely, and the last one shows the new image
+ */
+static void check_transition(size_t first, const image_t & old_img, const image_t & new_img,
+	const char *what)
+{
+	bool seen_new = false;
+	for(size_t i = first; i < frames.size(); ++i)
+	{
+		bool is_new = frames[i] == new_img;
+		bool is_old = frames[i] == old_img;
+		CHECK(is_new || is_old, "%s: frame %zu is neither old nor new image (%d/%d pixels differ)",
+			what, i, count_diff(frames[i], old_img), count_diff(frames[i], new_img));
+		CHECK(is_new || !seen_new, "%s: frame %zu shows old image after new one", what, i);
+		if(is_new) seen_new = true;
+	}
+	CHECK(frames.back() == new_img, "%s: last frame is not the new image (%d pixels differ)",
+		what, count_diff(frames.back(), new_img));
+}
+
+//! Fill rows of the buffer with random levels
+static void draw_random_rows(frame_buffer_t & fb, uint64_t rows)
+{
+	for(int y = 0; y < H; ++y)
+		if(rows & ((uint64_t)1 << y))
+			for(int x = 0; x < W; ++x)
+				fb.set_point_deep(x, y, rnd() & 4095);
+}
+
+static void test_flips()
+{
+	image_t shown = expected_image(get_current_frame_buffer());
+	for(int i = 0; i < 40; ++i)
+	{
+		uint64_t rows = ~(uint64_t)0;
+		if(i & 1)
+		{
+			// a few rows changed; unchanged rows are not re-encoded
+			frame_buffer_copy_forward();
+			rows = (uint64_t)1 << (rnd() % H) | (uint64_t)1 << (rnd() % H);
+		}
+		frame_buffer_t & bg = get_bg_frame_buffer();
+		draw_random_rows(bg, rows);
+		image_t img = expected_image(bg);
+		size_t first = frames.size();
+		frame_buffer_flip();
+		run_frames(3);
+		check_transition(first, shown, img, "flip");
+		shown = img;
+	}
+}
+
+static void test_gamma()
+{
+	static const led_gamma_params_t params[] = { { 250, 0, 4095 }, { 420, 60, 2000 }, { 350, 20, 3800 } };
+	for(auto & p : params)
+	{
+		image_t old_img = expected_image(get_current_frame_buffer());
+		gamma_params = p;
+		image_t new_img = expected_image(get_current_frame_buffer());
+		size_t first = frames.size();
+		led_set_gamma(p);
+		run_frames(3);
+		check_transition(first, old_img, new_img, "gamma");
+	}
+}
+
+static void test_interval_modes()
+{
+	static const led_interval_mode_t modes[] = { LIM_PWM_OFF, LIM_MODE1, LIM_MODE2, LIM_MODE0 };
+	for(auto m : modes)
+	{
+		led_set_interval_mode(m);
+		pwm_running = m != LIM_PWM_OFF;
+		run_frames(3);
+		CHECK(frames.back() == expected_image(get_current_frame_buffer()),
+			"interval mode %d: %d pixels differ", (int)m,
+			count_diff(frames.back(), expected_image(get_current_frame_buffer())));
+	}
+}
+
+static void test_config()
+{
+	led_set_contrast(20);
+	run_frames(1);
+	uint16_t expected = (1<<15) | (1<<13) | (1<<12) | (1<<11) | 20;
+	for(int c = 0; c < SIM_NUM_LED1642; ++c)
+		CHECK(sim_led1642[c].config == expected, "LED1642 #%d config %04x, expected %04x",
+			c, sim_led1642[c].config, expected);
+	led_set_contrast(63);
+}
+
+static void test_buttons()
+{
+	sim_buttons = 0x00a5c3;
+	run_frames(2);
+	CHECK(button_read == sim_buttons, "button_read %06x, expected %06x", button_read, sim_buttons);
+	sim_buttons = 0;
+	run_frames(2);
+	CHECK(button_read == 0, "button_read %06x, expected 0", button_read);
+}
+
+/**
+ * A main loop which stalls for a frame leaves rows of the pass unencoded;
+ * they are shown old, counted as late, and encoded once the main loop
+ * runs again
+ */
+static uint32_t test_stalled_main_loop()
+{
+	led_telemetry_t before, after;
+	led_get_telemetry(before);
+
+	image_t old_img = expected_image(get_current_frame_buffer());
+	frame_buffer_t & bg = get_bg_frame_buffer();
+	draw_random_rows(bg, ~(uint64_t)0);
+	image_t new_img = expected_image(bg);
+	size_t first = frames.size();
+	frame_buffer_flip();
+	size_t target = frames.size() + 2;
+	while(frames.size() < target) sim_run_interrupt(); // main loop stalled
+	CHECK(frames.back() == old_img, "stalled: frame is not the old image (%d pixels differ)",
+		count_diff(frames.back(), old_img));
+	run_frames(3);
+	check_transition(first, old_img, new_img, "stalled");
+
+	led_get_telemetry(after);
+	uint32_t late = after.late_rows - before.late_rows;
+	CHECK(late >= SIM_NUM_ROWS, "stalled: %u late rows counted, expected %d or more",
+		late, SIM_NUM_ROWS);
+	return late;
+}
+
+void test_led_sel_row(); // polling routine of matrix_drive.cpp
+
+/**
+ * Phase schedule calibration must not wait for SPI in the interrupt,
+ * and must give a schedule which keeps the interval
+ */
+static void test_phase_calibration()
+{
+	sim_stat.max_isr_spi_wait_cycles = 0;
+	led_start_phase_calibration();
+	for(int f = 0; f < 24 * 60 * 10 / SIM_NUM_ROWS + 2; ++f)
+	{
+		run_frames(1);
+		test_led_sel_row();
+	}
+	// one poll of SPI1CMD is allowed; a wait loop is not
+	CHECK(sim_stat.max_isr_spi_wait_cycles <= sim_spi_poll_cycles,
+		"calibration waited for SPI for %u cycles in an interrupt",
+		sim_stat.max_isr_spi_wait_cycles);
+
+	string_vector vec;
+	CHECK(settings_read_vector(F("led_phase_schedule_0"), vec) && vec.size() == LED_NUM_PHASES,
+		"calibrated phase schedule is not written");
+	long sum = 0;
+	for(auto & v : vec) sum += v.toInt();
+	CHECK(sum == 36864, "calibrated phase schedule sums up to %ld", sum);
+
+	// scan goes on with the new schedule
+	image_t img = expected_image(get_current_frame_buffer());
+	run_frames(3);
+	CHECK(frames.back() == img, "frame after calibration differs");
+
+	led_reset_phase_schedule();
+}
+
+/**
+ * Measure cost of each phase over frames which change entirely every frame,
+ * so that every row is re-encoded. The phase of an interrupt is found from
+ * the telemetry lateness histogram.
+ */
+static void measure_phase_cost()
+{
+	std::vector<uint32_t> cost[LED_NUM_PHASES];
+	static led_telemetry_t before, after; // large; not on the stack
+
+	for(int f = 0; f < 200; ++f)
+	{
+		frame_buffer_t & bg = get_bg_frame_buffer();
+		draw_random_rows(bg, ~(uint64_t)0);
+		frame_buffer_flip();
+
+		size_t target = frames.size() + 1;
+		while(frames.size() < target)
+		{
+			led_get_telemetry(before);
+			run_main_loop();
+			led_get_telemetry(after);
+			for(int p = 0; p < LED_NUM_PHASES; ++p)
+			{
+				uint32_t n = 0;
+				for(int b = 0; b < LED_TELEMETRY_NUM_BINS; ++b)
+					n += after.lateness_hist[p][b] - before.lateness_hist[p][b];
+				bool skipped = after.busy_on_entry[p] != before.busy_on_entry[p] ||
+					after.late_on_entry[p] != before.late_on_entry[p];
+				if(n && !skipped) cost[p].push_back(sim_last_isr_cycles);
+			}
+		}
+	}
+
+	printf("phase cost in CPU cycles, SPI wait as modelled + host CPU time:\n");
+	printf("phase median    p99    max (telemetry max_phase_cycles)\n");
+	for(int p = 0; p < LED_NUM_PHASES; ++p)
+	{
+		std::vector<uint32_t> & c = cost[p];
+		if(c.empty()) continue;
+		std::sort(c.begin(), c.end());
+		printf("%5d %6u %6u %6u (%u)\n", p, c[c.size() / 2], c[c.size() * 99 / 100], c.back(),
+			after.max_phase_cycles[p]);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	bool timing = argc > 1 && !strcmp(argv[1], "-t");
+
+	get_current_frame_buffer().fill(0);
+	sim_on_show = on_show;
+	led_init();
+	run_frames(1);
+	CHECK(frames.back() == expected_image(get_current_frame_buffer()), "initial frame is not blank");
+
+	test_config();
+	test_flips();
+	test_gamma();
+	test_interval_modes();
+	test_buttons();
+	test_phase_calibration();
+	uint32_t stalled_late_rows = test_stalled_main_loop();
+
+	led_telemetry_t t;
+	led_get_telemetry(t);
+	uint32_t skipped = 0;
+	for(int p = 0; p < LED_NUM_PHASES; ++p) skipped += t.busy_on_entry[p] + t.late_on_entry[p];
+	CHECK(skipped == 0, "%u interrupts skipped for SPI busy or lateness", skipped);
+	CHECK(t.late_rows == stalled_late_rows, "%u rows shown before encoded",
+		t.late_rows - stalled_late_rows);
+	CHECK(sim_stat.timer_in_past == 0, "%u timer targets written in the past", sim_stat.timer_in_past);
+	CHECK(sim_errors == 0, "%u hardware protocol violations", sim_errors);
+
+	printf("%s, %d buffers: %zu frames, %u SPI transactions, %u interrupts\n",
+		STRINGIFY(FRAME_BUFFER_FORMAT), FRAME_BUFFER_COUNT, frames.size(), sim_stat.spi_transactions, t.interrupt_count);
+
+	if(timing)
+	{
+		sim_cpu_timing = true;
+		measure_phase_cost();
+	}
+
+	if(failures) { printf("FAILED: %d checks\n", failures); return 1; }
+	printf("OK\n");
+	return 0;
+}
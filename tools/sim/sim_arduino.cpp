@@ -0,0 +1,59 @@
+#include <Arduino.h>
+#include <SPI.h>
+#include <ESP8266WiFi.h>
+#include <map>
+#include "settings.h"
+#include "panic.h"
+
+HardwareSerial Serial;
+EspClass ESP;
+SPIClass SPI;
+ESP8266WiFiClass WiFi;
+uint32_t sim_progmem_reads;
+
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t, uint8_t) {}
+int digitalRead(uint8_t) { return 0; }
+int analogRead(uint8_t) { return 0; }
+
+/*
+	Settings, kept in memory
+*/
+static std::map<String, String> settings;
+static std::map<String, string_vector> settings_vectors;
+
+bool settings_write(const String & key, const String & value, settings_overwrite_t overwrite)
+{
+	if(!overwrite.overwrite && settings.count(key)) return true;
+	settings[key] = value;
+	return true;
+}
+
+bool settings_read(const String & key, String & value)
+{
+	auto it = settings.find(key);
+	if(it == settings.end()) return false;
+	value = it->second;
+	return true;
+}
+
+bool settings_write_vector(const String & key, const string_vector & value, settings_overwrite_t overwrite)
+{
+	if(!overwrite.overwrite && settings_vectors.count(key)) return true;
+	settings_vectors[key] = value;
+	return true;
+}
+
+bool settings_read_vector(const String & key, string_vector & value)
+{
+	auto it = settings_vectors.find(key);
+	if(it == settings_vectors.end()) return false;
+	value = it->second;
+	return true;
+}
+
+void do_panic(int code, const String & message)
+{
+	fprintf(stderr, "panic %d: %s\n", code, message.c_str());
+	exit(2);
+}
@@ -0,0 +1,432 @@
+#include <Arduino.h>
+#include <time.h>
+#include <new>
+#include <vector>
+#include "sim_hw.h"
+
+#define LED_HC595_LATCH_GPIO 15
+
+sim_spi1cmd_t sim_spi1cmd;
+sim_gpo_t sim_gpos = { true }, sim_gpoc = { false };
+sim_gp16_t sim_gp16o = { true }, sim_gp16i = { false };
+volatile uint32_t sim_spi1w[16];
+volatile uint32_t sim_spi1u, sim_spi1u1, sim_spi1c;
+volatile uint32_t sim_i2s_regs[6];
+
+sim_led1642_t sim_led1642[SIM_NUM_LED1642];
+void (*sim_on_show)(int row);
+uint32_t sim_buttons;
+bool sim_cpu_timing;
+uint32_t sim_last_isr_cycles;
+sim_stat_t sim_stat;
+uint32_t sim_errors;
+
+static uint32_t hc595_shift; //!< HC595 shift registers
+static uint32_t hc595_out = 0xffffff; //!< HC595 outputs
+static uint32_t gpio_out; //!< GPIO 0-15 outputs
+static bool le; //!< LED1642 LE input
+static int le_clocks; //!< number of clocks while LE is high
+
+static uint64_t time_cycles; //!< simulated time
+static uint64_t spi_end; //!< time when the SPI transaction in progress ends
+static bool in_isr;
+static uint64_t isr_start; //!< simulated time at the interrupt entry
+static uint64_t isr_host_start; //!< host time at the interrupt entry, in ns
+static uint64_t isr_extra; //!< simulated time added within the interrupt
+static uint64_t isr_model_ns; //!< host time spent by the model within the interrupt
+static uint32_t isr_spi_wait; //!< CPU cycles spent polling busy SPI within the interrupt
+
+static timercallback timer_callback;
+static uint32_t timer_target;
+
+// the flash image; not on the heap of the model
+static uint8_t *flash;
+static size_t flash_size;
+
+void sim_error(const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	fprintf(stderr, "sim: at cycle %llu: ", (unsigned long long)sim_now());
+	vfprintf(stderr, fmt, ap);
+	fputc('\n', stderr);
+	va_end(ap);
+	++ sim_errors;
+}
+
+static uint64_t host_ns()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+uint64_t sim_now()
+{
+	if(in_isr)
+	{
+		uint64_t t = isr_start + isr_extra;
+		if(sim_cpu_timing)
+			t += (host_ns() - isr_host_start - isr_model_ns) * (F_CPU / 1000000) / 1000;
+		return t;
+	}
+	return time_cycles;
+}
+
+//! Advance simulated time
+static void advance(uint64_t cycles)
+{
+	if(in_isr) isr_extra += cycles; else time_cycles += cycles;
+}
+
+static bool spi_busy() { return sim_now() < spi_end; }
+
+/**
+ * Excludes host time spent by the model from the interrupt handler's
+ * CPU time, while in scope
+ */
+struct model_time_t
+{
+	uint64_t start = in_isr && sim_cpu_timing ? host_ns() : 0;
+	~model_time_t() { if(start) isr_model_ns += host_ns() - start; }
+};
+
+/**
+ * Execute the LED1642 command given by the number of clocks while LE was high
+ */
+static void led1642_command(int clocks)
+{
+	for(int c = 0; c < SIM_NUM_LED1642; ++c)
+	{
+		sim_led1642_t & chip = sim_led1642[c];
+		switch(clocks)
+		{
+		case 1: case 2:
+			chip.switches = chip.shift;
+			break;
+
+		case 3: case 4:
+			if(chip.next_latch >= 15)
+				sim_error("LED1642 #%d: data latch to latch %d", c, chip.next_latch);
+			else
+				chip.brightness[chip.next_latch ++] = chip.shift;
+			break;
+
+		case 5: case 6:
+			if(chip.next_latch != 15)
+				sim_error("LED1642 #%d: global latch after %d data latches", c, chip.next_latch);
+			chip.brightness[15] = chip.shift;
+			memcpy(chip.pwm, chip.brightness, sizeof(chip.pwm));
+			chip.next_latch = 0;
+			++ chip.global_latch_count;
+			break;
+
+		case 7:
+			chip.config = chip.shift;
+			break;
+
+		default:
+			sim_error("LED1642 #%d: unsupported command of %d clocks", c, clocks);
+			return;
+		}
+	}
+
+	if(clocks <= 2 && sim_led1642[0].switches == 0xffff && sim_on_show)
+	{
+		int row = sim_selected_row();
+		if(row == -2) sim_error("more than one row selected");
+		if(row >= 0) sim_on_show(row);
+	}
+}
+
+/**
+ * One SPI clock on the serial chain
+ */
+static void chain_clock(int data, int latch_enable)
+{
+	// LE falling edge executes the command
+	if(le && !latch_enable)
+	{
+		led1642_command(le_clocks);
+		le_clocks = 0;
+	}
+	le = latch_enable;
+	if(le) ++ le_clocks;
+
+	// the last LED1642 feeds the HC595s
+	int carry = data;
+	for(int c = 0; c < SIM_NUM_LED1642; ++c)
+	{
+		int out = sim_led1642[c].shift >> 15;
+		sim_led1642[c].shift = (sim_led1642[c].shift << 1) | carry;
+		carry = out;
+	}
+	hc595_shift = ((hc595_shift << 1) | carry) & 0xffffff;
+}
+
+/**
+ * Start SPI transaction; the whole FIFO content is shifted into the chain
+ * at once, and SPI1CMD reads busy until the transaction would end
+ */
+static void spi_start()
+{
+	model_time_t model_time;
+	uint64_t now = sim_now();
+	if(now < spi_end) sim_error("SPI transaction started while busy");
+
+	bool dual = sim_spi1u & SPIUFWDUAL;
+	if(dual != !!(sim_spi1c & SPICDOUT) || dual != !!(sim_spi1c & SPICFASTRD))
+		sim_error("inconsistent DIO setting: SPI1U=%08x SPI1C=%08x", sim_spi1u, sim_spi1c);
+	if(sim_spi1c & (SPICWBO | SPICRBO))
+		sim_error("SPI bit order is not MSB first");
+
+	int bits = ((sim_spi1u1 >> SPILMOSI) & SPIMMOSI) + 1;
+	if(dual && (bits & 1)) sim_error("odd number of bits in DIO mode");
+
+	// bytes are sent in memory order, each MSB first. in DIO mode,
+	// the first bit of each pair goes to MISO (LE), the second to MOSI.
+	int clocks = 0;
+	int pending_le = 0;
+	for(int i = 0; i < bits; ++i)
+	{
+		int bit = (sim_spi1w[i >> 5] >> (((i >> 3) & 3) * 8 + 7 - (i & 7))) & 1;
+		if(!dual)
+			chain_clock(bit, 0), ++ clocks;
+		else if(!(i & 1))
+			pending_le = bit;
+		else
+			chain_clock(bit, pending_le), ++ clocks;
+	}
+	// MISO returns to low at the end of the transaction
+	if(le)
+	{
+		led1642_command(le_clocks);
+		le_clocks = 0;
+		le = false;
+	}
+
+	++ sim_stat.spi_transactions;
+	sim_stat.spi_clocks += clocks;
+	spi_end = now + clocks * SIM_SPI_CLOCK_CYCLES;
+}
+
+uint32_t sim_spi1cmd_t::operator & (uint32_t mask) const
+{
+	model_time_t model_time;
+	uint32_t v = 0;
+	if(spi_busy())
+	{
+		v = SPIBUSY;
+		advance(sim_spi_poll_cycles);
+		sim_stat.spi_wait_cycles += sim_spi_poll_cycles;
+		if(in_isr) isr_spi_wait += sim_spi_poll_cycles;
+	}
+	return v & mask;
+}
+
+sim_spi1cmd_t & sim_spi1cmd_t::operator |= (uint32_t bits)
+{
+	if(bits & SPIBUSY) spi_start();
+	return *this;
+}
+
+sim_gpo_t & sim_gpo_t::operator = (uint32_t bits)
+{
+	model_time_t model_time;
+	uint32_t prev = gpio_out;
+	if(set) gpio_out |= bits; else gpio_out &= ~bits;
+
+	uint32_t latch = 1u << LED_HC595_LATCH_GPIO;
+	if(!(prev & latch) && (gpio_out & latch))
+	{
+		// HC595 latch rising edge
+		if(spi_busy()) sim_error("HC595 latched during SPI transaction");
+		for(int c = 0; c < SIM_NUM_LED1642; ++c)
+			if(sim_led1642[c].switches)
+				sim_error("HC595 latched while LED1642 #%d outputs are on", c);
+		hc595_out = hc595_shift;
+	}
+	return *this;
+}
+
+sim_gp16_t::operator uint32_t() const
+{
+	model_time_t model_time;
+	if(output) return 0;
+	int row = sim_selected_row();
+	return row >= 0 && (sim_buttons & (1u << row)) ? 0 : 1; // pressed button pulls low
+}
+
+sim_gp16_t & sim_gp16_t::operator = (uint32_t)
+{
+	return *this;
+}
+
+uint32_t sim_hc595_outputs()
+{
+	return hc595_out;
+}
+
+int sim_selected_row()
+{
+	uint32_t sel = ~hc595_out & 0xffffff;
+	if(!sel) return -1;
+	if(sel & (sel - 1)) return -2;
+	return 23 - __builtin_ctz(sel);
+}
+
+bool sim_run_interrupt()
+{
+	if(!timer_callback) return false;
+	int32_t wait = (int32_t)(timer_target - (uint32_t)time_cycles);
+	if(wait > 0) time_cycles += wait;
+
+	in_isr = true;
+	isr_start = time_cycles;
+	isr_extra = 0;
+	isr_model_ns = 0;
+	isr_spi_wait = 0;
+	isr_host_start = host_ns();
+	timer_callback();
+	uint64_t end = sim_now();
+	in_isr = false;
+	sim_last_isr_cycles = end - isr_start;
+	if(isr_spi_wait > sim_stat.max_isr_spi_wait_cycles)
+		sim_stat.max_isr_spi_wait_cycles = isr_spi_wait;
+	time_cycles = end;
+
+	// the timer fires only when the counter reaches the target
+	if((int32_t)(timer_target - (uint32_t)time_cycles) < 0) ++ sim_stat.timer_in_past;
+	return true;
+}
+
+void sim_run_for(uint64_t cycles)
+{
+	uint64_t end = time_cycles + cycles;
+	while(timer_callback)
+	{
+		int32_t wait = (int32_t)(timer_target - (uint32_t)time_cycles);
+		if(time_cycles + (wait < 0 ? 0 : wait) >= end) break;
+		sim_run_interrupt();
+	}
+	if(time_cycles < end) time_cycles = end;
+}
+
+bool sim_flash_load(const char *file_name, uint32_t address)
+{
+	FILE *f = fopen(file_name, "rb");
+	if(!f) return false;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	// the flash is erased to 0xff, and reads do not end within a sector
+	size_t end = (address + size + 4095) & ~(size_t)4095;
+	if(flash_size < end)
+	{
+		flash = static_cast<uint8_t *>(realloc(flash, end));
+		memset(flash + flash_size, 0xff, end - flash_size);
+		flash_size = end;
+	}
+	bool ok = fread(flash + address, 1, size, f) == (size_t)size;
+	fclose(f);
+	return ok;
+}
+
+/*
+	Heap accounting; each block is preceded by its size
+*/
+static uint32_t heap_used;
+uint32_t sim_heap_size = 1u << 30;
+uint32_t sim_heap_peak;
+
+static void * heap_alloc(size_t size)
+{
+	if(heap_used + size > sim_heap_size) return nullptr;
+	size_t *p = static_cast<size_t *>(malloc(size + sizeof(max_align_t)));
+	if(!p) return nullptr;
+	*p = size;
+	heap_used += size;
+	if(heap_used > sim_heap_peak) sim_heap_peak = heap_used;
+	return reinterpret_cast<char *>(p) + sizeof(max_align_t);
+}
+
+static void heap_free(void *ptr)
+{
+	if(!ptr) return;
+	size_t *p = reinterpret_cast<size_t *>(static_cast<char *>(ptr) - sizeof(max_align_t));
+	heap_used -= *p;
+	free(p);
+}
+
+void * operator new(size_t size) { return heap_alloc(size); }
+void * operator new[](size_t size) { return heap_alloc(size); }
+void * operator new(size_t size, const std::nothrow_t &) noexcept { return heap_alloc(size); }
+void * operator new[](size_t size, const std::nothrow_t &) noexcept { return heap_alloc(size); }
+void operator delete(void *p) noexcept { heap_free(p); }
+void operator delete[](void *p) noexcept { heap_free(p); }
+void operator delete(void *p, size_t) noexcept { heap_free(p); }
+void operator delete[](void *p, size_t) noexcept { heap_free(p); }
+
+uint32_t EspClass::getFreeHeap()
+{
+	return sim_heap_size - heap_used;
+}
+
+uint32_t EspClass::getCycleCount()
+{
+	return (uint32_t)sim_now();
+}
+
+bool EspClass::flashRead(uint32_t address, uint32_t *data, size_t size)
+{
+	++ sim_stat.flash_reads;
+	sim_stat.flash_bytes += size;
+	if((address | size | (uintptr_t)data) & 3) ++ sim_stat.flash_unaligned;
+	if(address + size > flash_size) return false;
+	memcpy(data, flash + address, size);
+	return true;
+}
+
+uint32_t millis()
+{
+	return sim_now() / (F_CPU / 1000);
+}
+
+uint32_t micros()
+{
+	return sim_now() / (F_CPU / 1000000);
+}
+
+void delay(unsigned long ms)
+{
+	sim_run_for((uint64_t)ms * (F_CPU / 1000));
+}
+
+void delayMicroseconds(unsigned int us)
+{
+	advance((uint64_t)us * (F_CPU / 1000000));
+}
+
+void yield()
+{
+	if(!sim_run_interrupt()) advance(F_CPU / 1000);
+}
+
+void timer0_isr_init()
+{
+}
+
+void timer0_write(uint32_t count)
+{
+	timer_target = count;
+}
+
+void timer0_attachInterrupt(timercallback callback)
+{
+	timer_callback = callback;
+}
+
+void timer0_detachInterrupt()
+{
+	timer_callback = nullptr;
+}
@@ -0,0 +1,113 @@
+#ifndef SIM_HW_H
+#define SIM_HW_H
+
+/*
+	Register-level model of the LED matrix hardware, for host builds.
+
+	SPI1 transactions started by the driver are shifted, bit by bit, into
+	a model of the serial chain: the MOSI line feeds eight LED1642s and
+	then three HC595s, and in DIO mode the MISO line drives the LE input
+	of the LED1642s. The LED1642 commands are given by the number of
+	clocks while LE is high, as in the datasheet:
+
+		1-2: write switch register   3-4: data latch
+		5-6: global latch            7:   write configuration register
+
+	Each data latch loads the next brightness latch of the chip, and the
+	global latch loads the last one and then all of them into the PWM
+	counters. GPIO15 rising edge latches the HC595 outputs, which select
+	the row; output bit 23-N drives row N, active low, which is the order
+	row_sel_pattern() shifts them in.
+
+	Simulated time is counted in 80MHz CPU cycles. It advances to the
+	timer0 target at each interrupt, and by sim_spi_poll_cycles for each
+	poll of a busy SPI1CMD. CPU time spent by the interrupt handler itself
+	is only counted if sim_cpu_timing is set; it is then the host time,
+	which is much faster than the ESP8266.
+*/
+
+#include <stdint.h>
+
+static constexpr int SIM_NUM_LED1642 = 8;
+static constexpr int SIM_NUM_ROWS = 24;
+static constexpr int SIM_SPI_CLOCK_CYCLES = 6; //!< CPU cycles per SPI clock (13.33MHz)
+static constexpr int sim_spi_poll_cycles = 16; //!< CPU cycles per poll of a busy SPI1CMD
+
+//! State of one LED1642
+struct sim_led1642_t
+{
+	uint16_t shift; //!< serial shift register
+	uint16_t brightness[16]; //!< brightness latches, in the order of loading
+	uint16_t pwm[16]; //!< brightness in use, loaded by the global latch
+	uint16_t switches; //!< output switch register
+	uint16_t config; //!< configuration register
+	int next_latch; //!< brightness latch to be loaded by the next data latch
+	uint32_t global_latch_count; //!< number of global latches
+};
+
+//! LED1642s; chip 0 is the nearest to the ESP8266
+extern sim_led1642_t sim_led1642[SIM_NUM_LED1642];
+
+//! Returns HC595 outputs
+uint32_t sim_hc595_outputs();
+
+//! Returns the row selected by the HC595s; -1 if none, -2 if more than one
+int sim_selected_row();
+
+//! Called when the LED1642 outputs are switched on with a row selected;
+//! the PWM counters of sim_led1642[] then hold the row being shown
+extern void (*sim_on_show)(int row);
+
+//! Buttons being pressed; bit N for the button on row N
+extern uint32_t sim_buttons;
+
+//! Whether the host CPU time of the interrupt handler is counted
+extern bool sim_cpu_timing;
+
+//! Returns simulated time in CPU cycles
+uint64_t sim_now();
+
+//! Run one timer interrupt; advances the time to the timer0 target first.
+//! Returns false if no handler is attached.
+bool sim_run_interrupt();
+
+//! Run timer interrupts for the given number of CPU cycles
+void sim_run_for(uint64_t cycles);
+
+//! Simulated time spent by the last interrupt, in CPU cycles
+extern uint32_t sim_last_isr_cycles;
+
+//! Hardware statistics
+struct sim_stat_t
+{
+	uint32_t spi_transactions; //!< number of SPI transactions
+	uint64_t spi_clocks; //!< number of SPI clocks
+	uint64_t spi_wait_cycles; //!< CPU cycles spent polling busy SPI
+	uint32_t max_isr_spi_wait_cycles; //!< maximum CPU cycles spent polling busy SPI in one interrupt
+	uint32_t timer_in_past; //!< interrupts whose target was already past when written
+	uint32_t flash_reads; //!< number of ESP.flashRead() calls
+	uint64_t flash_bytes; //!< bytes read by ESP.flashRead()
+	uint32_t flash_unaligned; //!< ESP.flashRead() calls violating its alignment requirement
+};
+extern sim_stat_t sim_stat;
+
+//! Number of hardware protocol violations found; each is also reported on stderr
+extern uint32_t sim_errors;
+
+//! Report a hardware protocol violation
+void sim_error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+//! Load a file into the flash image at the address
+bool sim_flash_load(const char *file_name, uint32_t address);
+
+//! Heap size of the model; ESP.getFreeHeap() returns this less the bytes
+//! allocated by new and not deleted yet, without any allocator overhead.
+//! new, and new (std::nothrow), returns nullptr when the heap is exhausted, as on the ESP8266.
+//! This is 1GB by default, as the tests allocate on the same heap.
+extern uint32_t sim_heap_size;
+
+//! Largest number of bytes allocated at once; set this to the bytes in use,
+//! sim_heap_size - ESP.getFreeHeap(), to measure from there
+extern uint32_t sim_heap_peak;
+
+#endif
@@ -0,0 +1,198 @@
+/*
+	Scroll strip test.
+
+	Checks that draw() and draw_subpixel() of the 4bpp strip give the
+	string as draw_text() gives it, quantized to 4bpp, at any offset and
+	around the wrap of the strip, and reports the heap taken by the strip.
+
+	Also reports the cost of a marquee frame of the clock, drawn by whole
+	pixels with draw() and by sub-pixel steps with draw_subpixel(), at the
+	default speed of 33 px/s, with frames at the former 50ms interval and
+	at every vsync of about 90 fps.
+*/
+#include <Arduino.h>
+#include <vector>
+#include "frame_buffer.h"
+#include "scroll_strip.h"
+#include "fonts/font_bff.h"
+#include "sim_hw.h"
+#include "bench.h"
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if(!(cond)) { \
+	fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+	fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); ++ failures; } } while(0)
+
+static frame_buffer_t fb, ref;
+
+static int quantize(int level) { return (level + 8) / 17 * 17; }
+
+//! Returns the level as stored in the frame buffer
+static int stored(int level)
+{
+	typedef frame_buffer_t::format_t format_t;
+	return format_t::to_level(format_t::from_level(level));
+}
+
+/**
+ * Draw the string at offset into ref as the marquee does without the
+ * strip, twice to wrap around, and quantize it to 4bpp. Each copy is
+ * clipped to its width, as ink outside of it is not in the strip.
+ */
+static void draw_reference(const String & s, int width, int offset)
+{
+	ref.fill(0);
+	ref.set_clip(-offset, 0, width, LED_MAX_LOGICAL_ROW);
+	ref.draw_text(-offset, 0, 255, s, font_bff);
+	ref.set_clip(-offset + width, 0, width, LED_MAX_LOGICAL_ROW);
+	ref.draw_text(-offset + width, 0, 255, s, font_bff);
+	ref.reset_clip();
+	for(int y = 0; y < LED_MAX_LOGICAL_ROW; ++y)
+		for(int x = 0; x < LED_MAX_LOGICAL_COL; ++x)
+			ref.set_point(x, y, quantize(ref.get_point(x, y)));
+}
+
+static void test_string(const String & s)
+{
+	scroll_strip_t strip;
+	uint32_t free_before = ESP.getFreeHeap();
+	sim_heap_peak = sim_heap_size - free_before;
+	CHECK(strip.render(s, font_bff), "render failed: %s", s.c_str());
+	int width = strip.get_width();
+	int height = font_bff.get_height();
+	uint32_t strip_bytes = free_before - ESP.getFreeHeap();
+	uint32_t peak_bytes = sim_heap_peak - (sim_heap_size - free_before);
+	CHECK(strip_bytes == (uint32_t)((width + 1) / 2 * height), "strip takes %u bytes", strip_bytes);
+	printf("strip of %d x %d px: %u bytes, %u bytes at peak while rendering\n",
+		width, height, strip_bytes, peak_bytes);
+
+	int w = width < LED_MAX_LOGICAL_COL ? width : LED_MAX_LOGICAL_COL;
+	for(int offset = 0; offset < width; offset += offset < 70 ? 1 : 23)
+	{
+		// whole pixels
+		draw_reference(s, width, offset);
+		fb.fill(0);
+		strip.draw(fb, 0, 0, offset, w);
+		int diff = 0;
+		for(int y = 0; y < height; ++y)
+			for(int x = 0; x < w; ++x)
+				if(fb.get_point(x, y) != ref.get_point(x, y)) ++ diff;
+		CHECK(diff == 0, "draw at offset %d: %d pixels differ", offset, diff);
+
+		// the fraction between this and the next pixel
+		draw_reference(s, width, (offset + 1) % width);
+		static uint8_t right[LED_MAX_LOGICAL_ROW][LED_MAX_LOGICAL_COL];
+		for(int y = 0; y < height; ++y)
+			for(int x = 0; x < w; ++x)
+				right[y][x] = ref.get_point(x, y);
+		draw_reference(s, width, offset);
+		for(int frac = 1; frac < 64; frac += 21)
+		{
+			fb.fill(0);
+			strip.draw_subpixel(fb, 0, 0, offset * 64 + frac, w);
+			diff = 0;
+			for(int y = 0; y < height; ++y)
+				for(int x = 0; x < w; ++x)
+				{
+					int expected = stored((ref.get_point(x, y) * (64 - frac) + right[y][x] * frac + 32) >> 6);
+					if(abs(fb.get_point(x, y) - expected) > 1) ++ diff;
+				}
+			CHECK(diff == 0, "draw_subpixel at %d + %d/64: %d pixels differ", offset, frac, diff);
+		}
+	}
+
+	strip.clear();
+	CHECK(ESP.getFreeHeap() == free_before, "strip is not released");
+}
+
+/**
+ * Measure the cost of a marquee frame by the strip, by whole pixels and by
+ * sub-pixel steps, averaged over the frames of one pass of the string.
+ * Frames are interval_us apart. Each frame is the best of several runs,
+ * and the two ways are run alternately to see the same host load.
+ */
+static void marquee_frame_cost(const scroll_strip_t & strip, uint32_t interval_us,
+	double & whole, double & subpixel)
+{
+	static constexpr int reps = 50;
+	static constexpr int speed = 33; // px per second; the clock's default
+	int width = strip.get_width();
+	int w = width < LED_MAX_LOGICAL_COL ? width : LED_MAX_LOGICAL_COL;
+	int num_frames = (uint64_t)width * 1000000 / speed / interval_us;
+	std::vector<uint64_t> best[2];
+	for(auto && b : best) b.assign(num_frames, ~(uint64_t)0);
+	fb.set_clip(0, 36, LED_MAX_LOGICAL_COL, LED_MAX_LOGICAL_ROW - 36);
+	for(int rep = 0; rep < reps; ++rep)
+	{
+		for(int i = 0; i < num_frames; ++i)
+		{
+			int32_t x_64 = (uint64_t)i * interval_us * speed * 64 / 1000000 % (width * 64);
+			for(int sub = 0; sub < 2; ++sub)
+			{
+				fb.fill(0);
+				uint64_t start = bench_clock();
+				if(sub)
+					strip.draw_subpixel(fb, 0, 36, x_64, w);
+				else
+					strip.draw(fb, 0, 36, font_base_t::round_64(x_64) % width, w);
+				uint64_t t = bench_clock() - start;
+				if(t < best[sub][i]) best[sub][i] = t;
+			}
+		}
+	}
+	fb.reset_clip();
+	uint64_t sum[2] = {0, 0};
+	for(int sub = 0; sub < 2; ++sub)
+		for(auto t : best[sub]) sum[sub] += t;
+	whole = (double)sum[0] / num_frames;
+	subpixel = (double)sum[1] / num_frames;
+}
+
+int main()
+{
+	if(!sim_flash_load(SIM_FONT_FILE, BFF_FONT_FILE_START_ADDRESS))
+	{
+		printf("cannot load %s\n", SIM_FONT_FILE);
+		return 1;
+	}
+	font_bff.begin(BFF_FONT_FILE_START_ADDRESS);
+	CHECK(font_bff.get_available(), "font is not available");
+
+	test_string(F("Hello"));
+	test_string(F("12:34 \xe6\x99\xb4\xe3\x82\x8c 25\xe2\x84\x83 \xe6\xb9\xbf\xe5\xba\xa6 60%"));
+
+	{
+		scroll_strip_t strip;
+		strip.render(F("12:34 \xe6\x99\xb4\xe3\x82\x8c 25\xe2\x84\x83 \xe6\xb9\xbf\xe5\xba\xa6 60%"), font_bff);
+		for(uint32_t interval_us : { 50000, 11111 })
+		{
+			double whole, subpixel;
+			marquee_frame_cost(strip, interval_us, whole, subpixel);
+			printf("marquee frame every %u us: whole pixels %.0f, sub-pixel %.0f " BENCH_UNIT
+				"; %.0fk per second by sub-pixel\n",
+				interval_us, whole, subpixel, subpixel * 1000 / interval_us);
+		}
+	}
+
+	// as long as the strip may be
+	String s;
+	for(;;)
+	{
+		String t = s + F("fox ");
+		if(fb.get_text_width(t, font_bff) > scroll_strip_t::max_width) break;
+		s = t;
+	}
+	test_string(s);
+
+	// too wide
+	s += s;
+	scroll_strip_t strip;
+	uint32_t free_before = ESP.getFreeHeap();
+	CHECK(!strip.render(s, font_bff) && !strip.get_available(), "too wide string is rendered");
+	CHECK(ESP.getFreeHeap() == free_before, "heap is not released on failure");
+
+	if(failures) { printf("FAILED: %d checks\n", failures); return 1; }
+	printf("OK\n");
+	return 0;
+}
@@ -0,0 +1,254 @@
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+/*
+	Minimal ESP8266 Arduino core for host builds of the firmware sources.
+
+	Only what the sources under src/ use is provided. Hardware registers
+	the LED matrix driver touches are objects of the register model in
+	sim_hw.cpp, so that SPI transactions and GPIO writes can be decoded.
+	Time is the simulated CPU cycle counter; see sim_hw.h.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+
+#define ICACHE_RAM_ATTR
+#define ICACHE_FLASH_ATTR
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+//! Number of pgm_read_*() calls, each of which is a flash access on the ESP8266
+extern uint32_t sim_progmem_reads;
+#define pgm_read_byte(p) (++ sim_progmem_reads, *(const uint8_t *)(p))
+#define pgm_read_word(p) (++ sim_progmem_reads, *(const uint16_t *)(p))
+#define pgm_read_dword(p) (++ sim_progmem_reads, *(const uint32_t *)(p))
+#define memcpy_P memcpy
+#define memcmp_P memcmp
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+
+#define F_CPU 80000000
+
+#define INPUT 0
+#define OUTPUT 1
+#define FUNCTION_1 2
+#define LOW 0
+#define HIGH 1
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+
+//! Arduino String over std::string
+class String
+{
+	std::string s;
+
+public:
+	String() {}
+	String(const char *p) : s(p ? p : "") {}
+	String(const __FlashStringHelper *p) : s(reinterpret_cast<const char *>(p)) {}
+	String(char c) : s(1, c) {}
+	String(int v, int base = 10) : String((long)v, base) {}
+	String(unsigned int v, int base = 10) : String((unsigned long)v, base) {}
+	String(long v, int base = 10) { char b[34]; snprintf(b, sizeof(b), base == 16 ? "%lx" : "%ld", v); s = b; }
+	String(unsigned long v, int base = 10) { char b[34]; snprintf(b, sizeof(b), base == 16 ? "%lx" : "%lu", v); s = b; }
+
+	const char * c_str() const { return s.c_str(); }
+	unsigned int length() const { return s.size(); }
+	long toInt() const { return atol(s.c_str()); }
+	float toFloat() const { return atof(s.c_str()); }
+	char operator [] (unsigned int i) const { return i < s.size() ? s[i] : 0; }
+	char charAt(unsigned int i) const { return (*this)[i]; }
+	String substring(unsigned int from) const { return substring(from, s.size()); }
+	String substring(unsigned int from, unsigned int to) const
+	{
+		if(from > s.size()) from = s.size();
+		if(to > s.size()) to = s.size();
+		return from < to ? String(s.substr(from, to - from).c_str()) : String();
+	}
+	int indexOf(char c, unsigned int from = 0) const
+	{
+		size_t p = s.find(c, from);
+		return p == std::string::npos ? -1 : (int)p;
+	}
+	bool startsWith(const String & o) const { return s.compare(0, o.s.size(), o.s) == 0; }
+	bool endsWith(const String & o) const
+	{
+		return s.size() >= o.s.size() && s.compare(s.size() - o.s.size(), o.s.size(), o.s) == 0;
+	}
+	void reserve(unsigned int n) { s.reserve(n); }
+
+	String & operator += (const String & o) { s += o.s; return *this; }
+	String & operator += (const char *p) { s += p; return *this; }
+	String & operator += (char c) { s += c; return *this; }
+	bool operator == (const String & o) const { return s == o.s; }
+	bool operator != (const String & o) const { return s != o.s; }
+	bool operator < (const String & o) const { return s < o.s; }
+
+	friend String operator + (const String & a, const String & b) { String r(a); r += b; return r; }
+	friend String operator + (const String & a, const char *b) { String r(a); r += b; return r; }
+	friend String operator + (const String & a, char c) { String r(a); r += c; return r; }
+};
+
+//! Serial port; output goes to stdout
+class HardwareSerial
+{
+public:
+	void begin(unsigned long) {}
+	int available() { return 0; }
+	int read() { return -1; }
+	void setDebugOutput(bool) {}
+	void flush() { fflush(stdout); }
+
+	size_t print(const char *s) { return fputs(s, stdout) < 0 ? 0 : strlen(s); }
+	size_t print(const __FlashStringHelper *s) { return print(reinterpret_cast<const char *>(s)); }
+	size_t print(const String & s) { return print(s.c_str()); }
+	size_t print(char c) { return putchar(c) < 0 ? 0 : 1; }
+	size_t print(int v) { return printf("%d", v); }
+	size_t println() { return print("\r\n"); }
+	template <typename T> size_t println(const T & v) { return print(v) + println(); }
+	size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)))
+	{
+		va_list ap;
+		va_start(ap, fmt);
+		int r = vprintf(fmt, ap);
+		va_end(ap);
+		return r < 0 ? 0 : r;
+	}
+	size_t printf_P(const char *fmt, ...) __attribute__((format(printf, 2, 3)))
+	{
+		va_list ap;
+		va_start(ap, fmt);
+		int r = vprintf(fmt, ap);
+		va_end(ap);
+		return r < 0 ? 0 : r;
+	}
+};
+extern HardwareSerial Serial;
+
+//! ESP object; the flash is an image given by sim_flash_load()
+class EspClass
+{
+public:
+	uint32_t getCycleCount();
+	bool flashRead(uint32_t address, uint32_t *data, size_t size);
+	uint32_t getFreeHeap();
+	void restart() { exit(0); }
+};
+extern EspClass ESP;
+
+uint32_t millis();
+uint32_t micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+#define interrupts()
+#define noInterrupts()
+
+typedef void (*timercallback)(void);
+void timer0_isr_init();
+void timer0_write(uint32_t count);
+void timer0_attachInterrupt(timercallback callback);
+void timer0_detachInterrupt();
+
+/*
+	Peripheral registers. Bit positions follow esp8266_peri.h for the
+	fields the register model decodes; the others only need to be distinct.
+*/
+
+//! SPI1CMD; setting SPIBUSY starts a transaction of the register model
+struct sim_spi1cmd_t
+{
+	uint32_t operator & (uint32_t mask) const;
+	sim_spi1cmd_t & operator |= (uint32_t bits);
+};
+//! GPOS/GPOC; writing sets or clears the GPIO outputs of the bits
+struct sim_gpo_t
+{
+	bool set;
+	sim_gpo_t & operator = (uint32_t bits);
+};
+//! GP16O/GP16I
+struct sim_gp16_t
+{
+	bool output;
+	operator uint32_t() const;
+	sim_gp16_t & operator = (uint32_t v);
+};
+
+extern sim_spi1cmd_t sim_spi1cmd;
+extern sim_gpo_t sim_gpos, sim_gpoc;
+extern sim_gp16_t sim_gp16o, sim_gp16i;
+extern volatile uint32_t sim_spi1w[16];
+extern volatile uint32_t sim_spi1u, sim_spi1u1, sim_spi1c;
+extern volatile uint32_t sim_i2s_regs[6];
+
+#define SPI1CMD sim_spi1cmd
+#define SPI1W0 (sim_spi1w[0])
+#define SPI1U sim_spi1u
+#define SPI1U1 sim_spi1u1
+#define SPI1C sim_spi1c
+#define GPOS sim_gpos
+#define GPOC sim_gpoc
+#define GP16O sim_gp16o
+#define GP16I sim_gp16i
+#define I2SC (sim_i2s_regs[0])
+#define I2STXF (sim_i2s_regs[1])
+#define I2SIC (sim_i2s_regs[2])
+#define I2SIE (sim_i2s_regs[3])
+#define I2SFC (sim_i2s_regs[4])
+#define I2SCC (sim_i2s_regs[5])
+#define I2S_CLK_ENABLE()
+
+#define SPIBUSY (1 << 18)
+#define SPIUMOSI (1 << 27)
+#define SPIUSSE (1 << 7)
+#define SPIUFWDUAL (1 << 12)
+#define SPICDOUT (1 << 14)
+#define SPICFASTRD (1 << 13)
+#define SPICRBO (1 << 25)
+#define SPICWBO (1 << 26)
+#define SPILMOSI 17
+#define SPIMMOSI 0x1ff
+#define SPILMISO 8
+#define SPIMMISO 0x1ff
+
+#define I2SRST (1 << 0)
+#define I2STXS (1 << 8)
+#define I2STSM (1 << 9)
+#define I2SRSM (1 << 11)
+#define I2SRF (1 << 12)
+#define I2SMR (1 << 13)
+#define I2SRMS (1 << 14)
+#define I2SBM 18
+#define I2SBMM 0xf
+#define I2SBD 16
+#define I2SBDM 0x3f
+#define I2SCD 22
+#define I2SCDM 0x3f
+#define I2SDE (1 << 12)
+#define I2STXFM 8
+#define I2STXFMM 0x7
+#define I2SRXFM 16
+#define I2SRXFMM 0x7
+#define I2STXCM 0
+#define I2STXCMM 0x7
+#define I2SRXCM 3
+#define I2SRXCMM 0x3
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef SIM_ESP8266WIFI_H
+#define SIM_ESP8266WIFI_H
+
+#include <Arduino.h>
+
+//! WiFi status, as read by the LED matrix driver's debug output
+class ESP8266WiFiClass
+{
+public:
+	int32_t RSSI() { return 0; }
+	int32_t channel() { return 1; }
+	int getPhyMode() { return 0; }
+};
+extern ESP8266WiFiClass WiFi;
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef SIM_FS_H
+#define SIM_FS_H
+
+#include <Arduino.h>
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef SIM_SPI_H
+#define SIM_SPI_H
+
+#include <Arduino.h>
+
+//! SPI library; the driver programs the SPI1 registers itself
+class SPIClass
+{
+public:
+	void begin() {}
+	void setHwCs(bool) {}
+	void setFrequency(uint32_t) {}
+};
+extern SPIClass SPI;
+
+#endif
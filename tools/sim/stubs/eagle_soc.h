@@ -0,0 +1,4 @@
+#ifndef SIM_EAGLE_SOC_H
+#define SIM_EAGLE_SOC_H
+
+#endif